@@ -0,0 +1,114 @@
+#include "bench.h"
+#include "../include/lib/io.h"
+#include "../include/lib/async.h"
+#include "../include/common/gc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Reads FILES files of FILE_SIZE bytes one after another with read_file,
+// then all at once with read_file_async and await. Each run starts with the
+// files evicted from the page cache where the kernel allows it, so the
+// reads wait on the device rather than copy from memory.
+#define FILES 256
+#define FILE_SIZE (64 * 1024)
+#define ITERATIONS 5
+
+static char paths[FILES][64];
+
+static void evict() {
+    for (int i = 0; i < FILES; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static size_t read_serial() {
+    size_t total = 0;
+    for (int i = 0; i < FILES; i++) {
+        PrismValue path = STRING_VAL(paths[i]);
+        PrismValue content = prism_io_read_file(&path, 1);
+        total += strlen(AS_STRING(content));
+        // No VM is running, so the buffer is the caller's
+        free(AS_PTR(content));
+    }
+    return total;
+}
+
+// Futures and what they read belong to a heap, freed once counted
+static size_t read_async() {
+    GcHeap* heap = gc_create(NULL, NULL);
+    gc_set_current(heap);
+
+    PrismValue futures[FILES];
+    for (int i = 0; i < FILES; i++) {
+        PrismValue path = STRING_VAL(paths[i]);
+        futures[i] = prism_io_read_file_async(&path, 1);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < FILES; i++) {
+        PrismValue content = prism_io_await(&futures[i], 1);
+        total += strlen(AS_STRING(content));
+    }
+
+    gc_free(heap);
+    return total;
+}
+
+static double time_reads(size_t (*reader)()) {
+    double elapsed = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        evict();
+        double start = now_seconds();
+        if (reader() != (size_t)FILES * FILE_SIZE) {
+            fprintf(stderr, "bench: short read\n");
+            exit(1);
+        }
+        elapsed += now_seconds() - start;
+    }
+    return elapsed;
+}
+
+int main() {
+    char dir[] = "/tmp/prism_bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("bench");
+        return 1;
+    }
+
+    char* content = malloc(FILE_SIZE + 1);
+    memset(content, 'x', FILE_SIZE);
+    content[FILE_SIZE] = '\0';
+
+    GcHeap* heap = gc_create(NULL, NULL);
+    gc_set_current(heap);
+    PrismValue futures[FILES];
+    for (int i = 0; i < FILES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+        PrismValue args[] = {STRING_VAL(paths[i]), STRING_VAL(content)};
+        futures[i] = prism_io_write_file_async(args, 2);
+    }
+    for (int i = 0; i < FILES; i++) {
+        prism_io_await(&futures[i], 1);
+    }
+    gc_free(heap);
+    free(content);
+
+    double serial = time_reads(read_serial);
+    double async = time_reads(read_async);
+
+    for (int i = 0; i < FILES; i++) {
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+    prism_io_cleanup();
+
+    double megabytes = (double)FILES * FILE_SIZE * ITERATIONS / (1024 * 1024);
+    printf("read_file:       %.3fs (%.0f MB/s)\n", serial, megabytes / serial);
+    printf("read_file_async: %.3fs (%.0f MB/s, %.2fx)\n", async, megabytes / async, serial / async);
+    return 0;
+}
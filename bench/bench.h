@@ -0,0 +1,119 @@
+#ifndef PRISM_BENCH_H
+#define PRISM_BENCH_H
+
+#include "../include/core/vm.h"
+#include "../include/core/ast.h"
+#include "../include/core/codegen.h"
+#include "../include/lib/std.h"
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Fixtures shared by the benchmarks, so that each one only spells out the
+ * shape of the program it times. Programs are built as syntax trees, and
+ * the tree takes ownership of every array handed to it. */
+
+static inline double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Includes blocks big enough to be mapped on their own
+static inline size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static inline Expr* variable(const char* name) {
+    return ast_create_variable_expr(name);
+}
+
+// name(args...), with arg_count Expr* arguments
+static inline Expr* call(const char* name, int arg_count, ...) {
+    Expr** args = malloc(sizeof(Expr*) * (arg_count > 0 ? arg_count : 1));
+    va_list list;
+    va_start(list, arg_count);
+    for (int i = 0; i < arg_count; i++) {
+        args[i] = va_arg(list, Expr*);
+    }
+    va_end(list);
+    return ast_create_call_expr(variable(name), args, arg_count);
+}
+
+// function name[param] ( body... )
+static inline Stmt* function(const char* name, const char* param, Stmt** body, int body_count) {
+    char** params = malloc(sizeof(char*));
+    params[0] = (char*)param;
+    PrismType* param_types = calloc(1, sizeof(PrismType));
+    Stmt** copy = malloc(sizeof(Stmt*) * body_count);
+    memcpy(copy, body, sizeof(Stmt*) * body_count);
+    return ast_create_func_decl_stmt(name, params, param_types, 1, copy, body_count, TYPE_NONE);
+}
+
+// function name[param] ( return result )
+static inline Stmt* function_returning(const char* name, const char* param, Expr* result) {
+    Stmt* body = ast_create_return_stmt(result);
+    return function(name, param, &body, 1);
+}
+
+// A VM with the program generated and the standard natives bound
+static inline VM* load(Program* program) {
+    VM* vm = vm_create();
+    vm->code_gen = codegen_create();
+    prism_std_register_all(vm);
+    codegen_generate(vm->code_gen, program);
+    return vm;
+}
+
+// Builds function name, one level of a tree over its child one level down
+typedef Stmt* (*TreeLevel)(const char* name, const char* child, const char* param);
+
+// Declares prefix1 .. prefix<depth>, each built by level over the one
+// before it; the caller declares prefix0. Returns the name of the top
+// level, which lasts until the next call.
+static inline const char* function_tree(Program* program, const char* prefix, const char* param,
+                                        int depth, TreeLevel level) {
+    static char name[16];
+    char child[16];
+    snprintf(name, sizeof(name), "%s0", prefix);
+    for (int i = 1; i <= depth; i++) {
+        memcpy(child, name, sizeof(child));
+        snprintf(name, sizeof(name), "%s%d", prefix, i);
+        ast_add_statement(program, level(name, child, param));
+    }
+    return name;
+}
+
+// function name[param] ( return child(child(param)) )
+static inline Stmt* doubling_level(const char* name, const char* child, const char* param) {
+    return function_returning(name, param, call(child, 1, call(child, 1, variable(param))));
+}
+
+// prefixK[param] ( return prefixK-1(prefixK-1(param)) ) for K up to depth,
+// so calling the top level runs prefix0 2^depth times
+static inline const char* doubling_tree(Program* program, const char* prefix, const char* param, int depth) {
+    return function_tree(program, prefix, param, depth, doubling_level);
+}
+
+// Runs the program, exiting unless it succeeds, and returns its result
+static inline PrismValue run_checked(VM* vm) {
+    if (vm_run(vm) != INTERPRET_OK) {
+        fprintf(stderr, "bench: run failed\n");
+        exit(1);
+    }
+    return vm->stack[vm->stack_top - 1];
+}
+
+// Exits unless a run's result was the right one
+static inline void expect_result(bool right) {
+    if (!right) {
+        fprintf(stderr, "bench: wrong result\n");
+        exit(1);
+    }
+}
+
+#endif /* PRISM_BENCH_H */
@@ -0,0 +1,58 @@
+#include "bench.h"
+#include <stdio.h>
+
+// Times the widest call a frame has room for: a function with MAX_PARAMS
+// parameters and an empty body, so it returns its implicit nil, called with
+// as many arguments. One parameter more must be turned away as a stack
+// overflow rather than run off the end of the stack.
+#define MAX_PARAMS (STACK_MAX - 2)
+#define ITERATIONS 200000
+
+// function wide[p0, p1, ...] ( ) and wide(0, 1, ...)
+static Program* build_program(int width) {
+    static char names[STACK_MAX][8];
+    char* params[STACK_MAX];
+    PrismType param_types[STACK_MAX];
+    Expr* args[STACK_MAX];
+    for (int i = 0; i < width; i++) {
+        snprintf(names[i], sizeof(names[i]), "p%d", i);
+        params[i] = names[i];
+        param_types[i] = TYPE_INT;
+        args[i] = ast_create_literal_expr(INT_VAL(i));
+    }
+
+    Program* program = ast_create_program();
+    ast_add_statement(program, ast_create_func_decl_stmt("wide", params, param_types, width, NULL, 0, TYPE_NONE));
+    ast_add_statement(program, ast_create_expr_stmt(ast_create_call_expr(variable("wide"), args, width)));
+    return program;
+}
+
+int main() {
+    Program* program = build_program(MAX_PARAMS + 1);
+    VM* vm = load(program);
+    prism_set_quiet_errors(true);
+    if (vm_run(vm) != INTERPRET_RUNTIME_ERROR) {
+        fprintf(stderr, "bench: a call one argument too wide was not refused\n");
+        return 1;
+    }
+    prism_set_quiet_errors(false);
+    vm_free(vm);
+    ast_free_program(program);
+
+    program = build_program(MAX_PARAMS);
+    vm = load(program);
+    vm_run(vm);
+
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        run_checked(vm);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("calls    %d-argument call x %d runs in %.3fs: %.1f M calls/s\n",
+           MAX_PARAMS, ITERATIONS, elapsed, ITERATIONS / elapsed / 1e6);
+
+    vm_free(vm);
+    ast_free_program(program);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "bench.h"
+#include "../include/core/lexer.h"
+#include "../include/core/parser.h"
+#include "../include/common/intern.h"
+#include "../include/common/memory.h"
+#include "../include/common/error.h"
+#include "../include/common/arena.h"
+#include <stdio.h>
+
+// Lexes, parses and generates code for a script that makes STATEMENTS
+// calls through the same few names, as vm_interpret does, and reports the
+// time taken, the heap held by the tokens, AST and bytecode once it is
+// done, and how much of that is the front end's arena.
+#define STATEMENTS 20000
+#define ITERATIONS 20
+
+static char* build_source() {
+    size_t capacity = 256 + STATEMENTS * 64;
+    char* source = prism_alloc(capacity);
+    size_t length = 0;
+    
+    length += snprintf(source + length, capacity - length,
+        "function show[message: string] ( render(message) ) >> None\n"
+        "function twice[message: string] ( show(message) show(message) ) >> None\n");
+    for (int i = 0; i < STATEMENTS; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "twice(\"greeting\") show(\"farewell\")\n");
+    }
+    return source;
+}
+
+typedef struct {
+    Arena* arena;
+    Lexer* lexer;
+    Parser* parser;
+    Program* program;
+    CodeGenerator* generator;
+} Compiled;
+
+static Compiled compile(const char* source) {
+    Compiled compiled;
+    compiled.arena = arena_create();
+    arena_set_current(compiled.arena);
+    compiled.lexer = lexer_create(source, "bench");
+    lexer_scan_tokens(compiled.lexer);
+    compiled.parser = parser_create(lexer_get_tokens(compiled.lexer));
+    compiled.program = parser_parse(compiled.parser);
+    arena_set_current(NULL);
+    
+    compiled.generator = codegen_create();
+    codegen_add_native_function(compiled.generator, "render", NULL);
+    codegen_generate(compiled.generator, compiled.program);
+    if (prism_get_last_error()->type != ERROR_NONE) {
+        fprintf(stderr, "bench: compile failed\n");
+        exit(1);
+    }
+    return compiled;
+}
+
+static void release(Compiled compiled) {
+    codegen_free(compiled.generator);
+    parser_free(compiled.parser);
+    lexer_free(compiled.lexer);
+    arena_free(compiled.arena);
+}
+
+int main() {
+    char* source = build_source();
+    
+    // Warm up, which also interns every string the script uses
+    release(compile(source));
+    
+    size_t before = heap_in_use();
+    Compiled compiled = compile(source);
+    size_t held = heap_in_use() - before;
+    size_t arena = arena_size(compiled.arena);
+    release(compiled);
+    
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        release(compile(source));
+    }
+    double elapsed = now_seconds() - start;
+    
+    printf("compile %d statements: %.2fms, %zu KB held, %zu KB of it in the arena; %zu interned strings in %zu bytes\n",
+           STATEMENTS * 2, elapsed / ITERATIONS * 1e3, held / 1024, arena / 1024, intern_count(), intern_bytes());
+    prism_free(source);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "bench.h"
+#include <stdio.h>
+
+// Builds a report one line at a time, the way report scripts do: the
+// script appends LINE 2^DEPTH times to a string that starts empty, then
+// passes the result to a native, which needs it flattened.
+#define DEPTH 12
+#define LINE "item 0042    quantity 17    total 1234.56\n"
+#define ITERATIONS 10
+
+// function f0[s] ( return s + LINE )
+// function fK[s] ( return fK-1(fK-1(s)) )
+// return string(fDEPTH(""))
+static Program* build_program() {
+    Program* program = ast_create_program();
+    ast_add_statement(program, function_returning("f0", "s", ast_create_binary_expr("+",
+        variable("s"), ast_create_literal_expr(STRING_VAL(LINE)))));
+    const char* top = doubling_tree(program, "f", "s", DEPTH);
+    ast_add_statement(program, ast_create_return_stmt(call("string", 1,
+        call(top, 1, ast_create_literal_expr(STRING_VAL(""))))));
+    return program;
+}
+
+int main() {
+    Program* program = build_program();
+    VM* vm = load(program);
+
+    size_t expected = strlen(LINE) << DEPTH;
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        PrismValue result = run_checked(vm);
+        expect_result(IS_STRING(result) && strlen(AS_STRING(result)) == expected);
+    }
+    double elapsed = now_seconds() - start;
+    vm_free(vm);
+    ast_free_program(program);
+
+    printf("concat %d appends into %zu bytes; %d runs: %.3fs (%.1fM appends/s)\n",
+           1 << DEPTH, expected, ITERATIONS, elapsed,
+           (double)ITERATIONS * (1 << DEPTH) / elapsed / 1e6);
+    return 0;
+}
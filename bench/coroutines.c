@@ -0,0 +1,95 @@
+#include "bench.h"
+#include "../include/core/coroutine.h"
+#include <stdio.h>
+
+// Builds a binary tree of coroutines LEVELS deep. Every node starts both
+// children, which park at their first yield, then parks itself, so the
+// whole tree is suspended at once; resuming the root again finishes every
+// node and sums the leaves. Each node switches four times: two resumes,
+// its yield and its return.
+#define LEVELS 12
+#define ITERATIONS 20
+
+// function nK[x] ( a = coroutine(nK-1, x)  b = coroutine(nK-1, x + 1)
+//                  resume(a) resume(b) yield(x)  return resume(a) + resume(b) )
+static Stmt* node_level(const char* name, const char* child, const char* param) {
+    Expr* next = ast_create_binary_expr("+", variable(param), ast_create_literal_expr(INT_VAL(1)));
+    Stmt* node[] = {
+        ast_create_var_decl_stmt("a", TYPE_NONE, false, false, call("coroutine", 2, variable(child), variable(param))),
+        ast_create_var_decl_stmt("b", TYPE_NONE, false, false, call("coroutine", 2, variable(child), next)),
+        ast_create_expr_stmt(call("resume", 1, variable("a"))),
+        ast_create_expr_stmt(call("resume", 1, variable("b"))),
+        ast_create_expr_stmt(call("yield", 1, variable(param))),
+        ast_create_return_stmt(ast_create_binary_expr("+",
+            call("resume", 1, variable("a")), call("resume", 1, variable("b"))))
+    };
+    return function(name, param, node, 6);
+}
+
+// function n0[x] ( yield(x) return x ), then node_level up to LEVELS
+static Program* build_program(bool finish) {
+    Program* program = ast_create_program();
+
+    Stmt* leaf[] = {
+        ast_create_expr_stmt(call("yield", 1, variable("x"))),
+        ast_create_return_stmt(variable("x"))
+    };
+    ast_add_statement(program, function("n0", "x", leaf, 2));
+
+    const char* root = function_tree(program, "n", "x", LEVELS, node_level);
+    ast_add_statement(program, ast_create_var_decl_stmt("root", TYPE_NONE, false, false,
+        call("coroutine", 2, variable(root), ast_create_literal_expr(INT_VAL(0)))));
+    ast_add_statement(program, ast_create_expr_stmt(call("resume", 1, variable("root"))));
+    if (finish) {
+        ast_add_statement(program, ast_create_return_stmt(call("resume", 1, variable("root"))));
+    }
+    return program;
+}
+
+// Walks the parked coroutines reachable from values, adding up what each
+// holds. Every node of the tree is referred to by its parent alone.
+static void measure(const PrismValue* values, int count, int* coroutines, size_t* bytes) {
+    for (int i = 0; i < count; i++) {
+        if (VALUE_TYPE(values[i]) != TYPE_COROUTINE) continue;
+
+        Coroutine* coroutine = AS_PTR(values[i]);
+        *coroutines += 1;
+        *bytes += sizeof(Coroutine) + sizeof(PrismValue) * coroutine->stack_capacity +
+                  sizeof(CallFrame) * coroutine->frame_capacity;
+        measure(coroutine->stack, coroutine->stack_count, coroutines, bytes);
+    }
+}
+
+int main() {
+    // Memory held by the tree while every node is parked
+    Program* parked_program = build_program(false);
+    VM* parked = load(parked_program);
+    run_checked(parked);
+
+    int count = 0;
+    size_t bytes = 0;
+    measure(parked->globals, parked->global_count, &count, &bytes);
+    vm_free(parked);
+    ast_free_program(parked_program);
+
+    Program* program = build_program(true);
+    VM* vm = load(program);
+    vm_run(vm);
+
+    double start = now_seconds();
+    PrismValue result;
+    for (int i = 0; i < ITERATIONS; i++) {
+        result = run_checked(vm);
+    }
+    double elapsed = now_seconds() - start;
+
+    // The leaves of node K at x sum to K * 2^(K-1) more than 2^K * x
+    expect_result(IS_INT(result) && AS_INT(result) == (int64_t)LEVELS << (LEVELS - 1));
+    vm_free(vm);
+    ast_free_program(program);
+
+    double switches = 4.0 * count * ITERATIONS;
+    printf("coroutines %d parked at %zu bytes each; %d runs: %.3fs (%.1fM switches/s)\n",
+           count, bytes / count, ITERATIONS, elapsed, switches / elapsed / 1e6);
+    return 0;
+}
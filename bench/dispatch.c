@@ -0,0 +1,67 @@
+#include "bench.h"
+#include <stdio.h>
+
+// Arithmetic-heavy straight-line program: STATEMENTS expression statements,
+// each a left-folded chain of TERMS mixed int/float operations.
+#define STATEMENTS 200
+#define TERMS 24
+#define ITERATIONS 20000
+
+static Expr* literal(int n) {
+    PrismValue value = n % 5 == 0 ? FLOAT_VAL(n + 0.5) : INT_VAL(n);
+    return ast_create_literal_expr(value);
+}
+
+static Program* build_program() {
+    static char* ops[] = {"+", "*", "-", "+", "/"};
+    Program* program = ast_create_program();
+
+    for (int i = 0; i < STATEMENTS; i++) {
+        Expr* expr = literal(i + 1);
+        for (int j = 1; j < TERMS; j++) {
+            expr = ast_create_binary_expr(ops[(i + j) % 5], expr, literal(j + 1));
+        }
+        ast_add_statement(program, ast_create_expr_stmt(expr));
+    }
+
+    return program;
+}
+
+static long count_instructions(CodeChunk* chunk) {
+    long count = 0;
+    for (int ip = 0; ip < chunk->count; ip += codegen_op_length(chunk->code[ip])) {
+        if (chunk->code[ip] == OP_END) break;
+        count++;
+    }
+    return count;
+}
+
+int main() {
+#ifdef PRISM_COMPUTED_GOTO
+    const char* mode = "threaded";
+#else
+    const char* mode = "switch";
+#endif
+
+    Program* program = build_program();
+    VM* vm = load(program);
+
+    long per_run = count_instructions(&vm->code_gen->chunks[0]);
+
+    // Warm up caches and branch predictors
+    for (int i = 0; i < ITERATIONS / 10; i++) vm_run(vm);
+
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        run_checked(vm);
+    }
+    double elapsed = now_seconds() - start;
+
+    double total = (double)per_run * ITERATIONS;
+    printf("%-8s %ld instructions x %d runs in %.3fs: %.1f M instructions/s (%zu-byte values)\n",
+           mode, per_run, ITERATIONS, elapsed, total / elapsed / 1e6, sizeof(PrismValue));
+
+    vm_free(vm);
+    ast_free_program(program);
+    return 0;
+}
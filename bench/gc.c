@@ -0,0 +1,64 @@
+#include "bench.h"
+#include "../include/common/gc.h"
+#include <stdio.h>
+
+// A long-running script that formats a log line per step and throws it
+// away: 2^DEPTH steps a run, ITERATIONS runs on one VM. Reports the time
+// taken, the heap in use after the first and the last run, and the
+// collector's pauses. Without a collector the heap grows with every run.
+#define DEPTH 14
+#define ITERATIONS 20
+#define PREFIX "2025-01-01T00:00:00Z worker 7 handled request "
+
+static Expr* add(Expr* left, Expr* right) {
+    return ast_create_binary_expr("+", left, right);
+}
+
+// function f0[x] ( line -> string(PREFIX + string(x) + " in " + string(x) + "us")
+//                  return x + 1 )
+// function fK[x] ( return fK-1(fK-1(x)) )
+// return fDEPTH(0)
+static Program* build_program() {
+    Program* program = ast_create_program();
+    Expr* line = add(add(add(add(ast_create_literal_expr(STRING_VAL(PREFIX)),
+        call("string", 1, variable("x"))), ast_create_literal_expr(STRING_VAL(" in "))),
+        call("string", 1, variable("x"))), ast_create_literal_expr(STRING_VAL("us")));
+    Stmt* step[] = {
+        ast_create_var_decl_stmt("line", TYPE_NONE, false, false, call("string", 1, line)),
+        ast_create_return_stmt(add(variable("x"), ast_create_literal_expr(INT_VAL(1))))
+    };
+    ast_add_statement(program, function("f0", "x", step, 2));
+    const char* top = doubling_tree(program, "f", "x", DEPTH);
+    ast_add_statement(program, ast_create_return_stmt(call(top, 1, ast_create_literal_expr(INT_VAL(0)))));
+    return program;
+}
+
+int main() {
+    Program* program = build_program();
+    VM* vm = load(program);
+
+    size_t before = heap_in_use();
+    size_t first = 0;
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        PrismValue result = run_checked(vm);
+        expect_result(IS_INT(result) && AS_INT(result) == 1 << DEPTH);
+        if (i == 0) first = heap_in_use() - before;
+    }
+    double elapsed = now_seconds() - start;
+    size_t last = heap_in_use() - before;
+
+    GcStats stats;
+    gc_get_stats(vm->heap, &stats);
+    vm_free(vm);
+    ast_free_program(program);
+
+    uint64_t collections = stats.minor_collections + stats.major_collections;
+    double steps = (double)ITERATIONS * (1 << DEPTH);
+    printf("gc %d steps x %d runs: %.3fs (%.1fM steps/s), heap %.2f MB after the first run, %.2f MB after the last\n",
+           1 << DEPTH, ITERATIONS, elapsed, steps / elapsed / 1e6, first / 1e6, last / 1e6);
+    printf("gc %llu minor + %llu major collections, pauses %.1f us max, %.2f us mean\n",
+           (unsigned long long)stats.minor_collections, (unsigned long long)stats.major_collections,
+           stats.max_pause / 1e3, collections ? stats.total_pause / 1e3 / collections : 0.0);
+    return 0;
+}
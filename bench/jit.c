@@ -0,0 +1,116 @@
+#include "bench.h"
+#include "../include/core/jit.h"
+#include <stdio.h>
+
+// Runs a call-heavy program on the interpreter, the baseline JIT and the
+// tracing tier. Every statement is a left-folded sum of calls to one small
+// arithmetic function, so once it turns hot nearly all instructions run as
+// machine code.
+#define STATEMENTS 40
+#define CALLS 50
+#define ITERATIONS 2000
+
+static Expr* binary(const char* op, Expr* left, Expr* right) {
+    return ast_create_binary_expr(op, left, right);
+}
+
+// function hot[a, b] ( c = a * b - a  d = c + b * 3  return d * 2 - c + a )
+static Stmt* hot_function() {
+    char** params = malloc(sizeof(char*) * 2);
+    params[0] = "a";
+    params[1] = "b";
+    PrismType* param_types = calloc(2, sizeof(PrismType));
+
+    Stmt** body = malloc(sizeof(Stmt*) * 3);
+    body[0] = ast_create_var_decl_stmt("c", TYPE_NONE, false, false,
+        binary("-", binary("*", variable("a"), variable("b")), variable("a")));
+    body[1] = ast_create_var_decl_stmt("d", TYPE_NONE, false, false,
+        binary("+", variable("c"), binary("*", variable("b"), ast_create_literal_expr(INT_VAL(3)))));
+    body[2] = ast_create_return_stmt(
+        binary("+", binary("-", binary("*", variable("d"), ast_create_literal_expr(INT_VAL(2))),
+                                variable("c")),
+                    variable("a")));
+
+    return ast_create_func_decl_stmt("hot", params, param_types, 2, body, 3, TYPE_NONE);
+}
+
+static Expr* call_hot(int a, int b) {
+    return call("hot", 2, ast_create_literal_expr(INT_VAL(a)), ast_create_literal_expr(INT_VAL(b)));
+}
+
+static Expr* sum_of_calls(int seed) {
+    Expr* expr = call_hot(seed, 1);
+    for (int j = 1; j < CALLS; j++) {
+        expr = binary("+", expr, call_hot(seed + j, j % 7));
+    }
+    return expr;
+}
+
+static Program* build_program() {
+    Program* program = ast_create_program();
+    ast_add_statement(program, hot_function());
+
+    for (int i = 0; i < STATEMENTS; i++) {
+        ast_add_statement(program, ast_create_expr_stmt(sum_of_calls(i)));
+    }
+    ast_add_statement(program, ast_create_return_stmt(sum_of_calls(STATEMENTS)));
+    return program;
+}
+
+static double time_runs(VM* vm, PrismValue* result) {
+    vm_run(vm);
+
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        *result = run_checked(vm);
+    }
+    return now_seconds() - start;
+}
+
+static double run_mode(bool use_jit, bool use_tracing, PrismValue* result) {
+    Program* program = build_program();
+    VM* vm = vm_create();
+    vm->use_jit = use_jit;
+    vm->use_tracing = use_tracing;
+    vm->code_gen = codegen_create();
+    codegen_generate(vm->code_gen, program);
+
+    double elapsed = time_runs(vm, result);
+
+    if (use_jit && !vm->code_gen->functions[1]->jit) {
+        fprintf(stderr, "bench: hot function was not compiled\n");
+        exit(1);
+    }
+    if (use_tracing && !trace_find(vm->code_gen->functions[1], 0)) {
+        fprintf(stderr, "bench: no trace was recorded\n");
+        exit(1);
+    }
+
+    vm_free(vm);
+    ast_free_program(program);
+    return elapsed;
+}
+
+int main() {
+#ifndef PRISM_JIT
+    printf("jit      not available on this platform\n");
+    return 0;
+#endif
+
+    PrismValue interpreted, compiled, traced;
+    double interpreted_time = run_mode(false, false, &interpreted);
+    double compiled_time = run_mode(true, false, &compiled);
+    double traced_time = run_mode(false, true, &traced);
+
+    if (!IS_INT(interpreted) || !IS_INT(compiled) || !IS_INT(traced) ||
+        AS_INT(interpreted) != AS_INT(compiled) || AS_INT(interpreted) != AS_INT(traced)) {
+        fprintf(stderr, "bench: results differ between interpreter and JIT\n");
+        return 1;
+    }
+
+    printf("jit      %d calls x %d runs: interpreter %.3fs, jit %.3fs (%.2fx), trace %.3fs (%.2fx)\n",
+           (STATEMENTS + 1) * CALLS, ITERATIONS, interpreted_time,
+           compiled_time, interpreted_time / compiled_time,
+           traced_time, interpreted_time / traced_time);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "bench.h"
+#include "../include/core/lexer.h"
+#include "../include/core/scan.h"
+#include "../include/common/memory.h"
+#include "../include/common/error.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+// Lexes a large generated script with each set of scanning kernels the CPU
+// supports and reports the throughput, along with that of the line kernel
+// on its own. The script has the usual mix of indented code, comments and
+// string literals, some long and some spread over several lines. Every set
+// must produce the same tokens.
+#define SOURCE_SIZE (32 * 1024 * 1024)
+#define ITERATIONS 20
+
+static const char* const SNIPPETS[] = {
+    "!! Formats one record of the nightly report and hands it to the writer\n"
+    "function format_record[record_identifier: string, quantity: int] (\n"
+    "    internal formatted_line -> concat(record_identifier, string(quantity))\n"
+    "    write_report_line(formatted_line, \"   \", 1.25)\n"
+    ") >> None\n",
+    "exposed greeting -> \"Hello from the generated configuration module, which has a long banner\"\n",
+    "        log_message(\"multi-line\n    help text for the\n    command line\", verbose_level)\n",
+    "prism Aggregator ( collect(first_partition, second_partition, third_partition) ) >> None\n",
+    "\n"
+    "!! ----------------------------------------------------------------------------\n"
+    "!! Section boundary generated by the template engine, kept for readability\n"
+    "!! ----------------------------------------------------------------------------\n\n",
+};
+
+// Bytes per token: a type, a start and a length
+#define TOKEN_SIZE (sizeof(uint8_t) + 2 * sizeof(uint32_t))
+
+static bool same_tokens(TokenList* a, TokenList* b) {
+    return a->count == b->count &&
+           memcmp(a->types, b->types, sizeof(uint8_t) * a->count) == 0 &&
+           memcmp(a->starts, b->starts, sizeof(uint32_t) * a->count) == 0 &&
+           memcmp(a->lengths, b->lengths, sizeof(uint32_t) * a->count) == 0;
+}
+
+static char* build_source(size_t* length) {
+    char* source = prism_alloc(SOURCE_SIZE + 256);
+    size_t used = 0;
+    int snippet_count = sizeof(SNIPPETS) / sizeof(SNIPPETS[0]);
+
+    for (int i = 0; used < SOURCE_SIZE; i++) {
+        const char* snippet = SNIPPETS[i % snippet_count];
+        size_t size = strlen(snippet);
+        memcpy(source + used, snippet, size);
+        used += size;
+    }
+    source[used] = '\0';
+    *length = used;
+    return source;
+}
+
+// CPU time spent in user mode. Faulting in the token arrays costs every
+// level the same and varies far more than what the kernels save. It is
+// counted in ticks, so lexing times are averaged rather than the best taken.
+static double user_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+}
+
+// Lexes the source with the kernels at level, checking the tokens against
+// reference, and returns the user time it took
+static double time_lexing(const char* source, ScanLevel level, Lexer* reference) {
+    scan_set_level(level);
+    double start = user_seconds();
+    Lexer* lexer = lexer_create(source, "bench");
+    lexer_scan_tokens(lexer);
+    double elapsed = user_seconds() - start;
+
+    if (prism_get_last_error()->type != ERROR_NONE) {
+        fprintf(stderr, "bench: lexing failed\n");
+        exit(1);
+    }
+    if (!same_tokens(lexer_get_tokens(lexer), lexer_get_tokens(reference))) {
+        fprintf(stderr, "bench: %s kernels produced different tokens\n", scan_kernels()->name);
+        exit(1);
+    }
+    lexer_free(lexer);
+    return elapsed;
+}
+
+// Steps over the source a line at a time with the line kernel alone, the
+// way comments and string bodies are scanned once they run past a few bytes
+static double time_lines(const char* source, ScanLevel level) {
+    scan_set_level(level);
+    size_t (*line)(const char* p) = scan_kernels()->line;
+    double start = now_seconds();
+    const char* p = source;
+    while (*p) {
+        p += line(p);
+        if (*p) p++;
+    }
+    return now_seconds() - start;
+}
+
+int main() {
+    size_t length;
+    char* source = build_source(&length);
+    ScanLevel best_level = scan_best_level();
+    double lexing[SCAN_AVX2 + 1] = {0};
+    double lines[SCAN_AVX2 + 1] = {0};
+
+    scan_set_level(SCAN_SCALAR);
+    Lexer* reference = lexer_create(source, "bench");
+    lexer_scan_tokens(reference);
+
+    // Levels take turns, so that drift in the machine's speed hits them alike
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (ScanLevel level = SCAN_SCALAR; level <= best_level; level++) {
+            lexing[level] += time_lexing(source, level, reference) / ITERATIONS;
+            double elapsed = time_lines(source, level);
+            if (lines[level] == 0 || elapsed < lines[level]) lines[level] = elapsed;
+        }
+    }
+
+    int count = lexer_get_tokens(reference)->count;
+    for (ScanLevel level = SCAN_SCALAR; level <= best_level; level++) {
+        scan_set_level(level);
+        printf("lexer %-6s %.0f MB, %d tokens in %.0f MB: %.1fms, %.0f MB/s; lines alone %.0f MB/s\n",
+               scan_kernels()->name, length / 1e6, count, count * TOKEN_SIZE / 1e6,
+               lexing[level] * 1e3, length / lexing[level] / 1e6, length / lines[level] / 1e6);
+    }
+
+    lexer_free(reference);
+    prism_free(source);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "bench.h"
+#include "../include/core/pool.h"
+#include "../include/common/memory.h"
+#include <stdio.h>
+
+// Runs the same batch of independent scripts on one worker and on one
+// worker per core. Each script declares a few functions and makes
+// STATEMENTS calls through them to the standard library, so a job covers
+// the whole pipeline from lexing to output.
+#define SCRIPTS 64
+#define STATEMENTS 2000
+
+static char* build_source(int seed) {
+    size_t capacity = 256 + STATEMENTS * 64;
+    char* source = prism_alloc(capacity);
+    size_t length = 0;
+
+    length += snprintf(source + length, capacity - length,
+        "function show[x: string] ( render(string(int(x))) ) >> None\n"
+        "function twice[x: string] ( show(x) show(x) ) >> None\n");
+    for (int i = 0; i < STATEMENTS; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "twice(\"%d\")\n", seed * STATEMENTS + i);
+    }
+    return source;
+}
+
+static double run_batch(int workers, PrismJob* jobs, char** sources, int* worker_count) {
+    WorkerPool* pool = pool_create(workers);
+    if (!pool) {
+        fprintf(stderr, "bench: could not start workers\n");
+        exit(1);
+    }
+    *worker_count = pool_worker_count(pool);
+
+    double start = now_seconds();
+    for (int i = 0; i < SCRIPTS; i++) {
+        jobs[i].source = sources[i];
+        jobs[i].filename = "bench";
+        jobs[i].use_jit = false;
+        jobs[i].use_tracing = false;
+        pool_submit(pool, &jobs[i]);
+    }
+    pool_wait(pool);
+    double elapsed = now_seconds() - start;
+
+    pool_free(pool);
+    for (int i = 0; i < SCRIPTS; i++) {
+        if (jobs[i].result != INTERPRET_OK || !jobs[i].output) {
+            fprintf(stderr, "bench: script %d failed\n", i);
+            exit(1);
+        }
+    }
+    return elapsed;
+}
+
+int main() {
+    char* sources[SCRIPTS];
+    for (int i = 0; i < SCRIPTS; i++) {
+        sources[i] = build_source(i);
+    }
+
+    PrismJob serial[SCRIPTS];
+    PrismJob parallel[SCRIPTS];
+    int serial_workers, parallel_workers;
+    double serial_time = run_batch(1, serial, sources, &serial_workers);
+    double parallel_time = run_batch(0, parallel, sources, &parallel_workers);
+
+    for (int i = 0; i < SCRIPTS; i++) {
+        if (serial[i].output_size != parallel[i].output_size ||
+            memcmp(serial[i].output, parallel[i].output, serial[i].output_size) != 0) {
+            fprintf(stderr, "bench: output of script %d differs between runs\n", i);
+            return 1;
+        }
+        prism_free(serial[i].output);
+        prism_free(parallel[i].output);
+        prism_free(sources[i]);
+    }
+
+    printf("pool     %d scripts: 1 worker %.3fs, %d workers %.3fs (%.2fx)\n",
+           SCRIPTS, serial_time, parallel_workers, parallel_time, serial_time / parallel_time);
+    return 0;
+}
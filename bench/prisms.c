@@ -0,0 +1,64 @@
+#include "bench.h"
+#include "../include/common/memory.h"
+#include <stdio.h>
+
+// Runs a script made of PRISMS independent prisms with and without
+// use_parallel. Each prism fans out through LEVELS of functions, each
+// calling the one below it four times, down to conversions in the standard
+// library, so every prism is worth a task of its own.
+#define PRISMS 8
+#define LEVELS 7
+#define RUNS 3
+
+static char* build_source() {
+    size_t capacity = 256 + (LEVELS + PRISMS) * 128;
+    char* source = prism_alloc(capacity);
+    size_t length = 0;
+
+    length += snprintf(source + length, capacity - length,
+        "function w0[x: string] ( string(int(x)) string(float(x)) type(x) ) >> None\n");
+    for (int i = 1; i <= LEVELS; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "function w%d[x: string] ( w%d(x) w%d(x) w%d(x) w%d(x) ) >> None\n",
+                           i, i - 1, i - 1, i - 1, i - 1);
+    }
+    for (int i = 0; i < PRISMS; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "prism p%d ( w%d(\"%d\") ) >> None\n", i, LEVELS, i);
+    }
+    for (int i = 0; i < PRISMS; i++) {
+        length += snprintf(source + length, capacity - length, "p%d()\n", i);
+    }
+    return source;
+}
+
+static double run_script(const char* source, bool use_parallel) {
+    double best = 0;
+    for (int i = 0; i < RUNS; i++) {
+        VM* vm = vm_create();
+        vm->use_parallel = use_parallel;
+
+        double start = now_seconds();
+        InterpretResult result = vm_interpret(vm, source, "bench");
+        double elapsed = now_seconds() - start;
+        vm_free(vm);
+
+        if (result != INTERPRET_OK) {
+            fprintf(stderr, "bench: script failed\n");
+            exit(1);
+        }
+        if (i == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+int main() {
+    char* source = build_source();
+    double inline_time = run_script(source, false);
+    double parallel_time = run_script(source, true);
+    prism_free(source);
+
+    printf("prisms   %d prisms: inline %.3fs, on the scheduler %.3fs (%.2fx)\n",
+           PRISMS, inline_time, parallel_time, inline_time / parallel_time);
+    return 0;
+}
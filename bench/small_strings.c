@@ -0,0 +1,47 @@
+#include "bench.h"
+#include <stdio.h>
+
+// Makes 2^DEPTH steps that each ask for a type name and round-trip a
+// counter through its decimal string, and reports the time taken and the
+// malloc heap still in use after the runs, per step. Type names and short
+// counters fit inside the value, so that should stay at zero. Longer
+// strings would show up as the nursery and what the collector still holds.
+#define DEPTH 14
+#define ITERATIONS 20
+
+// function f0[x] ( t -> type(x)  return int(string(x)) + 1 )
+// function fK[x] ( return fK-1(fK-1(x)) )
+// return fDEPTH(0)
+static Program* build_program() {
+    Program* program = ast_create_program();
+    Stmt* step[] = {
+        ast_create_var_decl_stmt("t", TYPE_NONE, false, false, call("type", 1, variable("x"))),
+        ast_create_return_stmt(ast_create_binary_expr("+",
+            call("int", 1, call("string", 1, variable("x"))), ast_create_literal_expr(INT_VAL(1))))
+    };
+    ast_add_statement(program, function("f0", "x", step, 2));
+    const char* top = doubling_tree(program, "f", "x", DEPTH);
+    ast_add_statement(program, ast_create_return_stmt(call(top, 1, ast_create_literal_expr(INT_VAL(0)))));
+    return program;
+}
+
+int main() {
+    Program* program = build_program();
+    VM* vm = load(program);
+
+    size_t before = mallinfo2().uordblks;
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++) {
+        PrismValue result = run_checked(vm);
+        expect_result(IS_INT(result) && AS_INT(result) == 1 << DEPTH);
+    }
+    double elapsed = now_seconds() - start;
+    double held = (double)(mallinfo2().uordblks - before);
+    vm_free(vm);
+    ast_free_program(program);
+
+    double steps = (double)ITERATIONS * (1 << DEPTH);
+    printf("small strings %d steps x %d runs: %.3fs (%.1fM steps/s), %.1f heap bytes per step\n",
+           1 << DEPTH, ITERATIONS, elapsed, steps / elapsed / 1e6, held / steps);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "bench.h"
+#include <stdio.h>
+
+// Round-robins SCRIPTS scripts on one thread behind a script that never
+// finishes. Each finite script makes 2^DEPTH - 1 calls; the runaway tail
+// calls itself forever. Every turn a script gets either FUEL checkpoints
+// or SLICE_NS of wall-clock time, and the time until each finite script
+// completes is its latency. Without slicing the first turn never ends.
+#define SCRIPTS 64
+#define DEPTH 12
+#define FUEL 1000
+#define SLICE_NS 100000
+#define ITERATIONS 20
+
+// function fK[x] ( return fK-1(x) + fK-1(x) )
+static Stmt* sum_level(const char* name, const char* child, const char* param) {
+    return function_returning(name, param, ast_create_binary_expr("+",
+        call(child, 1, variable(param)), call(child, 1, variable(param))));
+}
+
+// function f0[x] ( return x ), then sum_level up to DEPTH
+static Program* build_tree() {
+    Program* program = ast_create_program();
+    ast_add_statement(program, function_returning("f0", "x", variable("x")));
+    const char* top = function_tree(program, "f", "x", DEPTH, sum_level);
+    ast_add_statement(program, ast_create_return_stmt(call(top, 1, ast_create_literal_expr(INT_VAL(1)))));
+    return program;
+}
+
+// function spin[x] ( return spin(x + 1) )
+static Program* build_runaway() {
+    Program* program = ast_create_program();
+    ast_add_statement(program, function_returning("spin", "x", call("spin", 1,
+        ast_create_binary_expr("+", variable("x"), ast_create_literal_expr(INT_VAL(1))))));
+    ast_add_statement(program, ast_create_return_stmt(call("spin", 1, ast_create_literal_expr(INT_VAL(0)))));
+    return program;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Runs the runaway and the finite scripts in turn until every finite one
+// is done, filling latencies in seconds
+static void round_robin(VM** vms, bool by_fuel, double* latencies) {
+    bool started[SCRIPTS + 1] = {false};
+    bool finished[SCRIPTS + 1] = {false};
+    int remaining = SCRIPTS;
+    double start = now_seconds();
+    
+    while (remaining > 0) {
+        for (int i = 0; i <= SCRIPTS; i++) {
+            if (finished[i]) continue;
+            if (by_fuel) {
+                vm_set_fuel(vms[i], FUEL);
+            } else {
+                vm_set_deadline(vms[i], SLICE_NS);
+            }
+            
+            InterpretResult result = started[i] ? vm_resume(vms[i]) : vm_run(vms[i]);
+            started[i] = true;
+            if (result == INTERPRET_SUSPENDED) continue;
+            if (result != INTERPRET_OK || i == 0 ||
+                AS_INT(vms[i]->stack[vms[i]->stack_top - 1]) != 1 << DEPTH) {
+                fprintf(stderr, "bench: script %d failed\n", i);
+                exit(1);
+            }
+            finished[i] = true;
+            latencies[i - 1] = now_seconds() - start;
+            remaining--;
+        }
+    }
+}
+
+static void report(const char* label, VM** vms, bool by_fuel) {
+    double latencies[SCRIPTS];
+    double all[SCRIPTS * ITERATIONS];
+    for (int i = 0; i < ITERATIONS; i++) {
+        round_robin(vms, by_fuel, latencies);
+        memcpy(&all[i * SCRIPTS], latencies, sizeof(latencies));
+    }
+    qsort(all, SCRIPTS * ITERATIONS, sizeof(double), compare_doubles);
+    printf("%-24s p50 %.2fms  p99 %.2fms  max %.2fms\n", label,
+           all[SCRIPTS * ITERATIONS / 2] * 1e3, all[SCRIPTS * ITERATIONS * 99 / 100] * 1e3,
+           all[SCRIPTS * ITERATIONS - 1] * 1e3);
+}
+
+int main() {
+    Program* runaway = build_runaway();
+    Program* tree = build_tree();
+    VM* vms[SCRIPTS + 1];
+    vms[0] = load(runaway);
+    for (int i = 1; i <= SCRIPTS; i++) {
+        vms[i] = load(tree);
+    }
+    
+    // What a checkpoint costs: the same calls without a limit and with one
+    // that never runs out
+    double plain = 0, limited = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        vm_set_fuel(vms[1], -1);
+        double start = now_seconds();
+        vm_run(vms[1]);
+        plain += now_seconds() - start;
+        
+        vm_set_fuel(vms[1], INT64_MAX);
+        vm_set_deadline(vms[1], 1000000000000LL);
+        start = now_seconds();
+        vm_run(vms[1]);
+        limited += now_seconds() - start;
+    }
+    vm_set_deadline(vms[1], -1);
+    double calls = (double)((1 << (DEPTH + 1)) - 1) * ITERATIONS;
+    printf("checkpoints: %.1fns/call unlimited, %.1fns/call with fuel and a deadline\n",
+           plain / calls * 1e9, limited / calls * 1e9);
+    
+    char label[64];
+    snprintf(label, sizeof(label), "fuel %d per turn:", FUEL);
+    report(label, vms, true);
+    for (int i = 0; i <= SCRIPTS; i++) {
+        vm_set_fuel(vms[i], -1);
+    }
+    snprintf(label, sizeof(label), "deadline %dus per turn:", SLICE_NS / 1000);
+    report(label, vms, false);
+    
+    for (int i = 0; i <= SCRIPTS; i++) {
+        vm_free(vms[i]);
+    }
+    ast_free_program(runaway);
+    ast_free_program(tree);
+    return 0;
+}
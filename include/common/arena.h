@@ -0,0 +1,49 @@
+#ifndef PRISM_ARENA_H
+#define PRISM_ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocation for memory that dies all at once. An arena hands out
+ * memory from a list of chunks, each twice the size of the last up to a
+ * limit, and frees all of it in arena_free. Nothing allocated from an arena
+ * is freed on its own.
+ *
+ * The front end compiles a script inside an arena: while one is the
+ * calling thread's current arena, the lexer's tokens and every AST node and
+ * array are allocated from it, and the driver frees the lot once code has
+ * been generated. Without a current arena they come from prism_alloc and
+ * are freed by ast_free_program, as host code that builds trees by hand
+ * expects.
+ *
+ * Memory from an arena is 16-byte aligned and, unlike prism_alloc's, not
+ * zeroed. */
+
+typedef struct Arena Arena;
+typedef struct ArenaChunk ArenaChunk;
+
+// A point to rewind to, see arena_rewind
+typedef struct {
+    ArenaChunk* chunk;
+    size_t used;
+} ArenaMark;
+
+Arena* arena_create();
+void arena_free(Arena* arena);
+
+Arena* arena_current();
+void arena_set_current(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size);
+// Like prism_realloc. Grows in place when ptr is the last allocation and
+// its chunk has room, otherwise copies.
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+// Rewinding gives back everything allocated since the mark was taken, for
+// reuse by later allocations. Marks must be rewound to in reverse order.
+ArenaMark arena_mark(Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+// Bytes in the arena's chunks
+size_t arena_size(Arena* arena);
+
+#endif /* PRISM_ARENA_H */
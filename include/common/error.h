@@ -1,6 +1,8 @@
 #ifndef PRISM_ERROR_H
 #define PRISM_ERROR_H
 
+#include <stdbool.h>
+
 typedef enum {
     ERROR_NONE,
     ERROR_SYNTAX,
@@ -18,9 +20,22 @@ typedef struct {
     char* filename;
 } PrismError;
 
+/* Errors are recorded in the calling thread's current error state. Each VM
+ * has its own, which is current while one of the VM's entry points runs,
+ * so VMs taking turns on one thread never see each other's errors.
+ * Outside any VM, a thread records errors in a state of its own. */
 void prism_error(const char* format, ...);
 void prism_error_at(const char* filename, int line, int column, const char* format, ...);
+// The most recent error in the current error state
 PrismError* prism_get_last_error();
 void prism_clear_error();
+// Makes error the calling thread's current error state, or the thread's
+// own state if NULL
+void prism_set_error_state(PrismError* error);
+// Frees an error state's message and filename, leaving it with no error
+void prism_reset_error(PrismError* error);
+// Records the calling thread's errors without printing them, for work that
+// is redone elsewhere if it fails
+void prism_set_quiet_errors(bool quiet);
 
 #endif /* PRISM_ERROR_H */
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef PRISM_GC_H
+#define PRISM_GC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Garbage collection for strings, ropes, boxed ints, coroutines and
+ * futures made while a script runs.
+ *
+ * Every VM owns a heap, which is the calling thread's current heap while
+ * the VM runs. New objects are bump-allocated in the heap's nursery. A
+ * minor collection copies the nursery objects that are still reachable
+ * into the old generation and empties the nursery. The old generation is
+ * mark-sweep and its objects never move. Large objects, allocations made
+ * once the nursery is full, and coroutines and futures, which the VM and
+ * the kernel hold plain pointers to, go straight to the old generation.
+ *
+ * The collector is precise. The VM hands it every root: the stack, the
+ * globals, the running coroutines and the constant pools. Parked
+ * coroutines are traced like ropes, through whatever refers to them.
+ * Collections only happen at the VM's checkpoints
+ * (calls and resumes), where every live value is in one of those, so C
+ * code between two checkpoints can hold plain pointers safely. An
+ * allocation never collects; it only asks for a collection at the next
+ * checkpoint.
+ *
+ * Without a current heap, as in compiled programs and host code, the
+ * allocation functions fall back to plain malloc and nothing is freed. Pointers the collector doesn't own, such as interned
+ * constants, are left alone. */
+
+typedef enum {
+    GC_STRING,      // NUL-terminated characters
+    GC_ROPE,        // A PrismRope, whose halves and flat buffer are traced
+    GC_BIGINT,      // An int64_t too wide for a NaN-boxed value's payload
+    GC_COROUTINE,   // A Coroutine (see coroutine.h)
+    GC_FUTURE,      // A PrismFuture (see async.h)
+    GC_KIND_COUNT
+} GcKind;
+
+typedef struct GcHeap GcHeap;
+
+// Teaches the collector a kind defined outside common/. trace, during a
+// collection, passes the values the object refers to to gc_visit; finalize
+// releases what the object owns just before it is freed. Either may be
+// NULL. Define a kind before allocating any object of it.
+void gc_define_kind(GcKind kind, void (*trace)(GcHeap* heap, void* object),
+                    void (*finalize)(void* object));
+
+typedef struct {
+    uint64_t minor_collections;
+    uint64_t major_collections;
+    int64_t total_pause;        // nanoseconds
+    int64_t max_pause;
+    int64_t last_pause;
+    size_t nursery_size;
+    size_t nursery_used;
+    size_t old_bytes;           // payload bytes in the old generation
+    size_t old_objects;
+    size_t promoted_bytes;      // copied out of the nursery, ever
+    size_t freed_bytes;         // freed from the old generation, ever
+} GcStats;
+
+// request(data) is called, on the thread using the heap, when it first
+// wants a collection
+GcHeap* gc_create(void (*request)(void* data), void* data);
+// Frees every object in the heap
+void gc_free(GcHeap* heap);
+
+GcHeap* gc_current();
+void gc_set_current(GcHeap* heap);
+
+// From the current heap. gc_alloc_string leaves room for length bytes and
+// a NUL, which it writes.
+void* gc_alloc(GcKind kind, size_t size);
+char* gc_alloc_string(size_t length);
+
+// Call after storing a reference into a collected object that already
+// existed, so an old object pointing at a new one is found by a minor
+// collection. A coroutine or future is remembered once per collection, so
+// repeating this for one is cheap.
+void gc_write_barrier(GcKind kind, void* object);
+
+/* A collection. Everything reachable must be passed to gc_visit between
+ * gc_begin and gc_end; references to objects that moved are updated in
+ * place. A full collection also sweeps the old generation, and one is
+ * made anyway once it has grown enough since the last. */
+bool gc_pending(GcHeap* heap);
+void gc_begin(GcHeap* heap, bool full);
+void gc_visit(GcHeap* heap, PrismValue* values, int count);
+void gc_end(GcHeap* heap);
+
+void gc_get_stats(GcHeap* heap, GcStats* stats);
+
+#endif /* PRISM_GC_H */
@@ -0,0 +1,26 @@
+#ifndef PRISM_INTERN_H
+#define PRISM_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interned strings. Each distinct string is stored once for the life of
+ * the process, with its hash and length in a header just before the
+ * characters, so an interned string is an ordinary NUL-terminated C string
+ * that is never freed. Two interned strings are equal exactly when their
+ * pointers are. The lexer, AST, symbol table and constant pools all hold
+ * interned strings and pass them around without copying. The table is
+ * shared by every thread behind a lock. */
+
+const char* intern_string(const char* chars, size_t length);
+const char* intern_cstring(const char* chars);
+
+// Only for strings returned by the functions above
+uint32_t interned_hash(const char* string);
+size_t interned_length(const char* string);
+
+// Distinct strings interned so far, and the bytes they take up
+size_t intern_count();
+size_t intern_bytes();
+
+#endif /* PRISM_INTERN_H */
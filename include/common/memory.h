@@ -9,7 +9,9 @@ void* prism_alloc(size_t size);
 void* prism_realloc(void* ptr, size_t size);
 void prism_free(void* ptr);
 
-/* Value management */
+/* Value management. Freeing a value or variable, or overwriting one with
+ * prism_value_set, never frees the string it held: strings belong to the
+ * garbage collector, the intern table or whoever made them. */
 PrismValue* prism_value_create(PrismType type);
 void prism_value_free(PrismValue* value);
 
@@ -0,0 +1,45 @@
+#ifndef PRISM_ROPE_H
+#define PRISM_ROPE_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* Strings built by concatenation. Adding two strings makes a TYPE_ROPE node
+ * that points at both halves instead of copying them, so building a string
+ * piece by piece costs time in proportion to the pieces rather than to the
+ * string so far. Short results are still copied into a plain string, and
+ * a short piece appended to a rope is merged into its last leaf, so ropes
+ * stay shallow for the common "s + piece" pattern.
+ *
+ * A rope is flattened into contiguous bytes only when something needs a C
+ * string: natives get flattened arguments, and formatting a rope flattens
+ * it. The result is kept in the node, so flattening twice is free. Scripts
+ * can't tell a rope from a string; type() calls both "string".
+ *
+ * Flattening writes to the node, so a rope that hasn't been flattened must
+ * stay on the thread that built it. */
+
+typedef struct {
+    size_t length;
+    size_t depth;
+    char* flat;         // Whole contents once flattened, NULL until then
+    PrismValue left;    // Halves, each a string or a rope, until flattened
+    PrismValue right;
+} PrismRope;
+
+// Strings as scripts see them
+#define IS_TEXT(v) (IS_STRING(v) || IS_ROPE(v))
+
+// a + b for two IS_TEXT values
+PrismValue rope_concat(PrismValue a, PrismValue b);
+
+char* rope_flatten(PrismRope* rope);
+
+// A rope as a plain string; anything else is returned unchanged
+PrismValue rope_flatten_value(PrismValue value);
+
+// Flattens arguments in place before they are handed to a native. Natives
+// only ever see plain strings.
+void rope_flatten_args(PrismValue* args, int arg_count);
+
+#endif /* PRISM_ROPE_H */
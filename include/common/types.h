@@ -1,6 +1,7 @@
 #ifndef PRISM_TYPES_H
 #define PRISM_TYPES_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -12,20 +13,180 @@ typedef enum {
     TYPE_STRING,
     TYPE_FUNCTION,
     TYPE_NATIVE,
-    TYPE_PRISM
+    TYPE_PRISM,
+    TYPE_COROUTINE,
+    TYPE_FUTURE,
+    TYPE_ROPE
 } PrismType;
 
+/* Values are only ever touched through the accessor macros below, so the
+ * representation can be chosen at build time:
+ *
+ *   default             tagged struct, 16 bytes
+ *   PRISM_NAN_BOXING    one 64-bit word, 8 bytes
+ *
+ * IS_x(v) tests the type, AS_x(v) extracts the payload and x_VAL(...)
+ * builds a value. VALUE_TYPE(v) returns the PrismType. Function values
+ * carry a pointer to their FunctionProto.
+ *
+ * Strings of up to PRISM_SMALL_STRING_MAX bytes can be stored inside the
+ * value instead of on the heap; prism_string_value() makes one when the
+ * characters fit. They are TYPE_STRING like any other, and AS_STRING(v)
+ * points into v itself, so v must be an lvalue and the pointer is only
+ * good while v is. IS_SMALL_STRING(v) tells them apart where it matters,
+ * such as before freeing. */
+
+#ifdef PRISM_NAN_BOXING
+
+#include <string.h>
+
+/* Doubles are stored as-is. Everything else lives in the negative quiet-NaN
+ * space: sign, exponent and quiet bit set (the top 13 bits), a 4-bit tag in
+ * bits 47-50 and a 47-bit payload, which is wide enough for user-space
+ * pointers on x86-64 and AArch64. The tag is the PrismType plus one, so
+ * tag 0 never appears; NaNs produced by arithmetic are canonicalised to a
+ * positive quiet NaN so they can't be mistaken for a boxed value. Ints that
+ * don't fit the 47-bit payload are boxed on the heap under NANBOX_TAG_BIGINT
+ * and still report TYPE_INT. */
+typedef uint64_t PrismValue;
+
+#define NANBOX_PREFIX        0xFFF8000000000000ULL
+#define NANBOX_TAG_SHIFT     47
+#define NANBOX_TAG_BITS      0xFULL
+#define NANBOX_PAYLOAD_MASK  0x00007FFFFFFFFFFFULL
+#define NANBOX_CANONICAL_NAN 0x7FF8000000000000ULL
+#define NANBOX_TAG_BIGINT    0xFULL
+
+/* A small string keeps its characters in the low five bytes of the word,
+ * zero padded. The tag is even, so on a little-endian machine byte five is
+ * zero and terminates them. */
+#define NANBOX_TAG_SMALL_STRING 0xEULL
+#define PRISM_SMALL_STRING_MAX  5
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "NaN-boxed small strings need a little-endian target"
+#endif
+
+#define NANBOX_SMALL_INT_MIN (-(INT64_C(1) << 46))
+#define NANBOX_SMALL_INT_MAX ((INT64_C(1) << 46) - 1)
+
+#define NANBOX_IS_BOXED(v)   (((v) & NANBOX_PREFIX) == NANBOX_PREFIX)
+#define NANBOX_TAG(v)        (((v) >> NANBOX_TAG_SHIFT) & NANBOX_TAG_BITS)
+#define NANBOX_TAG_OF(type)  ((uint64_t)(type) + 1)
+#define NANBOX_MAKE(tag, payload) \
+    (NANBOX_PREFIX | ((uint64_t)(tag) << NANBOX_TAG_SHIFT) | ((uint64_t)(payload) & NANBOX_PAYLOAD_MASK))
+#define NANBOX_HAS_TAG(v, tag) (NANBOX_IS_BOXED(v) && NANBOX_TAG(v) == (tag))
+
+PrismValue prism_box_int(int64_t i);
+
+static inline PrismType prism_value_type(PrismValue v) {
+    if (!NANBOX_IS_BOXED(v)) return TYPE_FLOAT;
+    uint64_t tag = NANBOX_TAG(v);
+    if (tag == NANBOX_TAG_BIGINT) return TYPE_INT;
+    if (tag == NANBOX_TAG_SMALL_STRING) return TYPE_STRING;
+    return (PrismType)(tag - 1);
+}
+
+static inline double prism_value_as_float(PrismValue v) {
+    double f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static inline PrismValue prism_value_from_float(double f) {
+    PrismValue v;
+    if (f != f) return NANBOX_CANONICAL_NAN;
+    memcpy(&v, &f, sizeof(v));
+    return v;
+}
+
+static inline int64_t prism_value_as_int(PrismValue v) {
+    if (NANBOX_TAG(v) == NANBOX_TAG_OF(TYPE_INT)) {
+        // Sign-extend the 47-bit payload
+        return (int64_t)(v << (64 - NANBOX_TAG_SHIFT)) >> (64 - NANBOX_TAG_SHIFT);
+    }
+    return *(int64_t*)(uintptr_t)(v & NANBOX_PAYLOAD_MASK);
+}
+
+static inline PrismValue prism_value_from_int(int64_t i) {
+    if (i >= NANBOX_SMALL_INT_MIN && i <= NANBOX_SMALL_INT_MAX) {
+        return NANBOX_MAKE(NANBOX_TAG_OF(TYPE_INT), i);
+    }
+    return prism_box_int(i);
+}
+
+#define VALUE_TYPE(v)   prism_value_type(v)
+#define IS_NONE(v)      ((v) == NANBOX_MAKE(NANBOX_TAG_OF(TYPE_NONE), 0))
+#define IS_INT(v)       (NANBOX_HAS_TAG(v, NANBOX_TAG_OF(TYPE_INT)) || NANBOX_HAS_TAG(v, NANBOX_TAG_BIGINT))
+#define IS_FLOAT(v)     (!NANBOX_IS_BOXED(v))
+#define IS_BOOL(v)      NANBOX_HAS_TAG(v, NANBOX_TAG_OF(TYPE_BOOL))
+#define IS_STRING(v)    (NANBOX_HAS_TAG(v, NANBOX_TAG_OF(TYPE_STRING)) || IS_SMALL_STRING(v))
+#define IS_SMALL_STRING(v) NANBOX_HAS_TAG(v, NANBOX_TAG_SMALL_STRING)
+#define IS_FUNCTION(v)  NANBOX_HAS_TAG(v, NANBOX_TAG_OF(TYPE_FUNCTION))
+#define IS_ROPE(v)      NANBOX_HAS_TAG(v, NANBOX_TAG_OF(TYPE_ROPE))
+#define IS_BIGINT(v)    NANBOX_HAS_TAG(v, NANBOX_TAG_BIGINT)
+
+#define AS_INT(v)       prism_value_as_int(v)
+#define AS_FLOAT(v)     prism_value_as_float(v)
+#define AS_BOOL(v)      ((bool)((v) & 1))
+#define AS_STRING(v)    (IS_SMALL_STRING(v) ? (char*)&(v) : (char*)(uintptr_t)((v) & NANBOX_PAYLOAD_MASK))
+#define AS_FUNCTION(v)  ((void*)(uintptr_t)((v) & NANBOX_PAYLOAD_MASK))
+#define AS_PTR(v)       ((void*)(uintptr_t)((v) & NANBOX_PAYLOAD_MASK))
+
+#define NONE_VAL        NANBOX_MAKE(NANBOX_TAG_OF(TYPE_NONE), 0)
+#define INT_VAL(i)      prism_value_from_int(i)
+#define FLOAT_VAL(f)    prism_value_from_float(f)
+#define BOOL_VAL(b)     NANBOX_MAKE(NANBOX_TAG_OF(TYPE_BOOL), (b) ? 1 : 0)
+#define STRING_VAL(s)   NANBOX_MAKE(NANBOX_TAG_OF(TYPE_STRING), (uintptr_t)(s))
+#define FUNCTION_VAL(p) NANBOX_MAKE(NANBOX_TAG_OF(TYPE_FUNCTION), (uintptr_t)(p))
+#define PTR_VAL(type, p) NANBOX_MAKE(NANBOX_TAG_OF(type), (uintptr_t)(p))
+#define BIGINT_VAL(p)   NANBOX_MAKE(NANBOX_TAG_BIGINT, (uintptr_t)(p))
+
+#else
+
+// A small string's characters sit in the payload, NUL terminated
+#define PRISM_SMALL_STRING_MAX 7
+
 typedef struct {
     PrismType type;
+    bool small;     // Only meaningful for TYPE_STRING
     union {
         int64_t i;
         double f;
         bool b;
         char* s;
         void* ptr;
+        char chars[PRISM_SMALL_STRING_MAX + 1];
     } value;
 } PrismValue;
 
+#define VALUE_TYPE(v)   ((v).type)
+#define IS_NONE(v)      ((v).type == TYPE_NONE)
+#define IS_INT(v)       ((v).type == TYPE_INT)
+#define IS_FLOAT(v)     ((v).type == TYPE_FLOAT)
+#define IS_BOOL(v)      ((v).type == TYPE_BOOL)
+#define IS_STRING(v)    ((v).type == TYPE_STRING)
+#define IS_SMALL_STRING(v) ((v).type == TYPE_STRING && (v).small)
+#define IS_FUNCTION(v)  ((v).type == TYPE_FUNCTION)
+#define IS_ROPE(v)      ((v).type == TYPE_ROPE)
+
+#define AS_INT(v)       ((v).value.i)
+#define AS_FLOAT(v)     ((v).value.f)
+#define AS_BOOL(v)      ((v).value.b)
+#define AS_STRING(v)    ((v).small ? (v).value.chars : (v).value.s)
+#define AS_FUNCTION(v)  ((v).value.ptr)
+#define AS_PTR(v)       ((v).value.ptr)
+
+#define NONE_VAL        ((PrismValue){ .type = TYPE_NONE, .value = { .i = 0 } })
+#define INT_VAL(x)      ((PrismValue){ .type = TYPE_INT, .value = { .i = (x) } })
+#define FLOAT_VAL(x)    ((PrismValue){ .type = TYPE_FLOAT, .value = { .f = (x) } })
+#define BOOL_VAL(x)     ((PrismValue){ .type = TYPE_BOOL, .value = { .b = (x) } })
+#define STRING_VAL(x)   ((PrismValue){ .type = TYPE_STRING, .value = { .s = (x) } })
+#define FUNCTION_VAL(x) ((PrismValue){ .type = TYPE_FUNCTION, .value = { .ptr = (x) } })
+#define PTR_VAL(t, x)   ((PrismValue){ .type = (t), .value = { .ptr = (x) } })
+
+#endif
+
 typedef struct {
     char* name;
     PrismType type;
@@ -35,6 +196,9 @@ typedef struct {
 } PrismVariable;
 
 const char* prism_type_to_string(PrismType type);
+
+// A string holding a copy of chars, inside the value when it fits
+PrismValue prism_string_value(const char* chars, size_t length);
 PrismValue prism_value_convert(PrismValue value, PrismType target_type);
 
-#endif /* PRISM_TYPES_H */
\ No newline at end of file
+#endif /* PRISM_TYPES_H */
@@ -9,4 +9,8 @@ void prism_write_file(const char* path, const char* content);
 char* prism_format_value(PrismValue value);
 void prism_print_value(PrismValue value);
 
+// Where script output goes on the calling thread; NULL selects stdout
+FILE* prism_output();
+void prism_set_output(FILE* out);
+
 #endif /* PRISM_UTIL_H */
\ No newline at end of file
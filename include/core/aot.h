@@ -0,0 +1,41 @@
+#ifndef PRISM_AOT_H
+#define PRISM_AOT_H
+
+#include "vm.h"
+#include <stdio.h>
+
+/* Ahead-of-time compiler. Every chunk of a generated program is lowered to a
+ * C function: operand stack slots and locals become C variables, calls to
+ * functions known at compile time become direct C calls, natives are called
+ * through their symbols in src/lib, and globals live in a static array. The
+ * translation unit is built with the system C compiler and linked against
+ * libprism.a, which provides the natives and the runtime support below. */
+
+// Writes the program as a C translation unit. Returns false after reporting
+// an error if some chunk can't be lowered.
+bool aot_emit_c(CodeGenerator* generator, FILE* out);
+
+// Emits the program and builds an executable at output_path. When
+// output_path ends in ".c" only the translation unit is written.
+bool aot_compile(CodeGenerator* generator, const char* output_path);
+
+/* Runtime support for compiled programs. Arithmetic has inline int fast
+ * paths in the generated code and falls back to these; a runtime error
+ * prints its message and exits with status 70, like the interpreter. */
+
+// A function value in a compiled program. The name comes first so values
+// format the same way as FunctionProto pointers.
+typedef struct {
+    const char* name;
+    int arity;
+    PrismValue (*entry)(PrismValue* args);
+} AotFunction;
+
+PrismValue prism_aot_arith(OpCode op, PrismValue a, PrismValue b);
+PrismValue prism_aot_negate(PrismValue a);
+bool prism_aot_falsey(PrismValue condition);
+PrismValue prism_aot_call(PrismValue callee, PrismValue* args, int arg_count);
+PrismValue prism_aot_call_native(PrismValue (*function)(PrismValue*, int), PrismValue* args, int arg_count);
+void prism_aot_overflow(void);
+
+#endif /* PRISM_AOT_H */
@@ -0,0 +1,64 @@
+#ifndef PRISM_ARITH_H
+#define PRISM_ARITH_H
+
+#include "codegen.h"
+#include "../common/error.h"
+#include "../common/rope.h"
+
+/* Generic arithmetic, shared by the interpreter's handlers, the JIT helpers
+ * and the runtime of compiled programs so that they agree on results and
+ * error messages. It is inline because the interpreter reaches it for every
+ * mixed int and float operation and every division. */
+
+static inline bool arith_as_number(PrismValue value, double* out) {
+    if (IS_INT(value)) {
+        *out = (double)AS_INT(value);
+        return true;
+    }
+    if (IS_FLOAT(value)) {
+        *out = AS_FLOAT(value);
+        return true;
+    }
+    return false;
+}
+
+// The generic slow path of ADD, SUBTRACT, MULTIPLY and DIVIDE. Returns false
+// after reporting a runtime error.
+static inline bool prism_arith(OpCode op, PrismValue a, PrismValue b, PrismValue* result) {
+    double x, y;
+
+    if (op == OP_DIVIDE) {
+        if ((IS_INT(b) && AS_INT(b) == 0) || (IS_FLOAT(b) && AS_FLOAT(b) == 0.0)) {
+            prism_error("Division by zero");
+            return false;
+        }
+        if (!arith_as_number(a, &x) || !arith_as_number(b, &y)) {
+            prism_error("Invalid operand types for division");
+            return false;
+        }
+        *result = FLOAT_VAL(x / y);
+        return true;
+    }
+
+    if (op == OP_ADD && IS_TEXT(a) && IS_TEXT(b)) {
+        *result = rope_concat(a, b);
+        return true;
+    }
+
+    if (IS_INT(a) && IS_INT(b)) {
+        int64_t i = AS_INT(a);
+        int64_t j = AS_INT(b);
+        *result = INT_VAL(op == OP_ADD ? i + j : op == OP_SUBTRACT ? i - j : i * j);
+        return true;
+    }
+
+    if (!arith_as_number(a, &x) || !arith_as_number(b, &y)) {
+        prism_error("Invalid operand types for %s",
+                   op == OP_ADD ? "addition" : op == OP_SUBTRACT ? "subtraction" : "multiplication");
+        return false;
+    }
+    *result = FLOAT_VAL(op == OP_ADD ? x + y : op == OP_SUBTRACT ? x - y : x * y);
+    return true;
+}
+
+#endif /* PRISM_ARITH_H */
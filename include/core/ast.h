@@ -2,6 +2,7 @@
 #define PRISM_AST_H
 
 #include "../common/types.h"
+#include "../common/intern.h"
 
 typedef enum {
     EXPR_LITERAL,
@@ -25,7 +26,7 @@ typedef struct Expr {
     union {
         PrismValue literal;
         struct {
-            char* name;
+            const char* name;
         } variable;
         struct {
             struct Expr* callee;
@@ -33,19 +34,19 @@ typedef struct Expr {
             int arg_count;
         } call;
         struct {
-            char* op;
+            const char* op;
             struct Expr* left;
             struct Expr* right;
         } binary;
         struct {
-            char* op;
+            const char* op;
             struct Expr* operand;
         } unary;
     } as;
 } Expr;
 
 typedef struct {
-    char* name;
+    const char* name;
     PrismType type;
     bool exposed;
     bool internal;
@@ -53,8 +54,8 @@ typedef struct {
 } VarDecl;
 
 typedef struct {
-    char* name;
-    char** params;
+    const char* name;
+    const char** params;
     PrismType* param_types;
     int param_count;
     struct Stmt** body;
@@ -63,7 +64,7 @@ typedef struct {
 } FuncDecl;
 
 typedef struct {
-    char* name;
+    const char* name;
     struct Stmt** body;
     int body_count;
     PrismType return_type;
@@ -91,25 +92,32 @@ typedef struct {
     Stmt** statements;
     int count;
     int capacity;
+    struct Arena* arena;    // The arena the nodes are in, NULL if none
 } Program;
 
 Program* ast_create_program();
 void ast_free_program(Program* program);
 void ast_add_statement(Program* program, Stmt* stmt);
 
+// Names, operators and string literals are interned (see intern.h). The
+// constructors intern what they are given, and copy the arrays they are
+// given, so the caller keeps its copies. Nodes are allocated from the
+// current arena if there is one (see arena.h); ast_free_program leaves
+// those to the arena.
 Expr* ast_create_literal_expr(PrismValue value);
-Expr* ast_create_variable_expr(char* name);
+Expr* ast_create_variable_expr(const char* name);
 Expr* ast_create_call_expr(Expr* callee, Expr** args, int arg_count);
-Expr* ast_create_binary_expr(char* op, Expr* left, Expr* right);
-Expr* ast_create_unary_expr(char* op, Expr* operand);
+Expr* ast_create_binary_expr(const char* op, Expr* left, Expr* right);
+Expr* ast_create_unary_expr(const char* op, Expr* operand);
 
 Stmt* ast_create_expr_stmt(Expr* expr);
-Stmt* ast_create_var_decl_stmt(char* name, PrismType type, bool exposed, bool internal, Expr* initializer);
-Stmt* ast_create_func_decl_stmt(char* name, char** params, PrismType* param_types, int param_count, Stmt** body, int body_count, PrismType return_type);
-Stmt* ast_create_prism_decl_stmt(char* name, Stmt** body, int body_count, PrismType return_type);
+Stmt* ast_create_var_decl_stmt(const char* name, PrismType type, bool exposed, bool internal, Expr* initializer);
+Stmt* ast_create_func_decl_stmt(const char* name, char** params, PrismType* param_types, int param_count, Stmt** body, int body_count, PrismType return_type);
+Stmt* ast_create_prism_decl_stmt(const char* name, Stmt** body, int body_count, PrismType return_type);
 Stmt* ast_create_return_stmt(Expr* value);
 Stmt* ast_create_call_stmt(Expr* callee, Expr** args, int arg_count);
 
+// Not for nodes in an arena
 void ast_free_expr(Expr* expr);
 void ast_free_stmt(Stmt* stmt);
 
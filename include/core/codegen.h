@@ -18,7 +18,34 @@ typedef enum {
     OP_STORE,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
-    OP_POP
+    OP_POP,
+    OP_LOAD_GLOBAL,
+    OP_STORE_GLOBAL,
+    OP_CALL_NATIVE,     // index, argc: natives are bound at compile time
+    OP_TAIL_CALL,       // argc: call that replaces the current frame
+    OP_SPAWN,           // k: start independent prism k early, see parallel.h
+    OP_COROUTINE,       // argc: park a call as a coroutine, see coroutine.h
+    OP_RESUME,          // run a coroutine until it yields, sending it a value
+    OP_YIELD,           // hand a value back to whoever resumed this coroutine
+    OP_END,
+    
+    // Quickened forms, never emitted by codegen: the VM rewrites generic
+    // arithmetic into these in place once it has seen the operand types
+    OP_ADD_INT_INT,
+    OP_ADD_FLOAT_FLOAT,
+    OP_ADD_STR_STR,
+    OP_SUBTRACT_INT_INT,
+    OP_SUBTRACT_FLOAT_FLOAT,
+    OP_MULTIPLY_INT_INT,
+    OP_MULTIPLY_FLOAT_FLOAT,
+    
+    // Superinstructions, produced by codegen_peephole from common sequences
+    OP_ADD_CONST,       // CONSTANT k; ADD
+    OP_ADD_LOCALS,      // LOAD a; LOAD b; ADD
+    OP_CALL_DISCARD,    // CALL n; POP
+    OP_RETURN_NIL,      // CONSTANT nil; RETURN
+    
+    OP_COUNT            // number of opcodes, not an instruction
 } OpCode;
 
 typedef struct {
@@ -27,22 +54,56 @@ typedef struct {
     int count;
     int capacity;
    
-    PrismValue* constants;
+    PrismValue* constants;  // strings among them are interned
     int constant_count;
     int constant_capacity;
 } CodeChunk;
 
+/* A compiled function or prism body. Calls push a frame whose base is the
+ * first argument; parameters and then the remaining locals occupy the next
+ * local_count slots, and the body never needs more than max_stack slots of
+ * operand stack above them. */
+typedef struct {
+    const char* name;
+    int chunk_index;
+    CodeChunk* chunk;       // filled in once codegen is done growing chunks
+    int arity;
+    int local_count;
+    int max_stack;
+    
+    // Calls so far, and the compiled body once it crosses JIT_THRESHOLD
+    int call_count;
+    struct JitCode* jit;
+    
+    // Tracing tier state, created when the first anchor is counted
+    struct TraceCache* traces;
+    
+    // The body reads only exposed globals, writes none and calls nothing
+    // that could, so it can run on another thread (see parallel.h)
+    bool independent;
+} FunctionProto;
+
 // Define the NativeFunction structure
 typedef struct {
-    char* name;
+    const char* name;
     PrismValue (*function)(PrismValue*, int);
+    bool pure;      // no side effects, so independent bodies may call it
 } NativeFunction;
 
 typedef struct {
     CodeChunk* chunks;
     int chunk_count;
+    int current_chunk;      // index of the chunk being generated
     SymbolTable* symtab;
     
+    // functions[i] is the prototype for chunks[i]; 0 is the top-level script
+    FunctionProto** functions;
+    
+    // Slots for variables declared at the top level, and which of them
+    // were declared exposed
+    int global_count;
+    bool* exposed_globals;
+    
     // Add native function support
     NativeFunction* natives;
     int native_count;
@@ -56,8 +117,19 @@ void codegen_emit_byte(CodeGenerator* generator, OpCode op, int line);
 int codegen_emit_jump(CodeGenerator* generator, OpCode op, int line);
 void codegen_patch_jump(CodeGenerator* generator, int offset);
 
+// Number of code slots an instruction occupies, including its operands
+int codegen_op_length(OpCode op);
+const char* codegen_op_name(OpCode op);
+// Net number of values the instruction at code leaves on the operand stack
+int codegen_stack_effect(const OpCode* code);
+
+// Rewrites common instruction sequences in a finished chunk into
+// superinstructions, fixing up jump offsets around them
+void codegen_peephole(CodeChunk* chunk);
+
 // Add function declarations for native function handling
 void codegen_add_native_function(CodeGenerator* generator, const char* name, PrismValue (*function)(PrismValue*, int));
+void codegen_add_pure_native_function(CodeGenerator* generator, const char* name, PrismValue (*function)(PrismValue*, int));
 NativeFunction* codegen_get_native_function(CodeGenerator* generator, int index);
 
 void codegen_generate(CodeGenerator* generator, Program* program);
@@ -0,0 +1,59 @@
+#ifndef PRISM_COROUTINE_H
+#define PRISM_COROUTINE_H
+
+#include "vm.h"
+
+/* Coroutines, created by coroutine(f, args...) and driven by resume(c, v)
+ * and yield(v). A coroutine runs on the VM's own stack and frame list, on
+ * top of whoever resumed it, so compiled code and the interpreter need
+ * nothing special while it runs. When it yields, the slice of stack and
+ * frames it was using is copied out into buffers of its own, which start
+ * at the size of the function's frame and grow as needed, and the
+ * resumer's state is exactly as it was before the resume. A parked
+ * coroutine costs no more than its live values and frames.
+ *
+ * Coroutines belong to the garbage collector of the VM that runs them (see
+ * gc.h), which frees one once nothing refers to it any more. */
+
+typedef enum {
+    COROUTINE_SUSPENDED,
+    COROUTINE_RUNNING,
+    COROUTINE_DONE
+} CoroutineState;
+
+typedef struct Coroutine {
+    CoroutineState state;
+    bool started;           // resumed at least once, so a yield is waiting for a value
+
+    // The parked slice while suspended: stack[0] is the callee slot of the
+    // outermost frame, and frame bases are relative to it
+    PrismValue* stack;
+    int stack_count;
+    int stack_capacity;
+    CallFrame* frames;
+    int frame_count;
+    int frame_capacity;
+
+    // While running: where the slice starts on the VM, and who resumed it
+    int stack_base;
+    int frame_base;
+    struct Coroutine* caller;
+} Coroutine;
+
+// Parks a call to function with the callee and its arguments from args,
+// ready to run on the first resume
+Coroutine* coroutine_create(FunctionProto* function, const PrismValue* args, int arg_count);
+
+// Moves the coroutine onto the VM stack above stack_top. The value becomes
+// the result of the yield it is parked at. False after reporting why it
+// can't be resumed.
+bool coroutine_resume(VM* vm, Coroutine* coroutine, PrismValue value);
+
+// Parks the running coroutine and gives the VM back to its resumer. The
+// current frame's ip must be saved first.
+void coroutine_suspend(VM* vm);
+
+// Ends the running coroutine once its outermost frame has returned
+void coroutine_finish(VM* vm);
+
+#endif /* PRISM_COROUTINE_H */
@@ -0,0 +1,59 @@
+#ifndef PRISM_JIT_H
+#define PRISM_JIT_H
+
+#include "vm.h"
+
+/* Baseline JIT for x86-64. A function's chunk is translated one instruction
+ * at a time by stitching together machine-code templates. Stack traffic and
+ * int arithmetic are inlined; other operand types call out to C helpers.
+ * Calls, returns and any opcode without a template exit back to the
+ * interpreter at that instruction, so every chunk can be compiled and both
+ * tiers can hand off at any instruction boundary. Define PRISM_NO_JIT to leave it out. */
+#if defined(__x86_64__) && defined(__linux__) && !defined(PRISM_NO_JIT)
+#define PRISM_JIT
+#endif
+
+// Calls to a function before it is compiled
+#define JIT_THRESHOLD 100
+
+typedef struct JitCode JitCode;
+
+// NULL if the chunk could not be compiled
+JitCode* jit_compile(FunctionProto* function);
+void jit_free(JitCode* jit);
+
+// Runs compiled code from bytecode offset ip in the current frame. Returns
+// the offset where the interpreter should carry on, or -1 after a runtime
+// error.
+int jit_enter(JitCode* jit, VM* vm, PrismValue* slots, int ip);
+
+/* Tracing tier. Anchors are function entries and the instructions after
+ * calls. Once an anchor has been reached TRACE_THRESHOLD times the
+ * interpreter records the path taken from it up to the next call or return,
+ * and the trace is compiled with guards on the operand types it saw. */
+
+#define TRACE_THRESHOLD 50
+#define TRACE_MIN_LENGTH 8
+#define TRACE_MAX_LENGTH 500
+
+typedef struct Trace Trace;
+typedef struct TraceCache TraceCache;
+typedef struct TraceRecorder TraceRecorder;
+
+// Counts an arrival at ip; true when the anchor has just turned hot
+bool trace_is_hot(FunctionProto* function, int ip);
+// The trace compiled for the anchor at ip, if there is one
+Trace* trace_find(FunctionProto* function, int ip);
+
+TraceRecorder* trace_start(FunctionProto* function, int ip);
+// Called before each instruction while recording. Returns false once the
+// trace has been compiled or abandoned, which frees the recorder.
+bool trace_record(TraceRecorder* recorder, VM* vm, PrismValue* slots, int ip);
+void trace_abort(TraceRecorder* recorder);
+
+// Runs the trace from its anchor. Returns the offset where the interpreter
+// should carry on, or -1 after a runtime error.
+int trace_enter(Trace* trace, VM* vm, PrismValue* slots);
+void trace_free_all(FunctionProto* function);
+
+#endif /* PRISM_JIT_H */
@@ -1,6 +1,8 @@
 #ifndef PRISM_LEXER_H
 #define PRISM_LEXER_H
 
+#include <stdint.h>
+
 typedef enum {
     TOKEN_EOF,
     TOKEN_IDENTIFIER,
@@ -24,28 +26,40 @@ typedef enum {
     TOKEN_NONE
 } TokenType;
 
+/* The tokens, as parallel arrays indexed by token number. A token's text
+ * is a slice of the source, which must outlive the tokens. Nothing is
+ * copied or interned while lexing; the parser interns the names and
+ * literals it keeps. A string token's slice includes its quotes.
+ *
+ * Lines and columns aren't tracked while lexing: only the errors need them,
+ * and token_position works them out from an offset. */
 typedef struct {
-    TokenType type;
-    char* lexeme;
-    int line;
-    int column;
-} Token;
+    const char* source;
+    uint8_t* types;         // TokenType
+    uint32_t* starts;       // offset of the text in the source
+    uint32_t* lengths;
+    int count;
+    int capacity;
+    uint32_t* line_starts;  // offset of each line, built the first time it's needed
+    int line_count;
+} TokenList;
+
+// The line and column, both counted from 1, of an offset in the source
+void token_position(TokenList* tokens, uint32_t offset, int* line, int* column);
 
 typedef struct {
     const char* source;
     const char* filename;
     int start;
     int current;
-    int line;
-    int column;
-    Token* tokens;
-    int token_count;
-    int token_capacity;
+    TokenList tokens;       // in the current arena when the lexer was made, if any
+    struct Arena* arena;
+    const struct ScanKernels* scan;
 } Lexer;
 
 Lexer* lexer_create(const char* source, const char* filename);
 void lexer_free(Lexer* lexer);
 void lexer_scan_tokens(Lexer* lexer);
-Token* lexer_get_tokens(Lexer* lexer, int* count);
+TokenList* lexer_get_tokens(Lexer* lexer);
 
 #endif /* PRISM_LEXER_H */
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef PRISM_PARALLEL_H
+#define PRISM_PARALLEL_H
+
+#include "vm.h"
+
+/* Runs independent prisms ahead of their first call. Codegen emits
+ * OP_SPAWN after every top-level prism declaration whose body touches no
+ * shared state (see FunctionProto.independent). With use_parallel set, the
+ * VM hands such a prism to its work-stealing scheduler there, and the first
+ * call to the prism joins on the task and takes its result instead of
+ * running the body.
+ *
+ * Each task runs on a private copy of the program, so quickening, call
+ * counts and compiled code are never shared between threads, against a
+ * copy of the globals taken at the spawn. A task that fails is dropped and
+ * the call runs the prism inline, which reports the error as usual. */
+
+// Starts prism on the VM's scheduler, creating the scheduler on first use
+void parallel_spawn(VM* vm, FunctionProto* prism);
+// Waits for prism's task and takes its result, false if it failed
+bool parallel_join(VM* vm, FunctionProto* prism, PrismValue* result);
+// Waits for and drops every task that was never joined
+void parallel_finish(VM* vm);
+
+#endif /* PRISM_PARALLEL_H */
@@ -5,12 +5,24 @@
 #include "ast.h"
 
 typedef struct {
-    Token* tokens;
-    int token_count;
-    int current;
+    TokenList* tokens;
+    int current;            // tokens are passed around by index
+    
+    // Stacks for the lists being parsed, innermost on top. A finished list
+    // is copied into its node and popped, so the stacks are reused.
+    Expr** args;
+    int arg_count;
+    int arg_capacity;
+    char** params;
+    PrismType* param_types;
+    int param_count;
+    int param_capacity;
+    Stmt** body;
+    int body_count;
+    int body_capacity;
 } Parser;
 
-Parser* parser_create(Token* tokens, int token_count);
+Parser* parser_create(TokenList* tokens);
 void parser_free(Parser* parser);
 
 Program* parser_parse(Parser* parser);
@@ -0,0 +1,43 @@
+#ifndef PRISM_POOL_H
+#define PRISM_POOL_H
+
+#include "vm.h"
+
+/* Worker pool that runs independent scripts on several threads at once.
+ * Every job gets a fresh VM on one of the workers. VMs share no state, and
+ * each keeps its own error state and script output, so jobs can't see
+ * each other; each job's output is captured in memory instead of being
+ * interleaved on stdout. */
+
+typedef struct PrismJob {
+    // Set by the caller before submitting
+    const char* source;
+    const char* filename;
+    bool use_jit;
+    bool use_tracing;
+
+    // Set once the job has run. output holds everything the script printed
+    // and error the message of the error that stopped it, if any; both are
+    // the caller's to free.
+    InterpretResult result;
+    char* output;
+    size_t output_size;
+    char* error;
+
+    struct PrismJob* next;  // queue link, owned by the pool
+} PrismJob;
+
+typedef struct WorkerPool WorkerPool;
+
+// A worker_count of 0 starts one worker per online core
+WorkerPool* pool_create(int worker_count);
+int pool_worker_count(WorkerPool* pool);
+
+// The job must stay alive until pool_wait returns
+void pool_submit(WorkerPool* pool, PrismJob* job);
+// Blocks until every job submitted so far has run
+void pool_wait(WorkerPool* pool);
+// Finishes outstanding jobs and stops the workers
+void pool_free(WorkerPool* pool);
+
+#endif /* PRISM_POOL_H */
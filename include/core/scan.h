@@ -0,0 +1,50 @@
+#ifndef PRISM_SCAN_H
+#define PRISM_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte scanning for the lexer. Each kernel returns the length of the run
+ * of bytes starting at p that the lexer can step over in one go; the byte
+ * after the run is the next one the lexer has to look at. Runs stop at the
+ * NUL that ends the source.
+ *
+ * There are scalar, SSE2 and AVX2 versions of the kernels, and the best the
+ * CPU supports is picked the first time they are asked for. The lexer steps
+ * through the first few bytes of a run itself and only hands longer runs
+ * to a kernel, which is where the vector ones pay off. They read whole
+ * aligned blocks, which never cross a page, so they can look past the NUL
+ * without faulting. */
+
+// Character classes. NUL is in none of them.
+#define CHAR_SPACE 0x01     // blanks other than newline
+#define CHAR_DIGIT 0x02
+#define CHAR_ALPHA 0x04     // letters and '_', which can start an identifier
+#define CHAR_IDENT (CHAR_DIGIT | CHAR_ALPHA)
+
+extern const uint8_t char_class[256];
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+typedef struct ScanKernels {
+    ScanLevel level;
+    const char* name;
+    size_t (*blanks)(const char* p);        // CHAR_SPACE bytes
+    size_t (*identifier)(const char* p);    // CHAR_IDENT bytes
+    size_t (*line)(const char* p);          // up to a newline
+    size_t (*string)(const char* p);        // up to a '"'
+} ScanKernels;
+
+// The kernels lexers use from now on
+const ScanKernels* scan_kernels();
+// The best the CPU supports
+ScanLevel scan_best_level();
+// Use level, or the best below it the CPU supports, for lexers made from
+// now on. For benchmarks; call it before any lexing starts.
+void scan_set_level(ScanLevel level);
+
+#endif /* PRISM_SCAN_H */
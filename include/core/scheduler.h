@@ -0,0 +1,31 @@
+#ifndef PRISM_SCHEDULER_H
+#define PRISM_SCHEDULER_H
+
+#include <stdbool.h>
+
+/* Work-stealing task scheduler. Every worker owns a deque: it pushes and
+ * pops its own tasks at the bottom, and once it runs dry it steals from
+ * the top of another worker's deque. Tasks spawned from outside the pool
+ * are dealt round-robin across the deques. A thread joining on a task runs
+ * queued tasks itself while it waits, so joins never idle a core. */
+
+typedef struct SchedulerTask {
+    void (*run)(void* arg);
+    void* arg;
+    bool done;      // set by the scheduler, read it through scheduler_join
+} SchedulerTask;
+
+typedef struct Scheduler Scheduler;
+
+// A worker_count of 0 starts one worker per online core
+Scheduler* scheduler_create(int worker_count);
+int scheduler_worker_count(Scheduler* scheduler);
+
+// The task must stay alive until it has been joined
+void scheduler_spawn(Scheduler* scheduler, SchedulerTask* task);
+void scheduler_join(Scheduler* scheduler, SchedulerTask* task);
+
+// Runs every queued task to completion, then stops the workers
+void scheduler_free(Scheduler* scheduler);
+
+#endif /* PRISM_SCHEDULER_H */
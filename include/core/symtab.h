@@ -2,23 +2,34 @@
 #define PRISM_SYMTAB_H
 
 #include "../common/types.h"
+#include "../common/arena.h"
 
+/* Names are interned (see intern.h) and compared by pointer, so every name
+ * passed in must be an interned string.
+ *
+ * Scopes and entries are bump-allocated from the table's own arena, which
+ * lives as long as the table. Leaving a scope rewinds the arena to where
+ * it was on entry, so the next scope reuses the memory. */
 typedef struct SymbolEntry {
-    char* name;
+    const char* name;
     PrismType type;
     bool exposed;
     bool internal;
     void* data;
+    int depth;              // scope depth the symbol was defined at, 0 is global
     struct SymbolEntry* next;
 } SymbolEntry;
 
 typedef struct Scope {
     SymbolEntry* entries;
     struct Scope* parent;
+    ArenaMark mark;         // the arena before the scope was entered
 } Scope;
 
 typedef struct {
+    Arena* arena;
     Scope* current;
+    int depth;
     int current_vars;
 } SymbolTable;
 
@@ -2,28 +2,125 @@
 #define PRISM_VM_H
 
 #include "codegen.h"
+#include "../common/error.h"
+#include <stdio.h>
 
 #define STACK_MAX 256
 
+// Checkpoints between looks at the clock while a deadline is set
+#define VM_CLOCK_STRIDE 1024
+
+/* The interpreter loop uses threaded dispatch (GCC labels-as-values) when the
+ * compiler supports it. Define PRISM_NO_COMPUTED_GOTO to force the portable
+ * switch-based loop. */
+#if defined(__GNUC__) && !defined(PRISM_NO_COMPUTED_GOTO)
+#define PRISM_COMPUTED_GOTO
+#endif
+
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_SUSPENDED     // out of fuel or past the deadline, see vm_resume
 } InterpretResult;
 
+// An active call: the function's locals start at stack[base]
+typedef struct {
+    FunctionProto* function;
+    CodeChunk* chunk;
+    OpCode* ip;
+    int base;
+    bool discard_result;    // called through OP_CALL_DISCARD
+} CallFrame;
+
 typedef struct {
     CodeGenerator* code_gen;
     PrismValue stack[STACK_MAX];
     int stack_top;
-    int frames[STACK_MAX];
+    CallFrame frames[STACK_MAX];
     int frame_count;
+    
+    PrismValue* globals;
+    int global_count;
+    
+    // Compile hot functions to machine code (see jit.h)
+    bool use_jit;
+    
+    // Record and compile traces through hot paths, and the recording in
+    // progress if there is one
+    bool use_tracing;
+    struct TraceRecorder* recorder;
+    
+    // Stream natives write script output to while this VM runs, stdout if NULL
+    FILE* output;
+    
+    // Start independent prisms on other threads where they are declared
+    // (see parallel.h), and their tasks by chunk index while a run is on
+    bool use_parallel;
+    struct Scheduler* scheduler;
+    struct PrismTask** tasks;
+    
+    // The coroutine running now, NULL for the script itself (see coroutine.h)
+    struct Coroutine* coroutine;
+    
+    // Cooperative time slicing (see vm_set_fuel). Calls, tail calls and resumes
+    // count slice down; fuel and the clock are only looked at when it runs
+    // out, and what is left of the budget is fuel plus slice.
+    int64_t fuel;           // checkpoints not yet handed to slice, negative for no limit
+    int64_t deadline;       // CLOCK_MONOTONIC nanoseconds, 0 for none
+    int64_t slice;
+    bool suspended;
+    
+    // Strings and ropes made while this VM runs (see gc.h)
+    struct GcHeap* heap;
+    
+    // Errors raised while one of the VM's entry points runs (see error.h),
+    // for the host to read once it has returned. Compiling and starting a
+    // run clear it; resuming doesn't.
+    PrismError error;
 } VM;
 
 VM* vm_create();
 void vm_free(VM* vm);
 InterpretResult vm_interpret(VM* vm, const char* source, const char* filename);
+InterpretResult vm_run(VM* vm);
+// Runs one prism body against the VM's current globals, leaving its result
+// in stack[0], with a rope flattened to a plain string
+InterpretResult vm_run_prism(VM* vm, FunctionProto* prism);
+
+/* A run with fuel or a deadline stops with INTERPRET_SUSPENDED once either
+ * is used up, at the next call, tail call or resume, with the stack,
+ * frames and coroutines left exactly as they were. vm_resume carries on from there, so
+ * a host can round-robin many scripts on one thread by giving each some
+ * fuel or a few milliseconds at a time. Straight-line code between two
+ * checkpoints always finishes, and so does a native that blocks. */
+
+// Checkpoints (calls, tail calls and resumes) the VM may pass before
+// suspending, negative for no limit
+void vm_set_fuel(VM* vm, int64_t fuel);
+// Negative for no limit
+int64_t vm_fuel_left(VM* vm);
+// Suspends once this many nanoseconds from now have passed, negative for
+// no deadline. The clock is read every VM_CLOCK_STRIDE checkpoints.
+void vm_set_deadline(VM* vm, int64_t nanoseconds);
+// Continues a suspended run; the result is what vm_run would have returned
+InterpretResult vm_resume(VM* vm);
+
+/* Values a run leaves behind, such as the script's result in stack[0],
+ * stay valid until the VM runs again or is freed. */
+
+// Collects the VM's heap now rather than at the next checkpoint. A minor
+// collection only empties the nursery; a full one also frees old objects
+// nothing reaches.
+void vm_collect(VM* vm, bool full);
+
 void vm_push(VM* vm, PrismValue value);
 PrismValue vm_pop(VM* vm);
 PrismValue vm_peek(VM* vm, int distance);
 
+#ifdef PRISM_PROFILE_PAIRS
+// Most frequently executed opcode pairs since startup, built with PROFILE=pairs
+void vm_print_pair_profile(FILE* out);
+#endif
+
 #endif /* PRISM_VM_H */
\ No newline at end of file
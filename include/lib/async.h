@@ -0,0 +1,36 @@
+#ifndef PRISM_ASYNC_H
+#define PRISM_ASYNC_H
+
+#include "../common/types.h"
+
+/* Asynchronous file I/O behind read_file_async and friends. Each call opens
+ * the file, starts the transfer and returns a future right away, so a
+ * script can keep many reads and writes in flight and wait for each with
+ * await() when it needs the result.
+ *
+ * Transfers go through an io_uring ring owned by the calling thread. Where
+ * io_uring is missing, disabled or lacks plain reads and writes (before
+ * Linux 5.6), or when built with PRISM_NO_IO_URING, they run as blocking
+ * calls on a shared set of helper threads instead. Regular files always
+ * poll as ready, so epoll can't make them asynchronous. A future must be
+ * awaited on the thread that started it.
+ *
+ * Futures belong to the garbage collector of the VM that made them (see
+ * gc.h). One that nothing refers to any more is freed once its transfer
+ * is over; the first await copies what was read into the heap and frees
+ * the transfer buffer. */
+
+typedef struct PrismFuture PrismFuture;
+
+PrismFuture* async_read_file(const char* path);
+PrismFuture* async_write_file(const char* path, const char* content, bool append);
+
+// Waits for the operation and stores what the blocking native would have
+// returned. False after reporting why it failed; awaiting again gives the
+// same answer.
+bool async_await(PrismFuture* future, PrismValue* result);
+
+// Waits for everything the calling thread started, then releases its ring
+void async_finish();
+
+#endif /* PRISM_ASYNC_H */
@@ -13,6 +13,13 @@ PrismValue prism_io_append_file(PrismValue* args, int arg_count);
 PrismValue prism_io_file_exists(PrismValue* args, int arg_count);
 PrismValue prism_io_delete_file(PrismValue* args, int arg_count);
 
+// Asynchronous variants return a future; await(future) gives what the
+// blocking function would have returned
+PrismValue prism_io_read_file_async(PrismValue* args, int arg_count);
+PrismValue prism_io_write_file_async(PrismValue* args, int arg_count);
+PrismValue prism_io_append_file_async(PrismValue* args, int arg_count);
+PrismValue prism_io_await(PrismValue* args, int arg_count);
+
 // Register all IO library functions in the VM
 void prism_io_register_all(void* vm);
 
@@ -15,6 +15,7 @@ PrismValue prism_std_string(PrismValue* args, int arg_count);
 PrismValue prism_std_int(PrismValue* args, int arg_count);
 PrismValue prism_std_float(PrismValue* args, int arg_count);
 PrismValue prism_std_bool(PrismValue* args, int arg_count);
+PrismValue prism_std_done(PrismValue* args, int arg_count);
 
 // Register all standard library functions in the VM
 void prism_std_register_all(void* vm);
@@ -0,0 +1,144 @@
+#include "../../include/common/arena.h"
+#include "../../include/common/memory.h"
+#include <string.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#define POISON(p, size) ASAN_POISON_MEMORY_REGION(p, size)
+#define UNPOISON(p, size) ASAN_UNPOISON_MEMORY_REGION(p, size)
+#else
+#define POISON(p, size) ((void)0)
+#define UNPOISON(p, size) ((void)0)
+#endif
+
+#define FIRST_CHUNK (8 * 1024)
+#define MAX_CHUNK (1024 * 1024)
+
+#define ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+};
+
+struct Arena {
+    ArenaChunk* first;
+    ArenaChunk* current;
+    size_t next_size;
+    char* last;         // The last allocation, which arena_grow can extend
+};
+
+static _Thread_local Arena* current;
+
+// Holds at least needed bytes. Chunks aren't zeroed.
+static ArenaChunk* new_chunk(Arena* arena, size_t needed) {
+    size_t size = arena->next_size > needed ? arena->next_size : needed;
+    if (arena->next_size < MAX_CHUNK) arena->next_size *= 2;
+
+    ArenaChunk* chunk = prism_realloc(NULL, sizeof(ArenaChunk) + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    POISON(chunk->data, size);
+    return chunk;
+}
+
+// A new chunk, if one is needed, holds at least reserve bytes
+static void* bump(Arena* arena, size_t size, size_t reserve) {
+    size_t needed = ALIGN(size);
+    if (!arena->current) {
+        arena->first = new_chunk(arena, ALIGN(reserve));
+        arena->current = arena->first;
+    }
+
+    // Chunks past the current one are empty, left over from a rewind
+    ArenaChunk* chunk = arena->current;
+    while (chunk->used + needed > chunk->size) {
+        if (!chunk->next) chunk->next = new_chunk(arena, ALIGN(reserve));
+        chunk = chunk->next;
+    }
+    arena->current = chunk;
+
+    char* memory = chunk->data + chunk->used;
+    chunk->used += needed;
+    arena->last = memory;
+    UNPOISON(memory, size);
+    return memory;
+}
+
+Arena* arena_create() {
+    Arena* arena = prism_alloc(sizeof(Arena));
+    arena->next_size = FIRST_CHUNK;
+    return arena;
+}
+
+void arena_free(Arena* arena) {
+    if (!arena) return;
+
+    ArenaChunk* chunk = arena->first;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        UNPOISON(chunk->data, chunk->size);
+        prism_free(chunk);
+        chunk = next;
+    }
+    if (current == arena) current = NULL;
+    prism_free(arena);
+}
+
+Arena* arena_current() {
+    return current;
+}
+
+void arena_set_current(Arena* arena) {
+    current = arena;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    return bump(arena, size, size);
+}
+
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+
+    ArenaChunk* chunk = arena->current;
+    if (ptr == arena->last && (char*)ptr + ALIGN(new_size) <= chunk->data + chunk->size) {
+        chunk->used = (size_t)((char*)ptr - chunk->data) + ALIGN(new_size);
+        UNPOISON(ptr, new_size);
+        return ptr;
+    }
+
+    // Arrays grow by doubling, so leave room to double again in place
+    void* memory = bump(arena, new_size, new_size * 2);
+    memcpy(memory, ptr, old_size < new_size ? old_size : new_size);
+    return memory;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+    ArenaMark mark = { arena->current, arena->current ? arena->current->used : 0 };
+    return mark;
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    ArenaChunk* chunk = mark.chunk ? mark.chunk : arena->first;
+    if (!chunk) return;
+
+    chunk->used = mark.chunk ? mark.used : 0;
+    POISON(chunk->data + chunk->used, chunk->size - chunk->used);
+    for (ArenaChunk* next = chunk->next; next; next = next->next) {
+        next->used = 0;
+        POISON(next->data, next->size);
+    }
+    arena->current = chunk;
+    arena->last = NULL;
+}
+
+size_t arena_size(Arena* arena) {
+    size_t size = 0;
+    for (ArenaChunk* chunk = arena->first; chunk; chunk = chunk->next) {
+        size += chunk->size;
+    }
+    return size;
+}
@@ -4,7 +4,14 @@
 #include <stdarg.h>
 #include <string.h>
 
-static PrismError last_error = {ERROR_NONE, NULL, 0, 0, NULL};
+// Each thread has its own error state, used while no VM's is current
+static _Thread_local PrismError thread_error = {ERROR_NONE, NULL, 0, 0, NULL};
+static _Thread_local PrismError* current_error = NULL;
+static _Thread_local bool quiet_errors = false;
+
+static PrismError* current() {
+    return current_error ? current_error : &thread_error;
+}
 
 void prism_error(const char* format, ...) {
     char buffer[1024];
@@ -13,13 +20,14 @@ void prism_error(const char* format, ...) {
     vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
     
-    if (last_error.message) prism_free(last_error.message);
-    last_error.type = ERROR_RUNTIME;
-    last_error.message = strdup(buffer);
-    last_error.line = 0;
-    last_error.column = 0;
+    PrismError* last_error = current();
+    if (last_error->message) prism_free(last_error->message);
+    last_error->type = ERROR_RUNTIME;
+    last_error->message = strdup(buffer);
+    last_error->line = 0;
+    last_error->column = 0;
     
-    fprintf(stderr, "Error: %s\n", buffer);
+    if (!quiet_errors) fprintf(stderr, "Error: %s\n", buffer);
 }
 
 void prism_error_at(const char* filename, int line, int column, const char* format, ...) {
@@ -29,32 +37,45 @@ void prism_error_at(const char* filename, int line, int column, const char* form
     vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
     
-    if (last_error.message) prism_free(last_error.message);
-    if (last_error.filename) prism_free(last_error.filename);
+    PrismError* last_error = current();
+    if (last_error->message) prism_free(last_error->message);
+    if (last_error->filename) prism_free(last_error->filename);
     
-    last_error.type = ERROR_SYNTAX;
-    last_error.message = strdup(buffer);
-    last_error.line = line;
-    last_error.column = column;
-    last_error.filename = strdup(filename);
+    last_error->type = ERROR_SYNTAX;
+    last_error->message = strdup(buffer);
+    last_error->line = line;
+    last_error->column = column;
+    last_error->filename = strdup(filename);
     
-    fprintf(stderr, "%s:%d:%d: Error: %s\n", filename, line, column, buffer);
+    if (!quiet_errors) fprintf(stderr, "%s:%d:%d: Error: %s\n", filename, line, column, buffer);
 }
 
 PrismError* prism_get_last_error() {
-    return &last_error;
+    return current();
 }
 
 void prism_clear_error() {
-    if (last_error.message) {
-        prism_free(last_error.message);
-        last_error.message = NULL;
+    prism_reset_error(current());
+}
+
+void prism_set_error_state(PrismError* error) {
+    current_error = error;
+}
+
+void prism_reset_error(PrismError* error) {
+    if (error->message) {
+        prism_free(error->message);
+        error->message = NULL;
     }
-    if (last_error.filename) {
-        prism_free(last_error.filename);
-        last_error.filename = NULL;
+    if (error->filename) {
+        prism_free(error->filename);
+        error->filename = NULL;
     }
-    last_error.type = ERROR_NONE;
-    last_error.line = 0;
-    last_error.column = 0;
+    error->type = ERROR_NONE;
+    error->line = 0;
+    error->column = 0;
+}
+
+void prism_set_quiet_errors(bool quiet) {
+    quiet_errors = quiet;
 }
\ No newline at end of file
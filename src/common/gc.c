@@ -0,0 +1,479 @@
+#include "../../include/common/gc.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/rope.h"
+#include <string.h>
+#include <time.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#define POISON(p, size) ASAN_POISON_MEMORY_REGION(p, size)
+#define UNPOISON(p, size) ASAN_UNPOISON_MEMORY_REGION(p, size)
+#else
+#define POISON(p, size) ((void)0)
+#define UNPOISON(p, size) ((void)0)
+#endif
+
+#define NURSERY_SIZE (256 * 1024)
+
+// Anything bigger skips the nursery rather than being copied out of it
+#define LARGE_OBJECT (NURSERY_SIZE / 8)
+
+// The old generation may grow to this, or twice what survived the last
+// full collection, before the next one
+#define OLD_GENERATION_MIN (1024 * 1024)
+
+// In front of every nursery object. Keeps payloads 16-byte aligned.
+typedef struct {
+    uint32_t size;
+    uint32_t kind;
+    void* forward;      // The object's copy in the old generation, once made
+} NurseryHeader;
+
+typedef struct {
+    void* object;       // NULL for a free slot
+    size_t size;
+    GcKind kind;
+    bool marked;
+} OldObject;
+
+// In front of every coroutine and future. These never move, and values
+// say what they are, so the heap finds them through this header rather
+// than the old table, and keeps them on a list of their own for sweeping.
+typedef struct PinnedHeader {
+    struct PinnedHeader* next;
+    GcHeap* heap;       // NULL if made without a heap, and then never freed
+    uint32_t size;
+    uint32_t kind;
+    bool marked;
+    bool remembered;    // In the remembered set
+} PinnedHeader;
+
+// An object reached but not yet traced, or one that may point into the
+// nursery
+typedef struct {
+    void* object;
+    GcKind kind;
+} GrayObject;
+
+typedef struct {
+    void (*trace)(GcHeap* heap, void* object);
+    void (*finalize)(void* object);
+} KindHooks;
+
+static KindHooks hooks[GC_KIND_COUNT];
+
+struct GcHeap {
+    char* nursery;
+    size_t nursery_used;
+
+    // Open-addressed by address, so a full collection can tell its own
+    // objects from pointers it doesn't own
+    OldObject* old;
+    size_t old_capacity;
+    size_t old_count;
+    size_t old_bytes;
+    size_t threshold;
+
+    PinnedHeader* pinned;
+    size_t pinned_count;
+
+    // Old objects that may point into the nursery
+    GrayObject* remembered;
+    int remembered_count;
+    int remembered_capacity;
+
+    GrayObject* gray;
+    int gray_count;
+    int gray_capacity;
+    bool tracing;
+
+    void (*request)(void* data);
+    void* data;
+    bool pending;
+    bool collecting;
+    bool full;
+    int64_t started;
+
+    GcStats stats;
+};
+
+static _Thread_local GcHeap* current;
+
+static int64_t now_nanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t hash_address(const void* object, size_t capacity) {
+    return (size_t)(((uintptr_t)object >> 4) * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+}
+
+static OldObject* find_old(GcHeap* heap, const void* object) {
+    if (heap->old_count == 0) return NULL;
+
+    size_t index = hash_address(object, heap->old_capacity);
+    while (heap->old[index].object) {
+        if (heap->old[index].object == object) return &heap->old[index];
+        index = (index + 1) & (heap->old_capacity - 1);
+    }
+    return NULL;
+}
+
+static void insert_old(OldObject* table, size_t capacity, OldObject entry) {
+    size_t index = hash_address(entry.object, capacity);
+    while (table[index].object) {
+        index = (index + 1) & (capacity - 1);
+    }
+    table[index] = entry;
+}
+
+// Rebuilds the table at the given capacity. Sweeping frees the unmarked
+// objects and clears the marks of the rest.
+static void rebuild_old(GcHeap* heap, size_t capacity, bool sweeping) {
+    OldObject* table = prism_alloc(sizeof(OldObject) * capacity);
+    size_t count = 0;
+
+    for (size_t i = 0; i < heap->old_capacity; i++) {
+        OldObject entry = heap->old[i];
+        if (!entry.object) continue;
+
+        if (sweeping && !entry.marked) {
+            heap->old_bytes -= entry.size;
+            heap->stats.freed_bytes += entry.size;
+            prism_free(entry.object);
+            continue;
+        }
+        if (sweeping) entry.marked = false;
+        insert_old(table, capacity, entry);
+        count++;
+    }
+
+    prism_free(heap->old);
+    heap->old = table;
+    heap->old_capacity = capacity;
+    heap->old_count = count;
+}
+
+static void request_collection(GcHeap* heap) {
+    if (heap->pending || heap->collecting) return;
+    heap->pending = true;
+    if (heap->request) heap->request(heap->data);
+}
+
+static void add_old(GcHeap* heap, void* object, size_t size, GcKind kind) {
+    // At most half full
+    if ((heap->old_count + 1) * 2 > heap->old_capacity) {
+        rebuild_old(heap, heap->old_capacity ? heap->old_capacity * 2 : 256, false);
+    }
+
+    insert_old(heap->old, heap->old_capacity, (OldObject){ object, size, kind, heap->full });
+    heap->old_count++;
+    heap->old_bytes += size;
+    if (heap->old_bytes > heap->threshold) request_collection(heap);
+}
+
+static void push_object(GrayObject** list, int* count, int* capacity, void* object, GcKind kind) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *list = prism_realloc(*list, sizeof(GrayObject) * *capacity);
+    }
+    (*list)[(*count)++] = (GrayObject){ object, kind };
+}
+
+static bool is_pinned(GcKind kind) {
+    return kind == GC_COROUTINE || kind == GC_FUTURE;
+}
+
+static PinnedHeader* pinned_header(void* object) {
+    return (PinnedHeader*)object - 1;
+}
+
+static void remember_pinned(GcHeap* heap, PinnedHeader* header) {
+    header->remembered = true;
+    push_object(&heap->remembered, &heap->remembered_count, &heap->remembered_capacity,
+                header + 1, header->kind);
+}
+
+static void free_pinned(PinnedHeader* header) {
+    if (hooks[header->kind].finalize) hooks[header->kind].finalize(header + 1);
+    prism_free(header);
+}
+
+static void* alloc_pinned(GcHeap* heap, GcKind kind, size_t size) {
+    PinnedHeader* header = prism_alloc(sizeof(PinnedHeader) + size);
+    header->heap = heap;
+    header->size = (uint32_t)size;
+    header->kind = kind;
+    header->marked = false;
+    header->remembered = false;
+    if (!heap) return header + 1;
+
+    header->next = heap->pinned;
+    heap->pinned = header;
+    heap->pinned_count++;
+    heap->old_bytes += size;
+    header->marked = heap->full;
+
+    // Whatever it is about to point at may be in the nursery
+    remember_pinned(heap, header);
+    if (heap->old_bytes > heap->threshold) request_collection(heap);
+    return header + 1;
+}
+
+// Frees the pinned objects nothing reached and clears the marks of the rest
+static void sweep_pinned(GcHeap* heap) {
+    PinnedHeader** link = &heap->pinned;
+    while (*link) {
+        PinnedHeader* header = *link;
+        if (header->marked) {
+            header->marked = false;
+            link = &header->next;
+            continue;
+        }
+
+        *link = header->next;
+        heap->pinned_count--;
+        heap->old_bytes -= header->size;
+        heap->stats.freed_bytes += header->size;
+        free_pinned(header);
+    }
+}
+
+static bool in_nursery(GcHeap* heap, const void* object) {
+    return heap->nursery && (const char*)object >= heap->nursery &&
+           (const char*)object < heap->nursery + heap->nursery_used;
+}
+
+GcHeap* gc_create(void (*request)(void* data), void* data) {
+    GcHeap* heap = prism_alloc(sizeof(GcHeap));
+    heap->threshold = OLD_GENERATION_MIN;
+    heap->request = request;
+    heap->data = data;
+    heap->stats.nursery_size = NURSERY_SIZE;
+    return heap;
+}
+
+void gc_define_kind(GcKind kind, void (*trace)(GcHeap* heap, void* object),
+                    void (*finalize)(void* object)) {
+    hooks[kind].trace = trace;
+    hooks[kind].finalize = finalize;
+}
+
+void gc_free(GcHeap* heap) {
+    if (!heap) return;
+
+    while (heap->pinned) {
+        PinnedHeader* header = heap->pinned;
+        heap->pinned = header->next;
+        free_pinned(header);
+    }
+
+    for (size_t i = 0; i < heap->old_capacity; i++) {
+        prism_free(heap->old[i].object);
+    }
+    if (heap->nursery) UNPOISON(heap->nursery, NURSERY_SIZE);
+    prism_free(heap->nursery);
+    prism_free(heap->old);
+    prism_free(heap->remembered);
+    prism_free(heap->gray);
+    if (current == heap) current = NULL;
+    prism_free(heap);
+}
+
+GcHeap* gc_current() {
+    return current;
+}
+
+void gc_set_current(GcHeap* heap) {
+    current = heap;
+}
+
+void* gc_alloc(GcKind kind, size_t size) {
+    GcHeap* heap = current;
+    if (is_pinned(kind)) return alloc_pinned(heap, kind, size);
+    if (!heap) return prism_alloc(size);
+
+    if (size <= LARGE_OBJECT) {
+        if (!heap->nursery) {
+            heap->nursery = prism_alloc(NURSERY_SIZE);
+            POISON(heap->nursery, NURSERY_SIZE);
+        }
+
+        size_t needed = sizeof(NurseryHeader) + ((size + 15) & ~(size_t)15);
+        if (heap->nursery_used + needed <= NURSERY_SIZE) {
+            NurseryHeader* header = (NurseryHeader*)(heap->nursery + heap->nursery_used);
+            UNPOISON(header, needed);
+            header->size = (uint32_t)size;
+            header->kind = kind;
+            header->forward = NULL;
+            heap->nursery_used += needed;
+            return header + 1;
+        }
+
+        // Full until the next checkpoint collects it
+        request_collection(heap);
+    }
+
+    void* object = prism_alloc(size);
+    add_old(heap, object, size, kind);
+
+    // Whatever it is about to point at may be in the nursery
+    if (kind == GC_ROPE) {
+        push_object(&heap->remembered, &heap->remembered_count, &heap->remembered_capacity, object, kind);
+    }
+    return object;
+}
+
+char* gc_alloc_string(size_t length) {
+    char* chars = gc_alloc(GC_STRING, length + 1);
+    chars[length] = '\0';
+    return chars;
+}
+
+void gc_write_barrier(GcKind kind, void* object) {
+    GcHeap* heap = current;
+    if (!heap) return;
+
+    if (is_pinned(kind)) {
+        PinnedHeader* header = pinned_header(object);
+        if (header->heap == heap && !header->remembered) remember_pinned(heap, header);
+        return;
+    }
+    if (in_nursery(heap, object)) return;
+    push_object(&heap->remembered, &heap->remembered_count, &heap->remembered_capacity, object, kind);
+}
+
+bool gc_pending(GcHeap* heap) {
+    return heap->pending;
+}
+
+// Where the object lives once this collection is over. Copies nursery
+// objects out on first sight and, in a full collection, marks old ones.
+static void* visit_object(GcHeap* heap, void* object) {
+    if (in_nursery(heap, object)) {
+        NurseryHeader* header = (NurseryHeader*)object - 1;
+        if (!header->forward) {
+            void* copy = prism_alloc(header->size);
+            memcpy(copy, object, header->size);
+            add_old(heap, copy, header->size, header->kind);
+            heap->stats.promoted_bytes += header->size;
+            header->forward = copy;
+            if (header->kind == GC_ROPE) {
+                push_object(&heap->gray, &heap->gray_count, &heap->gray_capacity, copy, GC_ROPE);
+            }
+        }
+        return header->forward;
+    }
+
+    if (heap->full) {
+        OldObject* entry = find_old(heap, object);
+        if (entry && !entry->marked) {
+            entry->marked = true;
+            if (entry->kind == GC_ROPE) {
+                push_object(&heap->gray, &heap->gray_count, &heap->gray_capacity, object, GC_ROPE);
+            }
+        }
+    }
+    return object;
+}
+
+// Pinned objects are only ever marked, and only those of this heap
+static void visit_pinned(GcHeap* heap, void* object) {
+    PinnedHeader* header = pinned_header(object);
+    if (!heap->full || header->heap != heap || header->marked) return;
+    header->marked = true;
+    push_object(&heap->gray, &heap->gray_count, &heap->gray_capacity, object, header->kind);
+}
+
+static void visit_value(GcHeap* heap, PrismValue* value) {
+    if (IS_ROPE(*value)) {
+        *value = PTR_VAL(TYPE_ROPE, visit_object(heap, AS_PTR(*value)));
+    } else if (VALUE_TYPE(*value) == TYPE_COROUTINE || VALUE_TYPE(*value) == TYPE_FUTURE) {
+        if (AS_PTR(*value)) visit_pinned(heap, AS_PTR(*value));
+    } else if (IS_STRING(*value) && !IS_SMALL_STRING(*value) && AS_PTR(*value)) {
+        *value = STRING_VAL(visit_object(heap, AS_PTR(*value)));
+#ifdef PRISM_NAN_BOXING
+    } else if (IS_BIGINT(*value)) {
+        *value = BIGINT_VAL(visit_object(heap, AS_PTR(*value)));
+#endif
+    }
+}
+
+// A kind's trace hook calls back into gc_visit, which leaves the gray
+// objects it finds to the loop already running
+static void trace_gray(GcHeap* heap) {
+    if (heap->tracing) return;
+    heap->tracing = true;
+
+    while (heap->gray_count > 0) {
+        GrayObject gray = heap->gray[--heap->gray_count];
+        if (gray.kind == GC_ROPE) {
+            PrismRope* rope = gray.object;
+            visit_value(heap, &rope->left);
+            visit_value(heap, &rope->right);
+            if (rope->flat) rope->flat = visit_object(heap, rope->flat);
+        } else if (hooks[gray.kind].trace) {
+            hooks[gray.kind].trace(heap, gray.object);
+        }
+    }
+    heap->tracing = false;
+}
+
+void gc_begin(GcHeap* heap, bool full) {
+    heap->started = now_nanoseconds();
+    heap->collecting = true;
+    heap->full = full || heap->old_bytes > heap->threshold;
+
+    // A full collection traces every live old object anyway
+    for (int i = 0; i < heap->remembered_count; i++) {
+        GrayObject remembered = heap->remembered[i];
+        if (is_pinned(remembered.kind)) pinned_header(remembered.object)->remembered = false;
+        if (!heap->full) {
+            push_object(&heap->gray, &heap->gray_count, &heap->gray_capacity, remembered.object, remembered.kind);
+        }
+    }
+    heap->remembered_count = 0;
+}
+
+void gc_visit(GcHeap* heap, PrismValue* values, int count) {
+    for (int i = 0; i < count; i++) {
+        visit_value(heap, &values[i]);
+    }
+    trace_gray(heap);
+}
+
+void gc_end(GcHeap* heap) {
+    trace_gray(heap);
+
+    if (heap->full) {
+        size_t capacity = heap->old_capacity;
+        while (capacity > 256 && heap->old_count * 8 < capacity) capacity /= 2;
+        rebuild_old(heap, capacity, true);
+        sweep_pinned(heap);
+
+        heap->threshold = heap->old_bytes * 2;
+        if (heap->threshold < OLD_GENERATION_MIN) heap->threshold = OLD_GENERATION_MIN;
+        heap->stats.major_collections++;
+    } else {
+        heap->stats.minor_collections++;
+    }
+
+    if (heap->nursery) POISON(heap->nursery, NURSERY_SIZE);
+    heap->nursery_used = 0;
+    heap->full = false;
+    heap->collecting = false;
+    heap->pending = false;
+
+    int64_t pause = now_nanoseconds() - heap->started;
+    heap->stats.last_pause = pause;
+    heap->stats.total_pause += pause;
+    if (pause > heap->stats.max_pause) heap->stats.max_pause = pause;
+}
+
+void gc_get_stats(GcHeap* heap, GcStats* stats) {
+    *stats = heap->stats;
+    stats->nursery_used = heap->nursery_used;
+    stats->old_bytes = heap->old_bytes;
+    stats->old_objects = heap->old_count + heap->pinned_count;
+}
@@ -0,0 +1,104 @@
+#include "../../include/common/intern.h"
+#include "../../include/common/memory.h"
+#include <pthread.h>
+#include <string.h>
+
+#define INITIAL_TABLE_CAPACITY 256
+
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    char chars[];
+} InternedString;
+
+// Open addressing with linear probing, kept at most three quarters full
+static InternedString** table;
+static size_t capacity;
+static size_t count;
+static size_t bytes;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static InternedString* header(const char* string) {
+    return (InternedString*)(string - offsetof(InternedString, chars));
+}
+
+// FNV-1a
+static uint32_t hash_chars(const char* chars, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void grow() {
+    size_t new_capacity = capacity ? capacity * 2 : INITIAL_TABLE_CAPACITY;
+    InternedString** entries = prism_alloc(sizeof(InternedString*) * new_capacity);
+    
+    for (size_t i = 0; i < capacity; i++) {
+        InternedString* entry = table[i];
+        if (!entry) continue;
+        size_t slot = entry->hash & (new_capacity - 1);
+        while (entries[slot]) slot = (slot + 1) & (new_capacity - 1);
+        entries[slot] = entry;
+    }
+    
+    prism_free(table);
+    table = entries;
+    capacity = new_capacity;
+}
+
+const char* intern_string(const char* chars, size_t length) {
+    uint32_t hash = hash_chars(chars, length);
+    
+    pthread_mutex_lock(&lock);
+    if ((count + 1) * 4 > capacity * 3) grow();
+    
+    size_t slot = hash & (capacity - 1);
+    for (InternedString* entry; (entry = table[slot]); slot = (slot + 1) & (capacity - 1)) {
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->chars, chars, length) == 0) {
+            pthread_mutex_unlock(&lock);
+            return entry->chars;
+        }
+    }
+    
+    InternedString* entry = prism_alloc(sizeof(InternedString) + length + 1);
+    entry->hash = hash;
+    entry->length = (uint32_t)length;
+    memcpy(entry->chars, chars, length);
+    entry->chars[length] = '\0';
+    
+    table[slot] = entry;
+    count++;
+    bytes += sizeof(InternedString) + length + 1;
+    pthread_mutex_unlock(&lock);
+    return entry->chars;
+}
+
+const char* intern_cstring(const char* chars) {
+    return intern_string(chars, strlen(chars));
+}
+
+uint32_t interned_hash(const char* string) {
+    return header(string)->hash;
+}
+
+size_t interned_length(const char* string) {
+    return header(string)->length;
+}
+
+size_t intern_count() {
+    pthread_mutex_lock(&lock);
+    size_t result = count;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+size_t intern_bytes() {
+    pthread_mutex_lock(&lock);
+    size_t result = bytes;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
@@ -25,19 +25,24 @@ void prism_free(void* ptr) {
     if (ptr) free(ptr);
 }
 
+// Zero payload of the given type
+static PrismValue empty_value(PrismType type) {
+    switch (type) {
+        case TYPE_INT: return INT_VAL(0);
+        case TYPE_FLOAT: return FLOAT_VAL(0.0);
+        case TYPE_BOOL: return BOOL_VAL(false);
+        default: return PTR_VAL(type, NULL);
+    }
+}
+
 PrismValue* prism_value_create(PrismType type) {
     PrismValue* value = (PrismValue*)prism_alloc(sizeof(PrismValue));
-    value->type = type;
+    *value = empty_value(type);
     return value;
 }
 
 void prism_value_free(PrismValue* value) {
     if (!value) return;
-    
-    if (value->type == TYPE_STRING && value->value.s) {
-        prism_free(value->value.s);
-    }
-    
     prism_free(value);
 }
 
@@ -47,7 +52,7 @@ PrismVariable* prism_var_create(char* name, PrismType type, bool exposed, bool i
     var->type = type;
     var->exposed = exposed;
     var->internal = internal;
-    var->value.type = type;
+    var->value = empty_value(type);
     return var;
 }
 
@@ -55,9 +60,5 @@ void prism_var_free(PrismVariable* var) {
     if (!var) return;
     
     if (var->name) prism_free(var->name);
-    if (var->value.type == TYPE_STRING && var->value.value.s) {
-        prism_free(var->value.value.s);
-    }
-    
     prism_free(var);
 }
\ No newline at end of file
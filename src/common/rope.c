@@ -0,0 +1,128 @@
+#include "../../include/common/rope.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/gc.h"
+#include <string.h>
+
+// Results shorter than this are copied into a plain string
+#define ROPE_MIN_LENGTH 64
+
+// How long the last leaf of a rope may grow by merging short pieces
+#define ROPE_LEAF_MAX 256
+
+// Small strings live inside the value, so this takes the value's address
+static const char* string_chars(const PrismValue* value) {
+    const char* chars = AS_STRING(*value);
+    return chars ? chars : "";
+}
+
+static size_t text_length(PrismValue value) {
+    if (IS_ROPE(value)) return ((PrismRope*)AS_PTR(value))->length;
+    return strlen(string_chars(&value));
+}
+
+static size_t text_depth(PrismValue value) {
+    return IS_ROPE(value) ? ((PrismRope*)AS_PTR(value))->depth : 0;
+}
+
+static PrismValue join(const char* a, size_t len_a, const char* b, size_t len_b) {
+    if (len_a + len_b <= PRISM_SMALL_STRING_MAX) {
+        char chars[PRISM_SMALL_STRING_MAX];
+        memcpy(chars, a, len_a);
+        memcpy(chars + len_a, b, len_b);
+        return prism_string_value(chars, len_a + len_b);
+    }
+
+    char* joined = gc_alloc_string(len_a + len_b);
+    memcpy(joined, a, len_a);
+    memcpy(joined + len_a, b, len_b);
+    return STRING_VAL(joined);
+}
+
+static PrismValue make_node(PrismValue left, PrismValue right, size_t length) {
+    PrismRope* rope = gc_alloc(GC_ROPE, sizeof(PrismRope));
+    size_t depth_left = text_depth(left);
+    size_t depth_right = text_depth(right);
+    rope->length = length;
+    rope->depth = 1 + (depth_left > depth_right ? depth_left : depth_right);
+    rope->flat = NULL;
+    rope->left = left;
+    rope->right = right;
+    return PTR_VAL(TYPE_ROPE, rope);
+}
+
+PrismValue rope_concat(PrismValue a, PrismValue b) {
+    size_t len_a = text_length(a);
+    size_t len_b = text_length(b);
+    if (len_b == 0) return a;
+    if (len_a == 0) return b;
+
+    // Ropes are never this short, so both sides are plain strings
+    if (len_a + len_b < ROPE_MIN_LENGTH) {
+        return join(string_chars(&a), len_a, string_chars(&b), len_b);
+    }
+
+    if (IS_ROPE(a) && IS_STRING(b)) {
+        PrismRope* rope = AS_PTR(a);
+        if (!rope->flat && IS_STRING(rope->right) && len_b < ROPE_LEAF_MAX) {
+            const char* leaf = string_chars(&rope->right);
+            size_t len_leaf = strlen(leaf);
+            if (len_leaf + len_b <= ROPE_LEAF_MAX) {
+                return make_node(rope->left, join(leaf, len_leaf, string_chars(&b), len_b), len_a + len_b);
+            }
+        }
+    }
+
+    return make_node(a, b, len_a + len_b);
+}
+
+char* rope_flatten(PrismRope* rope) {
+    if (rope->flat) return rope->flat;
+
+    char* chars = gc_alloc_string(rope->length);
+    size_t end = rope->length;
+
+    // Fills the buffer back to front, right halves first. At most one
+    // pending left half per level, plus the piece being split.
+    PrismValue* pending = prism_alloc(sizeof(PrismValue) * (rope->depth + 1));
+    int count = 0;
+    pending[count++] = rope->left;
+    pending[count++] = rope->right;
+
+    while (count > 0) {
+        PrismValue piece = pending[--count];
+        if (IS_ROPE(piece)) {
+            PrismRope* node = AS_PTR(piece);
+            if (!node->flat) {
+                pending[count++] = node->left;
+                pending[count++] = node->right;
+                continue;
+            }
+            end -= node->length;
+            memcpy(chars + end, node->flat, node->length);
+        } else {
+            const char* string = string_chars(&piece);
+            size_t length = strlen(string);
+            end -= length;
+            memcpy(chars + end, string, length);
+        }
+    }
+    prism_free(pending);
+
+    // The halves aren't needed any more
+    rope->flat = chars;
+    rope->left = NONE_VAL;
+    rope->right = NONE_VAL;
+    gc_write_barrier(GC_ROPE, rope);
+    return chars;
+}
+
+PrismValue rope_flatten_value(PrismValue value) {
+    if (!IS_ROPE(value)) return value;
+    return STRING_VAL(rope_flatten(AS_PTR(value)));
+}
+
+void rope_flatten_args(PrismValue* args, int arg_count) {
+    for (int i = 0; i < arg_count; i++) {
+        if (IS_ROPE(args[i])) args[i] = STRING_VAL(rope_flatten(AS_PTR(args[i])));
+    }
+}
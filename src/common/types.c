@@ -1,5 +1,7 @@
 #include "../../include/common/types.h"
 #include "../../include/common/memory.h"
+#include "../../include/common/rope.h"
+#include "../../include/common/gc.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -13,6 +15,10 @@ const char* prism_type_to_string(PrismType type) {
         case TYPE_FUNCTION: return "function";
         case TYPE_NATIVE: return "native_function";
         case TYPE_PRISM: return "prism";
+        case TYPE_COROUTINE: return "coroutine";
+        case TYPE_FUTURE: return "future";
+        // A rope is a string built by concatenation, not yet flattened
+        case TYPE_ROPE: return "string";
         default: return "unknown";
     }
 }
@@ -26,116 +32,138 @@ PrismType prism_type_from_string(const char* str) {
     if (strcmp(str, "function") == 0) return TYPE_FUNCTION;
     if (strcmp(str, "native_function") == 0) return TYPE_NATIVE;
     if (strcmp(str, "prism") == 0) return TYPE_PRISM;
+    if (strcmp(str, "coroutine") == 0) return TYPE_COROUTINE;
+    if (strcmp(str, "future") == 0) return TYPE_FUTURE;
     return TYPE_NONE; // Default
 }
 
+PrismValue prism_string_value(const char* chars, size_t length) {
+    if (length > PRISM_SMALL_STRING_MAX) {
+        char* copy = gc_alloc_string(length);
+        memcpy(copy, chars, length);
+        return STRING_VAL(copy);
+    }
+    
+#ifdef PRISM_NAN_BOXING
+    uint64_t payload = 0;
+    memcpy(&payload, chars, length);
+    return NANBOX_MAKE(NANBOX_TAG_SMALL_STRING, payload);
+#else
+    PrismValue value = { .type = TYPE_STRING, .small = true };
+    memcpy(value.value.chars, chars, length);
+    return value;
+#endif
+}
+
 PrismValue prism_value_convert(PrismValue value, PrismType target_type) {
-    PrismValue result;
-    result.type = target_type;
+    PrismValue result = NONE_VAL;
+    value = rope_flatten_value(value);
     
     // Convert based on target type
     switch (target_type) {
         case TYPE_STRING:
-            switch (value.type) {
+            switch (VALUE_TYPE(value)) {
                 case TYPE_INT: {
                     char buffer[32];
-                    snprintf(buffer, sizeof(buffer), "%ld", value.value.i);
-                    result.value.s = strdup(buffer);
+                    int length = snprintf(buffer, sizeof(buffer), "%lld", (long long)AS_INT(value));
+                    result = prism_string_value(buffer, length);
                     break;
                 }
                 case TYPE_FLOAT: {
                     char buffer[32];
-                    snprintf(buffer, sizeof(buffer), "%g", value.value.f);
-                    result.value.s = strdup(buffer);
+                    int length = snprintf(buffer, sizeof(buffer), "%g", AS_FLOAT(value));
+                    result = prism_string_value(buffer, length);
                     break;
                 }
                 case TYPE_BOOL:
-                    result.value.s = strdup(value.value.b ? "true" : "false");
+                    result = AS_BOOL(value) ? prism_string_value("true", 4) : prism_string_value("false", 5);
                     break;
                 case TYPE_STRING:
-                    result.value.s = strdup(value.value.s);
+                    result = prism_string_value(AS_STRING(value), strlen(AS_STRING(value)));
                     break;
                 default:
-                    result.value.s = strdup("<unknown>");
+                    result = prism_string_value("<unknown>", 9);
                     break;
             }
             break;
             
         case TYPE_INT:
-            switch (value.type) {
+            switch (VALUE_TYPE(value)) {
                 case TYPE_INT:
-                    result.value.i = value.value.i;
+                    result = value;
                     break;
                 case TYPE_FLOAT:
-                    result.value.i = (int64_t)value.value.f;
+                    result = INT_VAL((int64_t)AS_FLOAT(value));
                     break;
                 case TYPE_BOOL:
-                    result.value.i = value.value.b ? 1 : 0;
+                    result = INT_VAL(AS_BOOL(value) ? 1 : 0);
                     break;
                 case TYPE_STRING: {
                     char* end;
-                    result.value.i = strtol(value.value.s, &end, 10);
+                    int64_t i = strtol(AS_STRING(value), &end, 10);
                     if (*end != '\0') {
                         // Not a complete conversion
-                        result.value.i = 0;
+                        i = 0;
                     }
+                    result = INT_VAL(i);
                     break;
                 }
                 default:
-                    result.value.i = 0;
+                    result = INT_VAL(0);
                     break;
             }
             break;
             
         case TYPE_FLOAT:
-            switch (value.type) {
+            switch (VALUE_TYPE(value)) {
                 case TYPE_INT:
-                    result.value.f = (double)value.value.i;
+                    result = FLOAT_VAL((double)AS_INT(value));
                     break;
                 case TYPE_FLOAT:
-                    result.value.f = value.value.f;
+                    result = value;
                     break;
                 case TYPE_BOOL:
-                    result.value.f = value.value.b ? 1.0 : 0.0;
+                    result = FLOAT_VAL(AS_BOOL(value) ? 1.0 : 0.0);
                     break;
                 case TYPE_STRING: {
                     char* end;
-                    result.value.f = strtod(value.value.s, &end);
+                    double f = strtod(AS_STRING(value), &end);
                     if (*end != '\0') {
                         // Not a complete conversion
-                        result.value.f = 0.0;
+                        f = 0.0;
                     }
+                    result = FLOAT_VAL(f);
                     break;
                 }
                 default:
-                    result.value.f = 0.0;
+                    result = FLOAT_VAL(0.0);
                     break;
             }
             break;
             
         case TYPE_BOOL:
-            switch (value.type) {
+            switch (VALUE_TYPE(value)) {
                 case TYPE_INT:
-                    result.value.b = (value.value.i != 0);
+                    result = BOOL_VAL(AS_INT(value) != 0);
                     break;
                 case TYPE_FLOAT:
-                    result.value.b = (value.value.f != 0.0);
+                    result = BOOL_VAL(AS_FLOAT(value) != 0.0);
                     break;
                 case TYPE_BOOL:
-                    result.value.b = value.value.b;
+                    result = value;
                     break;
                 case TYPE_STRING:
                     // "true" or non-empty string is true
-                    result.value.b = (strcmp(value.value.s, "true") == 0 || strlen(value.value.s) > 0);
+                    result = BOOL_VAL(strcmp(AS_STRING(value), "true") == 0 || strlen(AS_STRING(value)) > 0);
                     break;
                 default:
-                    result.value.b = false;
+                    result = BOOL_VAL(false);
                     break;
             }
             break;
             
         default:
-            result.type = TYPE_NONE;
+            result = NONE_VAL;
             break;
     }
     
@@ -143,24 +171,17 @@ PrismValue prism_value_convert(PrismValue value, PrismType target_type) {
 }
 
 void prism_value_set(PrismValue* dest, PrismValue* src) {
-    dest->type = src->type;
-    
-    switch (src->type) {
-        case TYPE_INT:
-            dest->value.i = src->value.i;
-            break;
-        case TYPE_FLOAT:
-            dest->value.f = src->value.f;
-            break;
-        case TYPE_BOOL:
-            dest->value.b = src->value.b;
-            break;
-        case TYPE_STRING:
-            if (dest->value.s) prism_free(dest->value.s);
-            dest->value.s = strdup(src->value.s);
-            break;
-        default:
-            dest->value.ptr = src->value.ptr;
-            break;
+    if (IS_STRING(*src)) {
+        *dest = prism_string_value(AS_STRING(*src), strlen(AS_STRING(*src)));
+    } else {
+        *dest = *src;
     }
-}
\ No newline at end of file
+}
+
+#ifdef PRISM_NAN_BOXING
+PrismValue prism_box_int(int64_t i) {
+    int64_t* box = gc_alloc(GC_BIGINT, sizeof(int64_t));
+    *box = i;
+    return NANBOX_MAKE(NANBOX_TAG_BIGINT, (uintptr_t)box);
+}
+#endif
@@ -1,10 +1,22 @@
 #include "../../include/common/util.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
+#include "../../include/common/rope.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Per thread, so VMs on different threads can write to different streams
+static _Thread_local FILE* output;
+
+FILE* prism_output() {
+    return output ? output : stdout;
+}
+
+void prism_set_output(FILE* out) {
+    output = out;
+}
+
 char* prism_read_file(const char* path) {
     FILE* file = fopen(path, "rb");
     if (!file) {
@@ -43,23 +55,27 @@ void prism_write_file(const char* path, const char* content) {
 char* prism_format_value(PrismValue value) {
     char buffer[128];
     
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case TYPE_INT:
-            snprintf(buffer, sizeof(buffer), "%lld", (long long)value.value.i);
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)AS_INT(value));
             break;
         case TYPE_FLOAT:
-            snprintf(buffer, sizeof(buffer), "%g", value.value.f);
+            snprintf(buffer, sizeof(buffer), "%g", AS_FLOAT(value));
             break;
         case TYPE_BOOL:
-            snprintf(buffer, sizeof(buffer), "%s", value.value.b ? "true" : "false");
+            snprintf(buffer, sizeof(buffer), "%s", AS_BOOL(value) ? "true" : "false");
             break;
-        case TYPE_STRING:
-            return strdup(value.value.s ? value.value.s : "");
+        case TYPE_STRING: {
+            const char* chars = AS_STRING(value);
+            return strdup(chars ? chars : "");
+        }
+        case TYPE_ROPE:
+            return strdup(rope_flatten(AS_PTR(value)));
         case TYPE_NONE:
             snprintf(buffer, sizeof(buffer), "None");
             break;
         default:
-            snprintf(buffer, sizeof(buffer), "[%s]", prism_type_to_string(value.type));
+            snprintf(buffer, sizeof(buffer), "[%s]", prism_type_to_string(VALUE_TYPE(value)));
             break;
     }
     
@@ -68,6 +84,6 @@ char* prism_format_value(PrismValue value) {
 
 void prism_print_value(PrismValue value) {
     char* formatted = prism_format_value(value);
-    printf("%s", formatted);
+    fputs(formatted, prism_output());
     prism_free(formatted);
 }
\ No newline at end of file
@@ -0,0 +1,484 @@
+#include "../../include/core/aot.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/lib/std.h"
+#include "../../include/lib/io.h"
+#include <math.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Set by the Makefile to where the headers and libprism.a live, so compiled
+ * programs can be built from any working directory */
+#ifndef PRISM_INCLUDE_DIR
+#define PRISM_INCLUDE_DIR "include"
+#endif
+#ifndef PRISM_LIB_DIR
+#define PRISM_LIB_DIR "build"
+#endif
+
+extern char** environ;
+
+/* Natives are bound to a table index at compile time; the generated code
+ * calls them by their C symbol instead. Every native registered by the
+ * standard libraries has to be listed here. */
+#define AOT_NATIVE(f) { f, #f }
+
+static const struct {
+    PrismValue (*function)(PrismValue*, int);
+    const char* symbol;
+} native_symbols[] = {
+    AOT_NATIVE(prism_std_print),
+    AOT_NATIVE(prism_std_render),
+    AOT_NATIVE(prism_std_input),
+    AOT_NATIVE(prism_std_type),
+    AOT_NATIVE(prism_std_string),
+    AOT_NATIVE(prism_std_int),
+    AOT_NATIVE(prism_std_float),
+    AOT_NATIVE(prism_std_bool),
+    AOT_NATIVE(prism_std_done),
+    AOT_NATIVE(prism_io_read_file),
+    AOT_NATIVE(prism_io_write_file),
+    AOT_NATIVE(prism_io_append_file),
+    AOT_NATIVE(prism_io_file_exists),
+    AOT_NATIVE(prism_io_delete_file),
+    AOT_NATIVE(prism_io_read_file_async),
+    AOT_NATIVE(prism_io_write_file_async),
+    AOT_NATIVE(prism_io_append_file_async),
+    AOT_NATIVE(prism_io_await),
+};
+
+#define NATIVE_SYMBOL_COUNT (int)(sizeof(native_symbols) / sizeof(native_symbols[0]))
+
+static const char* native_symbol(CodeGenerator* generator, int index) {
+    NativeFunction* native = &generator->natives[index];
+    for (int i = 0; i < NATIVE_SYMBOL_COUNT; i++) {
+        if (native_symbols[i].function == native->function) return native_symbols[i].symbol;
+    }
+    prism_error("Native function '%s' has no symbol to link against", native->name);
+    return NULL;
+}
+
+/* Shared definitions at the top of every generated file. Arithmetic takes
+ * the int path inline and leaves everything else to the runtime. */
+static const char* prelude =
+    "#include \"core/aot.h\"\n"
+    "#include \"lib/std.h\"\n"
+    "#include \"lib/io.h\"\n"
+    "#include <math.h>\n"
+    "\n"
+    "#define ARITH(op, sym, a, b) (IS_INT(a) && IS_INT(b) \\\n"
+    "    ? INT_VAL(AS_INT(a) sym AS_INT(b)) : prism_aot_arith(op, a, b))\n"
+    "#define ADD(a, b) ARITH(OP_ADD, +, a, b)\n"
+    "#define SUBTRACT(a, b) ARITH(OP_SUBTRACT, -, a, b)\n"
+    "#define MULTIPLY(a, b) ARITH(OP_MULTIPLY, *, a, b)\n"
+    "#define DIVIDE(a, b) prism_aot_arith(OP_DIVIDE, a, b)\n"
+    "#define NEGATE(a) (IS_INT(a) ? INT_VAL(-AS_INT(a)) : prism_aot_negate(a))\n"
+    "\n"
+    "// Call depth, bounded like the interpreter's frame stack\n"
+    "static int depth;\n"
+    "#define ENTER() if (++depth > STACK_MAX) prism_aot_overflow()\n"
+    "#define LEAVE() depth--\n"
+    "\n";
+
+static void emit_string_literal(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c == '\t') {
+            fputs("\\t", out);
+        } else if (c < 0x20 || c >= 0x7F) {
+            // Octal escapes stop after three digits, unlike hex ones
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static int function_index(CodeGenerator* generator, void* proto) {
+    for (int i = 0; i < generator->chunk_count; i++) {
+        if (generator->functions[i] == proto) return i;
+    }
+    return -1;
+}
+
+// Writes a constant as a C expression
+static bool emit_constant(CodeGenerator* generator, FILE* out, PrismValue value) {
+    switch (VALUE_TYPE(value)) {
+        case TYPE_NONE:
+            fputs("NONE_VAL", out);
+            return true;
+        case TYPE_INT:
+            if (AS_INT(value) == INT64_MIN) {
+                fputs("INT_VAL(INT64_MIN)", out);
+            } else {
+                fprintf(out, "INT_VAL(INT64_C(%lld))", (long long)AS_INT(value));
+            }
+            return true;
+        case TYPE_FLOAT: {
+            double f = AS_FLOAT(value);
+            if (isnan(f)) {
+                fputs("FLOAT_VAL(NAN)", out);
+            } else if (isinf(f)) {
+                fputs(f > 0 ? "FLOAT_VAL(HUGE_VAL)" : "FLOAT_VAL(-HUGE_VAL)", out);
+            } else {
+                // Hex floats round-trip exactly
+                fprintf(out, "FLOAT_VAL(%a)", f);
+            }
+            return true;
+        }
+        case TYPE_BOOL:
+            fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+            return true;
+        case TYPE_STRING:
+            fputs("STRING_VAL((char*)", out);
+            emit_string_literal(out, AS_STRING(value));
+            fputs(")", out);
+            return true;
+        case TYPE_FUNCTION:
+        case TYPE_PRISM: {
+            int index = function_index(generator, AS_PTR(value));
+            if (index < 0) break;
+            fprintf(out, "PTR_VAL(%s, (void*)&functions[%d])",
+                    VALUE_TYPE(value) == TYPE_FUNCTION ? "TYPE_FUNCTION" : "TYPE_PRISM", index);
+            return true;
+        }
+        default:
+            break;
+    }
+    prism_error("Cannot compile a constant of type %s", prism_type_to_string(VALUE_TYPE(value)));
+    return false;
+}
+
+static void emit_signature(FILE* out, FunctionProto* function, int index) {
+    fprintf(out, "static PrismValue f%d(", index);
+    if (function->arity == 0) fputs("void", out);
+    for (int i = 0; i < function->arity; i++) {
+        fprintf(out, "%sPrismValue l%d", i > 0 ? ", " : "", i);
+    }
+    fputs(")", out);
+}
+
+// Copies count operand slots starting at first into a local args array, for
+// calls that take their arguments by pointer
+static void emit_args(FILE* out, int first, int count) {
+    fprintf(out, "PrismValue args[%d] = {", count > 0 ? count : 1);
+    if (count == 0) fputs("NONE_VAL", out);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%ss%d", i > 0 ? ", " : "", first + i);
+    }
+    fputs("}; ", out);
+}
+
+// Writes the callee's C call for a CALL-family instruction with the callee
+// in slot callee, or a call through the runtime when it isn't known
+static void emit_call(FILE* out, CodeGenerator* generator, int known, int callee, int arg_count) {
+    if (known >= 0 && generator->functions[known]->arity == arg_count) {
+        fprintf(out, "f%d(", known);
+        for (int i = 0; i < arg_count; i++) {
+            fprintf(out, "%ss%d", i > 0 ? ", " : "", callee + 1 + i);
+        }
+        fputs(")", out);
+    } else {
+        fprintf(out, "prism_aot_call(s%d, args, %d)", callee, arg_count);
+    }
+}
+
+// Whether the instruction leaves a new value in the top operand slot
+static bool writes_result(OpCode op) {
+    switch (op) {
+        case OP_NOP:
+        case OP_POP:
+        case OP_SPAWN:
+        case OP_STORE:
+        case OP_STORE_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_CALL_DISCARD:
+        case OP_TAIL_CALL:
+        case OP_RETURN:
+        case OP_RETURN_NIL:
+        case OP_END:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool emit_function(CodeGenerator* generator, FILE* out, int index) {
+    FunctionProto* function = generator->functions[index];
+    CodeChunk* chunk = &generator->chunks[index];
+    const OpCode* code = chunk->code;
+    int count = chunk->count;
+    bool ok = true;
+
+    // Jump targets get labels. Forward jumps only ever meet straight-line
+    // code at the same depth, so one pass gives every instruction its depth.
+    bool* targets = prism_alloc(sizeof(bool) * (count + 1));
+    memset(targets, 0, sizeof(bool) * (count + 1));
+    for (int ip = 0; ip < count; ip += codegen_op_length(code[ip])) {
+        if (code[ip] == OP_JUMP || code[ip] == OP_JUMP_IF_FALSE) {
+            targets[ip + 3 + ((code[ip + 1] << 8) | code[ip + 2])] = true;
+        }
+    }
+
+    // Which function constant each operand slot holds, if any, so calls to
+    // it can be made directly
+    int slots = function->max_stack > 0 ? function->max_stack : 1;
+    int* known = prism_alloc(sizeof(int) * slots);
+    for (int i = 0; i < slots; i++) known[i] = -1;
+
+    fprintf(out, "// %s\n", function->name);
+    emit_signature(out, function, index);
+    fputs(" {\n", out);
+    for (int i = function->arity; i < function->local_count; i++) {
+        fprintf(out, "    PrismValue l%d = NONE_VAL;\n", i);
+    }
+    for (int i = 0; i < function->max_stack; i++) {
+        fprintf(out, "    PrismValue s%d;\n", i);
+    }
+    fputs("    ENTER();\n", out);
+
+    int d = 0;
+    for (int ip = 0; ip < count && ok; ip += codegen_op_length(code[ip])) {
+        if (targets[ip]) {
+            fprintf(out, "L%d:;\n", ip);
+            for (int i = 0; i < slots; i++) known[i] = -1;
+        }
+
+        // Pops only move the depth, and compiled programs run prisms inline
+        if (code[ip] != OP_NOP && code[ip] != OP_POP && code[ip] != OP_SPAWN) fputs("    ", out);
+        switch (code[ip]) {
+            case OP_NOP:
+            case OP_POP:
+            case OP_SPAWN:
+                break;
+            case OP_CONSTANT: {
+                PrismValue value = chunk->constants[code[ip + 1]];
+                fprintf(out, "s%d = ", d);
+                ok = emit_constant(generator, out, value);
+                fputs(";\n", out);
+                known[d] = IS_FUNCTION(value) || VALUE_TYPE(value) == TYPE_PRISM
+                    ? function_index(generator, AS_PTR(value)) : -1;
+                break;
+            }
+            case OP_ADD:
+            case OP_ADD_INT_INT:
+            case OP_ADD_FLOAT_FLOAT:
+            case OP_ADD_STR_STR:
+                fprintf(out, "s%d = ADD(s%d, s%d);\n", d - 2, d - 2, d - 1);
+                break;
+            case OP_SUBTRACT:
+            case OP_SUBTRACT_INT_INT:
+            case OP_SUBTRACT_FLOAT_FLOAT:
+                fprintf(out, "s%d = SUBTRACT(s%d, s%d);\n", d - 2, d - 2, d - 1);
+                break;
+            case OP_MULTIPLY:
+            case OP_MULTIPLY_INT_INT:
+            case OP_MULTIPLY_FLOAT_FLOAT:
+                fprintf(out, "s%d = MULTIPLY(s%d, s%d);\n", d - 2, d - 2, d - 1);
+                break;
+            case OP_DIVIDE:
+                fprintf(out, "s%d = DIVIDE(s%d, s%d);\n", d - 2, d - 2, d - 1);
+                break;
+            case OP_NEGATE:
+                fprintf(out, "s%d = NEGATE(s%d);\n", d - 1, d - 1);
+                break;
+            case OP_ADD_CONST:
+                fprintf(out, "s%d = ADD(s%d, ", d - 1, d - 1);
+                ok = emit_constant(generator, out, chunk->constants[code[ip + 1]]);
+                fputs(");\n", out);
+                break;
+            case OP_ADD_LOCALS:
+                fprintf(out, "s%d = ADD(l%d, l%d);\n", d, code[ip + 1], code[ip + 2]);
+                break;
+            case OP_LOAD:
+                fprintf(out, "s%d = l%d;\n", d, code[ip + 1]);
+                break;
+            case OP_STORE:
+                fprintf(out, "l%d = s%d;\n", code[ip + 1], d - 1);
+                break;
+            case OP_LOAD_GLOBAL:
+                fprintf(out, "s%d = globals[%d];\n", d, code[ip + 1]);
+                break;
+            case OP_STORE_GLOBAL:
+                fprintf(out, "globals[%d] = s%d;\n", code[ip + 1], d - 1);
+                break;
+            case OP_JUMP:
+                fprintf(out, "goto L%d;\n", ip + 3 + ((code[ip + 1] << 8) | code[ip + 2]));
+                break;
+            case OP_JUMP_IF_FALSE:
+                fprintf(out, "if (prism_aot_falsey(s%d)) goto L%d;\n",
+                        d - 1, ip + 3 + ((code[ip + 1] << 8) | code[ip + 2]));
+                break;
+            case OP_CALL:
+            case OP_CALL_DISCARD:
+            case OP_TAIL_CALL: {
+                int arg_count = code[ip + 1];
+                int callee = d - arg_count - 1;
+                bool direct = known[callee] >= 0 &&
+                              generator->functions[known[callee]]->arity == arg_count;
+                fputs("{ ", out);
+                if (!direct) emit_args(out, callee + 1, arg_count);
+                if (code[ip] == OP_TAIL_CALL) {
+                    // A sibling call, which the C compiler turns into a jump
+                    fputs("LEAVE(); return ", out);
+                } else if (code[ip] == OP_CALL) {
+                    fprintf(out, "s%d = ", callee);
+                }
+                emit_call(out, generator, known[callee], callee, arg_count);
+                fputs("; }\n", out);
+                break;
+            }
+            case OP_CALL_NATIVE: {
+                int arg_count = code[ip + 2];
+                const char* symbol = native_symbol(generator, code[ip + 1]);
+                if (!symbol) {
+                    ok = false;
+                    break;
+                }
+                fputs("{ ", out);
+                emit_args(out, d - arg_count, arg_count);
+                fprintf(out, "s%d = prism_aot_call_native(%s, args, %d); }\n",
+                        d - arg_count, symbol, arg_count);
+                break;
+            }
+            case OP_RETURN:
+                fprintf(out, "LEAVE(); return s%d;\n", d - 1);
+                break;
+            case OP_RETURN_NIL:
+            case OP_END:
+                fputs("LEAVE(); return NONE_VAL;\n", out);
+                break;
+            default:
+                prism_error("Cannot compile instruction %s", codegen_op_name(code[ip]));
+                ok = false;
+                break;
+        }
+
+        int next = d + codegen_stack_effect(&code[ip]);
+        if (code[ip] != OP_CONSTANT && writes_result(code[ip]) && next > 0) {
+            known[next - 1] = -1;
+        }
+        d = next;
+    }
+
+    // Every chunk ends in OP_END, so control never reaches the closing brace
+    fputs("}\n\n", out);
+    fprintf(out, "static PrismValue f%d_entry(PrismValue* args) {\n", index);
+    if (function->arity == 0) fputs("    (void)args;\n", out);
+    fprintf(out, "    return f%d(", index);
+    for (int i = 0; i < function->arity; i++) {
+        fprintf(out, "%sargs[%d]", i > 0 ? ", " : "", i);
+    }
+    fputs(");\n}\n\n", out);
+
+    prism_free(known);
+    prism_free(targets);
+    return ok;
+}
+
+bool aot_emit_c(CodeGenerator* generator, FILE* out) {
+    fputs(prelude, out);
+
+    // Forward declarations, then the function values every chunk can refer to
+    for (int i = 0; i < generator->chunk_count; i++) {
+        emit_signature(out, generator->functions[i], i);
+        fputs(";\n", out);
+        fprintf(out, "static PrismValue f%d_entry(PrismValue* args);\n", i);
+    }
+    fputs("\nstatic const AotFunction functions[] = {\n", out);
+    for (int i = 0; i < generator->chunk_count; i++) {
+        FunctionProto* function = generator->functions[i];
+        fputs("    { ", out);
+        emit_string_literal(out, function->name);
+        fprintf(out, ", %d, f%d_entry },\n", function->arity, i);
+    }
+    fputs("};\n\n", out);
+
+    int global_count = generator->global_count > 0 ? generator->global_count : 1;
+    fprintf(out, "static PrismValue globals[%d];\n\n", global_count);
+
+    for (int i = 0; i < generator->chunk_count; i++) {
+        if (!emit_function(generator, out, i)) return false;
+    }
+
+    fputs("int main(void) {\n", out);
+    fprintf(out, "    for (int i = 0; i < %d; i++) globals[i] = NONE_VAL;\n", global_count);
+    fputs("    prism_std_init();\n"
+          "    prism_io_init();\n"
+          "    f0();\n"
+          "    prism_std_cleanup();\n"
+          "    prism_io_cleanup();\n"
+          "    return 0;\n"
+          "}\n", out);
+    return true;
+}
+
+static bool ends_with(const char* s, const char* suffix) {
+    size_t length = strlen(s);
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(s + length - suffix_length, suffix) == 0;
+}
+
+// Runs the C compiler ($CC, or gcc) on source and waits for it
+static bool run_compiler(const char* source, const char* output_path) {
+    const char* cc = getenv("CC");
+    if (!cc || !*cc) cc = "gcc";
+
+    char* argv[] = {
+        (char*)cc, "-O2", "-I" PRISM_INCLUDE_DIR,
+#ifdef PRISM_NAN_BOXING
+        "-DPRISM_NAN_BOXING",
+#endif
+        (char*)source, PRISM_LIB_DIR "/libprism.a", "-lm",
+        "-o", (char*)output_path, NULL
+    };
+
+    pid_t pid;
+    int status;
+    if (posix_spawnp(&pid, cc, NULL, NULL, argv, environ) != 0) {
+        prism_error("Could not run C compiler '%s'", cc);
+        return false;
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        prism_error("C compiler '%s' failed", cc);
+        return false;
+    }
+    return true;
+}
+
+bool aot_compile(CodeGenerator* generator, const char* output_path) {
+    if (ends_with(output_path, ".c")) {
+        FILE* out = fopen(output_path, "w");
+        if (!out) {
+            prism_error("Could not open file '%s' for writing", output_path);
+            return false;
+        }
+        bool ok = aot_emit_c(generator, out);
+        fclose(out);
+        return ok;
+    }
+
+    char source[] = "/tmp/prism-aot-XXXXXX.c";
+    int fd = mkstemps(source, 2);
+    if (fd < 0) {
+        prism_error("Could not create a temporary file");
+        return false;
+    }
+    FILE* out = fdopen(fd, "w");
+    bool ok = out && aot_emit_c(generator, out);
+    if (out) fclose(out);
+
+    ok = ok && run_compiler(source, output_path);
+    unlink(source);
+    return ok;
+}
@@ -0,0 +1,67 @@
+#include "../../include/core/aot.h"
+#include "../../include/core/arith.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/common/rope.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Runtime support linked into programs built by the AOT compiler. These
+ * are the slow paths of the interpreter's handlers; errors are reported
+ * through prism_error and end the program the way vm_run's caller would. */
+
+#define RUNTIME_ERROR_STATUS 70
+
+static void fail(void) {
+    exit(RUNTIME_ERROR_STATUS);
+}
+
+PrismValue prism_aot_arith(OpCode op, PrismValue a, PrismValue b) {
+    PrismValue result;
+    if (!prism_arith(op, a, b, &result)) fail();
+    return result;
+}
+
+PrismValue prism_aot_negate(PrismValue a) {
+    if (IS_INT(a)) return INT_VAL(-AS_INT(a));
+    if (IS_FLOAT(a)) return FLOAT_VAL(-AS_FLOAT(a));
+    prism_error("Can only negate numbers");
+    fail();
+    return NONE_VAL;
+}
+
+bool prism_aot_falsey(PrismValue condition) {
+    return (IS_BOOL(condition) && !AS_BOOL(condition)) ||
+           (IS_INT(condition) && AS_INT(condition) == 0) ||
+           (IS_FLOAT(condition) && AS_FLOAT(condition) == 0.0) ||
+           IS_NONE(condition);
+}
+
+// Calls through a value the compiler couldn't resolve, such as a function
+// stored in a global
+PrismValue prism_aot_call(PrismValue callee, PrismValue* args, int arg_count) {
+    if (!IS_FUNCTION(callee) && VALUE_TYPE(callee) != TYPE_PRISM) {
+        prism_error("Can only call functions and prisms");
+        fail();
+    }
+
+    const AotFunction* function = AS_PTR(callee);
+    if (arg_count != function->arity) {
+        prism_error("%s expects %d arguments but got %d",
+                   function->name, function->arity, arg_count);
+        fail();
+    }
+    return function->entry(args);
+}
+
+PrismValue prism_aot_call_native(PrismValue (*function)(PrismValue*, int), PrismValue* args, int arg_count) {
+    rope_flatten_args(args, arg_count);
+    PrismValue result = function(args, arg_count);
+    if (prism_get_last_error()->type != ERROR_NONE) fail();
+    return result;
+}
+
+void prism_aot_overflow(void) {
+    prism_error("Stack overflow");
+    fail();
+}
@@ -1,19 +1,29 @@
 #include "../../include/core/ast.h"
 #include "../../include/common/memory.h"
+#include "../../include/common/arena.h"
 #include <string.h>
 
 #define INITIAL_PROGRAM_CAPACITY 16
 
+// From the current arena if there is one, otherwise freed by the
+// ast_free_* functions
+static void* node_alloc(size_t size) {
+    Arena* arena = arena_current();
+    return arena ? arena_alloc(arena, size) : prism_alloc(size);
+}
+
 Program* ast_create_program() {
-    Program* program = prism_alloc(sizeof(Program));
+    Program* program = node_alloc(sizeof(Program));
+    program->arena = arena_current();
     program->count = 0;
     program->capacity = INITIAL_PROGRAM_CAPACITY;
-    program->statements = prism_alloc(sizeof(Stmt*) * program->capacity);
+    program->statements = node_alloc(sizeof(Stmt*) * program->capacity);
     return program;
 }
 
 void ast_free_program(Program* program) {
-    if (!program) return;
+    // A program built in an arena goes with it
+    if (!program || program->arena) return;
     
     for (int i = 0; i < program->count; i++) {
         ast_free_stmt(program->statements[i]);
@@ -25,52 +35,44 @@ void ast_free_program(Program* program) {
 
 void ast_add_statement(Program* program, Stmt* stmt) {
     if (program->count >= program->capacity) {
+        size_t old_size = sizeof(Stmt*) * program->capacity;
         program->capacity *= 2;
-        program->statements = prism_realloc(program->statements, sizeof(Stmt*) * program->capacity);
+        if (program->arena) {
+            program->statements = arena_grow(program->arena, program->statements, old_size,
+                                             sizeof(Stmt*) * program->capacity);
+        } else {
+            program->statements = prism_realloc(program->statements, sizeof(Stmt*) * program->capacity);
+        }
     }
     
     program->statements[program->count++] = stmt;
 }
 
 Expr* ast_create_literal_expr(PrismValue value) {
-    Expr* expr = prism_alloc(sizeof(Expr));
+    Expr* expr = node_alloc(sizeof(Expr));
     expr->type = EXPR_LITERAL;
     
-    // Copy literal value
-    expr->as.literal.type = value.type;
-    switch (value.type) {
-        case TYPE_INT:
-            expr->as.literal.value.i = value.value.i;
-            break;
-        case TYPE_FLOAT:
-            expr->as.literal.value.f = value.value.f;
-            break;
-        case TYPE_BOOL:
-            expr->as.literal.value.b = value.value.b;
-            break;
-        case TYPE_STRING:
-            expr->as.literal.value.s = strdup(value.value.s);
-            break;
-        default:
-            expr->as.literal.value.ptr = value.value.ptr;
-            break;
+    if (IS_STRING(value)) {
+        expr->as.literal = STRING_VAL((char*)intern_cstring(AS_STRING(value)));
+    } else {
+        expr->as.literal = value;
     }
     
     return expr;
 }
 
-Expr* ast_create_variable_expr(char* name) {
-    Expr* expr = prism_alloc(sizeof(Expr));
+Expr* ast_create_variable_expr(const char* name) {
+    Expr* expr = node_alloc(sizeof(Expr));
     expr->type = EXPR_VARIABLE;
-    expr->as.variable.name = strdup(name);
+    expr->as.variable.name = intern_cstring(name);
     return expr;
 }
 
 Expr* ast_create_call_expr(Expr* callee, Expr** args, int arg_count) {
-    Expr* expr = prism_alloc(sizeof(Expr));
+    Expr* expr = node_alloc(sizeof(Expr));
     expr->type = EXPR_CALL;
     expr->as.call.callee = callee;
-    expr->as.call.args = prism_alloc(sizeof(Expr*) * arg_count);
+    expr->as.call.args = node_alloc(sizeof(Expr*) * arg_count);
     expr->as.call.arg_count = arg_count;
     
     // Copy args
@@ -81,34 +83,34 @@ Expr* ast_create_call_expr(Expr* callee, Expr** args, int arg_count) {
     return expr;
 }
 
-Expr* ast_create_binary_expr(char* op, Expr* left, Expr* right) {
-    Expr* expr = prism_alloc(sizeof(Expr));
+Expr* ast_create_binary_expr(const char* op, Expr* left, Expr* right) {
+    Expr* expr = node_alloc(sizeof(Expr));
     expr->type = EXPR_BINARY;
-    expr->as.binary.op = strdup(op);
+    expr->as.binary.op = intern_cstring(op);
     expr->as.binary.left = left;
     expr->as.binary.right = right;
     return expr;
 }
 
-Expr* ast_create_unary_expr(char* op, Expr* operand) {
-    Expr* expr = prism_alloc(sizeof(Expr));
+Expr* ast_create_unary_expr(const char* op, Expr* operand) {
+    Expr* expr = node_alloc(sizeof(Expr));
     expr->type = EXPR_UNARY;
-    expr->as.unary.op = strdup(op);
+    expr->as.unary.op = intern_cstring(op);
     expr->as.unary.operand = operand;
     return expr;
 }
 
 Stmt* ast_create_expr_stmt(Expr* expr) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_EXPR;
     stmt->as.expr = expr;
     return stmt;
 }
 
-Stmt* ast_create_var_decl_stmt(char* name, PrismType type, bool exposed, bool internal, Expr* initializer) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+Stmt* ast_create_var_decl_stmt(const char* name, PrismType type, bool exposed, bool internal, Expr* initializer) {
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_VAR_DECL;
-    stmt->as.var_decl.name = strdup(name);
+    stmt->as.var_decl.name = intern_cstring(name);
     stmt->as.var_decl.type = type;
     stmt->as.var_decl.exposed = exposed;
     stmt->as.var_decl.internal = internal;
@@ -116,24 +118,24 @@ Stmt* ast_create_var_decl_stmt(char* name, PrismType type, bool exposed, bool in
     return stmt;
 }
 
-Stmt* ast_create_func_decl_stmt(char* name, char** params, PrismType* param_types, int param_count, 
+Stmt* ast_create_func_decl_stmt(const char* name, char** params, PrismType* param_types, int param_count, 
                                Stmt** body, int body_count, PrismType return_type) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_FUNC_DECL;
-    stmt->as.func_decl.name = strdup(name);
+    stmt->as.func_decl.name = intern_cstring(name);
     
     // Copy parameters
-    stmt->as.func_decl.params = prism_alloc(sizeof(char*) * param_count);
-    stmt->as.func_decl.param_types = prism_alloc(sizeof(PrismType) * param_count);
+    stmt->as.func_decl.params = node_alloc(sizeof(const char*) * param_count);
+    stmt->as.func_decl.param_types = node_alloc(sizeof(PrismType) * param_count);
     stmt->as.func_decl.param_count = param_count;
     
     for (int i = 0; i < param_count; i++) {
-        stmt->as.func_decl.params[i] = strdup(params[i]);
+        stmt->as.func_decl.params[i] = intern_cstring(params[i]);
         stmt->as.func_decl.param_types[i] = param_types[i];
     }
     
     // Copy body
-    stmt->as.func_decl.body = prism_alloc(sizeof(Stmt*) * body_count);
+    stmt->as.func_decl.body = node_alloc(sizeof(Stmt*) * body_count);
     stmt->as.func_decl.body_count = body_count;
     
     for (int i = 0; i < body_count; i++) {
@@ -145,13 +147,13 @@ Stmt* ast_create_func_decl_stmt(char* name, char** params, PrismType* param_type
     return stmt;
 }
 
-Stmt* ast_create_prism_decl_stmt(char* name, Stmt** body, int body_count, PrismType return_type) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+Stmt* ast_create_prism_decl_stmt(const char* name, Stmt** body, int body_count, PrismType return_type) {
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_PRISM_DECL;
-    stmt->as.prism_decl.name = strdup(name);
+    stmt->as.prism_decl.name = intern_cstring(name);
     
     // Copy body
-    stmt->as.prism_decl.body = prism_alloc(sizeof(Stmt*) * body_count);
+    stmt->as.prism_decl.body = node_alloc(sizeof(Stmt*) * body_count);
     stmt->as.prism_decl.body_count = body_count;
     
     for (int i = 0; i < body_count; i++) {
@@ -164,17 +166,17 @@ Stmt* ast_create_prism_decl_stmt(char* name, Stmt** body, int body_count, PrismT
 }
 
 Stmt* ast_create_return_stmt(Expr* value) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_RETURN;
     stmt->as.return_stmt.value = value;
     return stmt;
 }
 
 Stmt* ast_create_call_stmt(Expr* callee, Expr** args, int arg_count) {
-    Stmt* stmt = prism_alloc(sizeof(Stmt));
+    Stmt* stmt = node_alloc(sizeof(Stmt));
     stmt->type = STMT_CALL;
     stmt->as.call.callee = callee;
-    stmt->as.call.args = prism_alloc(sizeof(Expr*) * arg_count);
+    stmt->as.call.args = node_alloc(sizeof(Expr*) * arg_count);
     stmt->as.call.arg_count = arg_count;
     
     // Copy args
@@ -190,12 +192,7 @@ void ast_free_expr(Expr* expr) {
     
     switch (expr->type) {
         case EXPR_LITERAL:
-            if (expr->as.literal.type == TYPE_STRING && expr->as.literal.value.s) {
-                prism_free(expr->as.literal.value.s);
-            }
-            break;
         case EXPR_VARIABLE:
-            prism_free(expr->as.variable.name);
             break;
         case EXPR_CALL:
             ast_free_expr(expr->as.call.callee);
@@ -205,12 +202,10 @@ void ast_free_expr(Expr* expr) {
             prism_free(expr->as.call.args);
             break;
         case EXPR_BINARY:
-            prism_free(expr->as.binary.op);
             ast_free_expr(expr->as.binary.left);
             ast_free_expr(expr->as.binary.right);
             break;
         case EXPR_UNARY:
-            prism_free(expr->as.unary.op);
             ast_free_expr(expr->as.unary.operand);
             break;
     }
@@ -226,14 +221,9 @@ void ast_free_stmt(Stmt* stmt) {
             ast_free_expr(stmt->as.expr);
             break;
         case STMT_VAR_DECL:
-            prism_free(stmt->as.var_decl.name);
             ast_free_expr(stmt->as.var_decl.initializer);
             break;
         case STMT_FUNC_DECL:
-            prism_free(stmt->as.func_decl.name);
-            for (int i = 0; i < stmt->as.func_decl.param_count; i++) {
-                prism_free(stmt->as.func_decl.params[i]);
-            }
             prism_free(stmt->as.func_decl.params);
             prism_free(stmt->as.func_decl.param_types);
             for (int i = 0; i < stmt->as.func_decl.body_count; i++) {
@@ -242,7 +232,6 @@ void ast_free_stmt(Stmt* stmt) {
             prism_free(stmt->as.func_decl.body);
             break;
         case STMT_PRISM_DECL:
-            prism_free(stmt->as.prism_decl.name);
             for (int i = 0; i < stmt->as.prism_decl.body_count; i++) {
                 ast_free_stmt(stmt->as.prism_decl.body[i]);
             }
@@ -1,27 +1,43 @@
 #include "../../include/core/codegen.h"
+#include "../../include/core/jit.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
+#include "../../include/common/intern.h"
 #include <string.h>
 
 #define INITIAL_CHUNK_CAPACITY 64
 #define INITIAL_CONSTANT_CAPACITY 16
 #define INITIAL_NATIVE_CAPACITY 16
 
-static CodeChunk* current_chunk;
+static void init_chunk(CodeChunk* chunk) {
+    chunk->code = prism_alloc(sizeof(OpCode) * INITIAL_CHUNK_CAPACITY);
+    chunk->lines = prism_alloc(sizeof(int) * INITIAL_CHUNK_CAPACITY);
+    chunk->count = 0;
+    chunk->capacity = INITIAL_CHUNK_CAPACITY;
+    
+    chunk->constants = prism_alloc(sizeof(PrismValue) * INITIAL_CONSTANT_CAPACITY);
+    chunk->constant_count = 0;
+    chunk->constant_capacity = INITIAL_CONSTANT_CAPACITY;
+}
+
+static FunctionProto* new_function(const char* name, int chunk_index, int arity) {
+    FunctionProto* function = prism_alloc(sizeof(FunctionProto));
+    function->name = intern_cstring(name);
+    function->chunk_index = chunk_index;
+    function->arity = arity;
+    return function;
+}
 
 CodeGenerator* codegen_create() {
     CodeGenerator* generator = prism_alloc(sizeof(CodeGenerator));
     generator->chunks = prism_alloc(sizeof(CodeChunk));
     generator->chunk_count = 1;
+    init_chunk(&generator->chunks[0]);
     
-    generator->chunks[0].code = prism_alloc(sizeof(OpCode) * INITIAL_CHUNK_CAPACITY);
-    generator->chunks[0].lines = prism_alloc(sizeof(int) * INITIAL_CHUNK_CAPACITY);
-    generator->chunks[0].count = 0;
-    generator->chunks[0].capacity = INITIAL_CHUNK_CAPACITY;
-    
-    generator->chunks[0].constants = prism_alloc(sizeof(PrismValue) * INITIAL_CONSTANT_CAPACITY);
-    generator->chunks[0].constant_count = 0;
-    generator->chunks[0].constant_capacity = INITIAL_CONSTANT_CAPACITY;
+    generator->functions = prism_alloc(sizeof(FunctionProto*));
+    generator->functions[0] = new_function("<script>", 0, 0);
+    generator->functions[0]->chunk = &generator->chunks[0];
+    generator->global_count = 0;
     
     generator->symtab = symtab_create();
     
@@ -30,7 +46,7 @@ CodeGenerator* codegen_create() {
     generator->native_count = 0;
     generator->native_capacity = INITIAL_NATIVE_CAPACITY;
     
-    current_chunk = &generator->chunks[0];
+    generator->current_chunk = 0;
     
     return generator;
 }
@@ -42,87 +58,149 @@ void codegen_free(CodeGenerator* generator) {
         CodeChunk* chunk = &generator->chunks[i];
         prism_free(chunk->code);
         prism_free(chunk->lines);
-        
-        for (int j = 0; j < chunk->constant_count; j++) {
-            if (chunk->constants[j].type == TYPE_STRING && chunk->constants[j].value.s) {
-                prism_free(chunk->constants[j].value.s);
-            }
-        }
-        
         prism_free(chunk->constants);
+        
+        jit_free(generator->functions[i]->jit);
+        trace_free_all(generator->functions[i]);
+        prism_free(generator->functions[i]);
     }
+    prism_free(generator->functions);
     
-    // Free native function names
-    for (int i = 0; i < generator->native_count; i++) {
-        prism_free(generator->natives[i].name);
-    }
     prism_free(generator->natives);
     
     prism_free(generator->chunks);
+    prism_free(generator->exposed_globals);
     symtab_free(generator->symtab);
     prism_free(generator);
 }
 
+// The chunk being generated. Indexed rather than pointed to because
+// declaring a function grows, and so moves, the chunk array.
+static CodeChunk* current_chunk(CodeGenerator* generator) {
+    return &generator->chunks[generator->current_chunk];
+}
+
 int codegen_emit_constant(CodeGenerator* generator, PrismValue value) {
-    if (current_chunk->constant_count >= current_chunk->constant_capacity) {
-        current_chunk->constant_capacity *= 2;
-        current_chunk->constants = prism_realloc(current_chunk->constants, 
-                                                sizeof(PrismValue) * current_chunk->constant_capacity);
+    CodeChunk* chunk = current_chunk(generator);
+    
+    // Strings are interned, so a repeated one can share its slot
+    if (IS_STRING(value)) {
+        value = STRING_VAL((char*)intern_cstring(AS_STRING(value)));
+        for (int i = 0; i < chunk->constant_count; i++) {
+            if (IS_STRING(chunk->constants[i]) && AS_STRING(chunk->constants[i]) == AS_STRING(value)) {
+                return i;
+            }
+        }
     }
     
-    // Copy the constant value
-    current_chunk->constants[current_chunk->constant_count].type = value.type;
-    switch (value.type) {
-        case TYPE_INT:
-            current_chunk->constants[current_chunk->constant_count].value.i = value.value.i;
-            break;
-        case TYPE_FLOAT:
-            current_chunk->constants[current_chunk->constant_count].value.f = value.value.f;
-            break;
-        case TYPE_BOOL:
-            current_chunk->constants[current_chunk->constant_count].value.b = value.value.b;
-            break;
-        case TYPE_STRING:
-            current_chunk->constants[current_chunk->constant_count].value.s = strdup(value.value.s);
-            break;
-        default:
-            break;
+    if (chunk->constant_count >= chunk->constant_capacity) {
+        chunk->constant_capacity *= 2;
+        chunk->constants = prism_realloc(chunk->constants, 
+                                         sizeof(PrismValue) * chunk->constant_capacity);
     }
     
-    return current_chunk->constant_count++;
+    chunk->constants[chunk->constant_count] = value;
+    return chunk->constant_count++;
 }
 
 void codegen_emit_byte(CodeGenerator* generator, OpCode op, int line) {
-    if (current_chunk->count >= current_chunk->capacity) {
-        current_chunk->capacity *= 2;
-        current_chunk->code = prism_realloc(current_chunk->code, 
-                                           sizeof(OpCode) * current_chunk->capacity);
-        current_chunk->lines = prism_realloc(current_chunk->lines, 
-                                            sizeof(int) * current_chunk->capacity);
+    CodeChunk* chunk = current_chunk(generator);
+    if (chunk->count >= chunk->capacity) {
+        chunk->capacity *= 2;
+        chunk->code = prism_realloc(chunk->code, sizeof(OpCode) * chunk->capacity);
+        chunk->lines = prism_realloc(chunk->lines, sizeof(int) * chunk->capacity);
     }
     
-    current_chunk->code[current_chunk->count] = op;
-    current_chunk->lines[current_chunk->count] = line;
-    current_chunk->count++;
+    chunk->code[chunk->count] = op;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
 }
 
 int codegen_emit_jump(CodeGenerator* generator, OpCode op, int line) {
     codegen_emit_byte(generator, op, line);
     codegen_emit_byte(generator, 0xFF, line); // Placeholder for jump offset
     codegen_emit_byte(generator, 0xFF, line);
-    return current_chunk->count - 2;
+    return current_chunk(generator)->count - 2;
 }
 
 void codegen_patch_jump(CodeGenerator* generator, int offset) {
+    CodeChunk* chunk = current_chunk(generator);
+    
     // -2 to adjust for the jump offset itself
-    int jump = current_chunk->count - offset - 2;
+    int jump = chunk->count - offset - 2;
     
     if (jump > 0xFFFF) {
         prism_error("Jump offset too large");
     }
     
-    current_chunk->code[offset] = (jump >> 8) & 0xFF;
-    current_chunk->code[offset + 1] = jump & 0xFF;
+    chunk->code[offset] = (jump >> 8) & 0xFF;
+    chunk->code[offset + 1] = jump & 0xFF;
+}
+
+int codegen_op_length(OpCode op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_SPAWN:
+        case OP_COROUTINE:
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_LOAD_GLOBAL:
+        case OP_STORE_GLOBAL:
+        case OP_ADD_CONST:
+        case OP_CALL_DISCARD:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_CALL_NATIVE:
+        case OP_ADD_LOCALS:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+const char* codegen_op_name(OpCode op) {
+    static const char* names[OP_COUNT] = {
+        [OP_NOP] = "NOP",
+        [OP_CONSTANT] = "CONSTANT",
+        [OP_ADD] = "ADD",
+        [OP_SUBTRACT] = "SUBTRACT",
+        [OP_MULTIPLY] = "MULTIPLY",
+        [OP_DIVIDE] = "DIVIDE",
+        [OP_NEGATE] = "NEGATE",
+        [OP_RETURN] = "RETURN",
+        [OP_CALL] = "CALL",
+        [OP_LOAD] = "LOAD",
+        [OP_STORE] = "STORE",
+        [OP_JUMP] = "JUMP",
+        [OP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+        [OP_POP] = "POP",
+        [OP_LOAD_GLOBAL] = "LOAD_GLOBAL",
+        [OP_STORE_GLOBAL] = "STORE_GLOBAL",
+        [OP_CALL_NATIVE] = "CALL_NATIVE",
+        [OP_TAIL_CALL] = "TAIL_CALL",
+        [OP_SPAWN] = "SPAWN",
+        [OP_COROUTINE] = "COROUTINE",
+        [OP_RESUME] = "RESUME",
+        [OP_YIELD] = "YIELD",
+        [OP_END] = "END",
+        [OP_ADD_INT_INT] = "ADD_INT_INT",
+        [OP_ADD_FLOAT_FLOAT] = "ADD_FLOAT_FLOAT",
+        [OP_ADD_STR_STR] = "ADD_STR_STR",
+        [OP_SUBTRACT_INT_INT] = "SUBTRACT_INT_INT",
+        [OP_SUBTRACT_FLOAT_FLOAT] = "SUBTRACT_FLOAT_FLOAT",
+        [OP_MULTIPLY_INT_INT] = "MULTIPLY_INT_INT",
+        [OP_MULTIPLY_FLOAT_FLOAT] = "MULTIPLY_FLOAT_FLOAT",
+        [OP_ADD_CONST] = "ADD_CONST",
+        [OP_ADD_LOCALS] = "ADD_LOCALS",
+        [OP_CALL_DISCARD] = "CALL_DISCARD",
+        [OP_RETURN_NIL] = "RETURN_NIL"
+    };
+    
+    if (op < 0 || op >= OP_COUNT || !names[op]) return "UNKNOWN";
+    return names[op];
 }
 
 void codegen_add_native_function(CodeGenerator* generator, const char* name, PrismValue (*function)(PrismValue*, int)) {
@@ -135,8 +213,10 @@ void codegen_add_native_function(CodeGenerator* generator, const char* name, Pri
     }
     
     // Add the native function
-    generator->natives[generator->native_count].name = strdup(name);
+    name = intern_cstring(name);
+    generator->natives[generator->native_count].name = name;
     generator->natives[generator->native_count].function = function;
+    generator->natives[generator->native_count].pure = false;
     
     // Add the function to the symbol table - use the native function index as the "special" value
     // The negative index indicates it's a native function
@@ -146,6 +226,13 @@ void codegen_add_native_function(CodeGenerator* generator, const char* name, Pri
     generator->native_count++;
 }
 
+void codegen_add_pure_native_function(CodeGenerator* generator, const char* name, PrismValue (*function)(PrismValue*, int)) {
+    if (!generator) return;
+    
+    codegen_add_native_function(generator, name, function);
+    generator->natives[generator->native_count - 1].pure = true;
+}
+
 // Lookup a native function by index (the index is expected to be negative)
 NativeFunction* codegen_get_native_function(CodeGenerator* generator, int index) {
     if (!generator) return NULL;
@@ -160,6 +247,233 @@ NativeFunction* codegen_get_native_function(CodeGenerator* generator, int index)
     return &generator->natives[real_index];
 }
 
+int codegen_stack_effect(const OpCode* code) {
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_LOAD:
+        case OP_LOAD_GLOBAL:
+        case OP_ADD_LOCALS:
+            return 1;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_ADD_INT_INT:
+        case OP_ADD_FLOAT_FLOAT:
+        case OP_ADD_STR_STR:
+        case OP_SUBTRACT_INT_INT:
+        case OP_SUBTRACT_FLOAT_FLOAT:
+        case OP_MULTIPLY_INT_INT:
+        case OP_MULTIPLY_FLOAT_FLOAT:
+        case OP_RETURN:
+        case OP_STORE:
+        case OP_STORE_GLOBAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP:
+        case OP_RESUME:
+            return -1;
+        case OP_CALL:
+        case OP_COROUTINE:
+            // Callee and arguments are replaced by the result
+            return -(int)code[1];
+        case OP_CALL_DISCARD:
+        case OP_TAIL_CALL:
+            return -(int)code[1] - 1;
+        case OP_CALL_NATIVE:
+            // Arguments are replaced by the result
+            return 1 - (int)code[2];
+        default:
+            return 0;
+    }
+}
+
+// Deepest operand stack the chunk can build. Codegen only emits forward
+// jumps to points where the depth matches, so one linear pass is enough.
+// RETURN_NIL has no net effect but pushes its none before returning it, as
+// the CONSTANT it was fused from did.
+static int compute_max_stack(CodeChunk* chunk) {
+    int depth = 0;
+    int max = 0;
+    for (int ip = 0; ip < chunk->count; ip += codegen_op_length(chunk->code[ip])) {
+        if (chunk->code[ip] == OP_RETURN_NIL && depth + 1 > max) max = depth + 1;
+        depth += codegen_stack_effect(&chunk->code[ip]);
+        if (depth > max) max = depth;
+    }
+    return max;
+}
+
+/* A body is independent when it touches no shared state: it reads only
+ * exposed globals, writes none, calls only pure natives and calls only
+ * functions and prisms that are independent themselves. Callees are
+ * declared before use, so they have been analysed already; a body calling
+ * itself is judged on the rest of it. Globals are only ever stored by their
+ * declaration, so everything such a body reads is final once it is declared. */
+static bool is_independent(CodeGenerator* generator, FunctionProto* function) {
+    // A body that failed to compile need not balance its stack, and never runs
+    if (prism_get_last_error()->type != ERROR_NONE) return false;
+    
+    CodeChunk* chunk = &generator->chunks[function->chunk_index];
+    const OpCode* code = chunk->code;
+    bool independent = true;
+    
+    // The function constant each operand slot holds, to identify callees
+    int depth = 0;
+    FunctionProto** callees = prism_alloc(sizeof(FunctionProto*) * (compute_max_stack(chunk) + 1));
+    
+    for (int ip = 0; ip < chunk->count && independent; ip += codegen_op_length(code[ip])) {
+        switch (code[ip]) {
+            case OP_LOAD_GLOBAL:
+                independent = generator->exposed_globals[code[ip + 1]];
+                break;
+            case OP_STORE_GLOBAL:
+            case OP_SPAWN:
+            case OP_COROUTINE:
+            case OP_RESUME:
+            case OP_YIELD:
+                independent = false;
+                break;
+            case OP_CALL_NATIVE:
+                independent = generator->natives[code[ip + 1]].pure;
+                break;
+            case OP_CALL:
+            case OP_CALL_DISCARD:
+            case OP_TAIL_CALL: {
+                FunctionProto* callee = callees[depth - code[ip + 1] - 1];
+                independent = callee && (callee == function || callee->independent);
+                break;
+            }
+            default:
+                break;
+        }
+        
+        int next = depth + codegen_stack_effect(&code[ip]);
+        if (code[ip] == OP_CONSTANT) {
+            PrismValue value = chunk->constants[code[ip + 1]];
+            bool callable = IS_FUNCTION(value) || VALUE_TYPE(value) == TYPE_PRISM;
+            callees[depth] = callable ? AS_PTR(value) : NULL;
+        } else if (next > 0) {
+            callees[next - 1] = NULL;
+        }
+        depth = next;
+    }
+    
+    prism_free(callees);
+    return independent;
+}
+
+// Operands can hold any value, so find the last instruction by walking
+// from the start rather than looking at the last slot
+static bool ends_with_return(CodeChunk* chunk) {
+    int last = -1;
+    for (int ip = 0; ip < chunk->count; ip += codegen_op_length(chunk->code[ip])) {
+        last = ip;
+    }
+    return last >= 0 && (chunk->code[last] == OP_RETURN || chunk->code[last] == OP_TAIL_CALL);
+}
+
+static void emit_return_and_end(CodeGenerator* generator) {
+    // Add return if one wasn't explicitly given
+    if (!ends_with_return(current_chunk(generator))) {
+        PrismValue nil = NONE_VAL;
+        int constant = codegen_emit_constant(generator, nil);
+        codegen_emit_byte(generator, OP_CONSTANT, 0);
+        codegen_emit_byte(generator, constant, 0);
+        codegen_emit_byte(generator, OP_RETURN, 0);
+    }
+    
+    // Terminate the chunk so the VM never has to bounds-check ip
+    codegen_emit_byte(generator, OP_END, 0);
+}
+
+static void generate_expr(CodeGenerator* generator, Expr* expr);
+
+// Zero-based index of the native function a callee names, or -1
+static int native_index(CodeGenerator* generator, Expr* callee) {
+    if (callee->type != EXPR_VARIABLE) return -1;
+    
+    SymbolEntry* entry = symtab_lookup(generator->symtab, callee->as.variable.name);
+    if (!entry || entry->type != TYPE_FUNCTION || (intptr_t)entry->data >= 0) return -1;
+    
+    return -(int)(intptr_t)entry->data - 1;
+}
+
+// The instruction behind coroutine(), resume() or yield(), or OP_NOP for
+// any other callee. A definition of the same name takes precedence.
+static OpCode coroutine_op(CodeGenerator* generator, Expr* callee) {
+    if (callee->type != EXPR_VARIABLE) return OP_NOP;
+    
+    const char* name = callee->as.variable.name;
+    if (symtab_lookup(generator->symtab, name)) return OP_NOP;
+    
+    if (strcmp(name, "coroutine") == 0) return OP_COROUTINE;
+    if (strcmp(name, "resume") == 0) return OP_RESUME;
+    if (strcmp(name, "yield") == 0) return OP_YIELD;
+    return OP_NOP;
+}
+
+// Coroutine operations switch the VM between stacks, so unlike natives
+// they get instructions of their own. A missing value to send or yield
+// is none.
+static void generate_coroutine_op(CodeGenerator* generator, OpCode op, Expr* callee,
+                                  Expr** args, int arg_count) {
+    int min_args = op == OP_COROUTINE || op == OP_RESUME ? 1 : 0;
+    int max_args = op == OP_COROUTINE ? arg_count : op == OP_RESUME ? 2 : 1;
+    if (arg_count < min_args || arg_count > max_args) {
+        prism_error("%s expects %s", callee->as.variable.name,
+                    op == OP_COROUTINE ? "a function and its arguments" :
+                    op == OP_RESUME ? "a coroutine and an optional value" : "at most one value");
+        return;
+    }
+    
+    for (int i = 0; i < arg_count; i++) {
+        generate_expr(generator, args[i]);
+    }
+    
+    if (op != OP_COROUTINE && arg_count < max_args) {
+        int constant = codegen_emit_constant(generator, NONE_VAL);
+        codegen_emit_byte(generator, OP_CONSTANT, 0);
+        codegen_emit_byte(generator, constant, 0);
+    }
+    
+    codegen_emit_byte(generator, op, 0);
+    if (op == OP_COROUTINE) codegen_emit_byte(generator, arg_count - 1, 0);
+}
+
+// op is OP_CALL, or OP_TAIL_CALL for a call in tail position
+static void generate_call(CodeGenerator* generator, Expr* callee, Expr** args, int arg_count, OpCode op) {
+    OpCode coroutine = coroutine_op(generator, callee);
+    if (coroutine != OP_NOP) {
+        generate_coroutine_op(generator, coroutine, callee, args, arg_count);
+        return;
+    }
+    
+    // Natives are resolved now, so the VM calls straight through the table
+    // with the arguments left where they are on the stack
+    int native = native_index(generator, callee);
+    if (native >= 0) {
+        for (int i = 0; i < arg_count; i++) {
+            generate_expr(generator, args[i]);
+        }
+        
+        codegen_emit_byte(generator, OP_CALL_NATIVE, 0);
+        codegen_emit_byte(generator, native, 0);
+        codegen_emit_byte(generator, arg_count, 0);
+        return;
+    }
+    
+    // The callee goes below its arguments, which become the first
+    // locals of the new frame
+    generate_expr(generator, callee);
+    
+    for (int i = 0; i < arg_count; i++) {
+        generate_expr(generator, args[i]);
+    }
+    
+    // Emit the call instruction with the argument count
+    codegen_emit_byte(generator, op, 0);
+    codegen_emit_byte(generator, arg_count, 0);
+}
+
 static void generate_expr(CodeGenerator* generator, Expr* expr) {
     if (!expr) return;
     
@@ -178,38 +492,35 @@ static void generate_expr(CodeGenerator* generator, Expr* expr) {
                 return;
             }
             
-            // Handle function references differently
-            if (entry->type == TYPE_FUNCTION) {
-                // Push the function index (positive for bytecode functions, negative for native functions)
-                PrismValue func_idx;
-                func_idx.type = TYPE_FUNCTION;
-                func_idx.value.i = (int)(intptr_t)entry->data;
+            // Functions and prisms are compile-time constants
+            if (entry->type == TYPE_FUNCTION || entry->type == TYPE_PRISM) {
+                if ((intptr_t)entry->data < 0) {
+                    prism_error("Native function '%s' can only be called directly", entry->name);
+                    return;
+                }
+                
+                PrismValue callee = entry->type == TYPE_FUNCTION
+                    ? FUNCTION_VAL(entry->data)
+                    : PTR_VAL(TYPE_PRISM, entry->data);
                 
-                int constant = codegen_emit_constant(generator, func_idx);
+                int constant = codegen_emit_constant(generator, callee);
                 codegen_emit_byte(generator, OP_CONSTANT, 0);
                 codegen_emit_byte(generator, constant, 0);
-            } else {
-                // Load the variable value
+            } else if (entry->depth == 0) {
+                codegen_emit_byte(generator, OP_LOAD_GLOBAL, 0);
+                codegen_emit_byte(generator, (int)(intptr_t)entry->data, 0);
+            } else if (entry->depth == generator->symtab->depth) {
+                // Slot relative to the current frame's base
                 codegen_emit_byte(generator, OP_LOAD, 0);
-                // TODO: Implement variable index lookup
                 codegen_emit_byte(generator, (int)(intptr_t)entry->data, 0);
+            } else {
+                prism_error("Cannot capture local variable '%s' of an enclosing function", entry->name);
             }
             break;
         }
-        case EXPR_CALL: {
-            // Generate code for the arguments
-            for (int i = 0; i < expr->as.call.arg_count; i++) {
-                generate_expr(generator, expr->as.call.args[i]);
-            }
-            
-            // Generate code for the function itself
-            generate_expr(generator, expr->as.call.callee);
-            
-            // Emit the call instruction with the argument count
-            codegen_emit_byte(generator, OP_CALL, 0);
-            codegen_emit_byte(generator, expr->as.call.arg_count, 0);
+        case EXPR_CALL:
+            generate_call(generator, expr->as.call.callee, expr->as.call.args, expr->as.call.arg_count, OP_CALL);
             break;
-        }
         case EXPR_BINARY: {
             generate_expr(generator, expr->as.binary.left);
             generate_expr(generator, expr->as.binary.right);
@@ -242,6 +553,53 @@ static void generate_expr(CodeGenerator* generator, Expr* expr) {
     }
 }
 
+static void generate_stmt(CodeGenerator* generator, Stmt* stmt);
+
+// Compiles a function or prism body into a chunk of its own
+static FunctionProto* generate_function(CodeGenerator* generator, const char* name, PrismType type,
+                              const char** params, PrismType* param_types, int param_count,
+                              Stmt** body, int body_count) {
+    int old_index = generator->current_chunk;
+    int index = generator->chunk_count++;
+    generator->chunks = prism_realloc(generator->chunks, sizeof(CodeChunk) * generator->chunk_count);
+    generator->functions = prism_realloc(generator->functions, 
+                                        sizeof(FunctionProto*) * generator->chunk_count);
+    
+    FunctionProto* function = new_function(name, index, param_count);
+    generator->functions[index] = function;
+    init_chunk(&generator->chunks[index]);
+    generator->current_chunk = index;
+    
+    // Define the function before compiling the body so it can recurse
+    symtab_define(generator->symtab, name, type, false, false, function);
+    
+    // Locals are numbered from the frame base, parameters first
+    int old_vars = generator->symtab->current_vars;
+    generator->symtab->current_vars = 0;
+    symtab_enter_scope(generator->symtab);
+    
+    for (int i = 0; i < param_count; i++) {
+        int param_index = generator->symtab->current_vars++;
+        symtab_define(generator->symtab, params[i], param_types[i], false, false, 
+                     (void*)(intptr_t)param_index);
+    }
+    
+    for (int i = 0; i < body_count; i++) {
+        generate_stmt(generator, body[i]);
+    }
+    
+    emit_return_and_end(generator);
+    function->local_count = generator->symtab->current_vars;
+    
+    symtab_exit_scope(generator->symtab);
+    generator->symtab->current_vars = old_vars;
+    
+    generator->current_chunk = old_index;
+    
+    function->independent = is_independent(generator, function);
+    return function;
+}
+
 static void generate_stmt(CodeGenerator* generator, Stmt* stmt) {
     if (!stmt) return;
     
@@ -257,136 +615,73 @@ static void generate_stmt(CodeGenerator* generator, Stmt* stmt) {
                 generate_expr(generator, stmt->as.var_decl.initializer);
             } else {
                 // Default initialization to nil if no initializer
-                PrismValue nil;
-                nil.type = TYPE_NONE;
+                PrismValue nil = NONE_VAL;
                 int constant = codegen_emit_constant(generator, nil);
                 codegen_emit_byte(generator, OP_CONSTANT, 0);
                 codegen_emit_byte(generator, constant, 0);
             }
             
-            // Add the variable to the symbol table
-            int var_index = generator->symtab->current_vars++;
+            // Top-level variables are globals; anything else is a slot in
+            // the enclosing function's frame
+            bool global = generator->symtab->depth == 0;
+            int var_index = global ? generator->global_count++ : generator->symtab->current_vars++;
+            if (global) {
+                generator->exposed_globals = prism_realloc(generator->exposed_globals,
+                                                           sizeof(bool) * generator->global_count);
+                generator->exposed_globals[var_index] = stmt->as.var_decl.exposed;
+            }
             symtab_define(generator->symtab, stmt->as.var_decl.name, 
                          stmt->as.var_decl.type, stmt->as.var_decl.exposed, 
                          stmt->as.var_decl.internal, (void*)(intptr_t)var_index);
             
             // Emit the store instruction
-            codegen_emit_byte(generator, OP_STORE, 0);
+            codegen_emit_byte(generator, global ? OP_STORE_GLOBAL : OP_STORE, 0);
             codegen_emit_byte(generator, var_index, 0);
             break;
         }
             
-        case STMT_FUNC_DECL: {
-            // Create a new chunk for the function
-            int func_chunk_idx = generator->chunk_count++;
-            generator->chunks = prism_realloc(generator->chunks, 
-                                             sizeof(CodeChunk) * generator->chunk_count);
-            
-            CodeChunk* old_chunk = current_chunk;
-            current_chunk = &generator->chunks[func_chunk_idx];
-            
-            current_chunk->code = prism_alloc(sizeof(OpCode) * INITIAL_CHUNK_CAPACITY);
-            current_chunk->lines = prism_alloc(sizeof(int) * INITIAL_CHUNK_CAPACITY);
-            current_chunk->count = 0;
-            current_chunk->capacity = INITIAL_CHUNK_CAPACITY;
-            
-            current_chunk->constants = prism_alloc(sizeof(PrismValue) * INITIAL_CONSTANT_CAPACITY);
-            current_chunk->constant_count = 0;
-            current_chunk->constant_capacity = INITIAL_CONSTANT_CAPACITY;
-            
-            // Define the function in the symbol table
-            symtab_define(generator->symtab, stmt->as.func_decl.name, 
-                         TYPE_FUNCTION, false, false, (void*)(intptr_t)func_chunk_idx);
-            
-            // Enter a new scope for the function
-            symtab_enter_scope(generator->symtab);
-            
-            // Define parameters
-            for (int i = 0; i < stmt->as.func_decl.param_count; i++) {
-                int param_index = generator->symtab->current_vars++;
-                symtab_define(generator->symtab, stmt->as.func_decl.params[i], 
-                             stmt->as.func_decl.param_types[i], false, false, 
-                             (void*)(intptr_t)param_index);
-            }
-            
-            // Generate code for the function body
-            for (int i = 0; i < stmt->as.func_decl.body_count; i++) {
-                generate_stmt(generator, stmt->as.func_decl.body[i]);
-            }
-            
-            // Add return if one wasn't explicitly given
-            if (current_chunk->count == 0 || current_chunk->code[current_chunk->count - 1] != OP_RETURN) {
-                PrismValue nil;
-                nil.type = TYPE_NONE;
-                int constant = codegen_emit_constant(generator, nil);
-                codegen_emit_byte(generator, OP_CONSTANT, 0);
-                codegen_emit_byte(generator, constant, 0);
-                codegen_emit_byte(generator, OP_RETURN, 0);
-            }
-            
-            // Exit the function scope
-            symtab_exit_scope(generator->symtab);
-            
-            // Restore the previous chunk
-            current_chunk = old_chunk;
+        case STMT_FUNC_DECL:
+            generate_function(generator, stmt->as.func_decl.name, TYPE_FUNCTION,
+                              stmt->as.func_decl.params, stmt->as.func_decl.param_types,
+                              stmt->as.func_decl.param_count,
+                              stmt->as.func_decl.body, stmt->as.func_decl.body_count);
             break;
-        }
             
         case STMT_PRISM_DECL: {
-            // Similar to function declaration, but with additional prism-specific behavior
-            int prism_chunk_idx = generator->chunk_count++;
-            generator->chunks = prism_realloc(generator->chunks, 
-                                             sizeof(CodeChunk) * generator->chunk_count);
-            
-            CodeChunk* old_chunk = current_chunk;
-            current_chunk = &generator->chunks[prism_chunk_idx];
-            
-            current_chunk->code = prism_alloc(sizeof(OpCode) * INITIAL_CHUNK_CAPACITY);
-            current_chunk->lines = prism_alloc(sizeof(int) * INITIAL_CHUNK_CAPACITY);
-            current_chunk->count = 0;
-            current_chunk->capacity = INITIAL_CHUNK_CAPACITY;
-            
-            current_chunk->constants = prism_alloc(sizeof(PrismValue) * INITIAL_CONSTANT_CAPACITY);
-            current_chunk->constant_count = 0;
-            current_chunk->constant_capacity = INITIAL_CONSTANT_CAPACITY;
-            
-            // Define the prism in the symbol table
-            symtab_define(generator->symtab, stmt->as.prism_decl.name, 
-                         TYPE_PRISM, false, false, (void*)(intptr_t)prism_chunk_idx);
-            
-            // Enter a new scope for the prism
-            symtab_enter_scope(generator->symtab);
-            
-            // Generate code for the prism body
-            for (int i = 0; i < stmt->as.prism_decl.body_count; i++) {
-                generate_stmt(generator, stmt->as.prism_decl.body[i]);
-            }
-            
-            // Add return if one wasn't explicitly given
-            if (current_chunk->count == 0 || current_chunk->code[current_chunk->count - 1] != OP_RETURN) {
-                PrismValue nil;
-                nil.type = TYPE_NONE;
-                int constant = codegen_emit_constant(generator, nil);
-                codegen_emit_byte(generator, OP_CONSTANT, 0);
+            // Same as a function without parameters, but typed as a prism
+            FunctionProto* prism = generate_function(generator, stmt->as.prism_decl.name, TYPE_PRISM,
+                                                     NULL, NULL, 0,
+                                                     stmt->as.prism_decl.body, stmt->as.prism_decl.body_count);
+            
+            // Every global an independent top-level prism can read has been
+            // stored by now, so it may start running here
+            if (prism->independent && generator->symtab->depth == 0) {
+                int constant = codegen_emit_constant(generator, PTR_VAL(TYPE_PRISM, prism));
+                codegen_emit_byte(generator, OP_SPAWN, 0);
                 codegen_emit_byte(generator, constant, 0);
-                codegen_emit_byte(generator, OP_RETURN, 0);
             }
-            
-            // Exit the prism scope
-            symtab_exit_scope(generator->symtab);
-            
-            // Restore the previous chunk
-            current_chunk = old_chunk;
             break;
         }
             
-        case STMT_RETURN:
-            if (stmt->as.return_stmt.value) {
-                generate_expr(generator, stmt->as.return_stmt.value);
+        case STMT_RETURN: {
+            Expr* value = stmt->as.return_stmt.value;
+            
+            // A call in tail position reuses the current frame. The script
+            // frame has no callee slot below it, so only function and prism
+            // bodies get tail calls; natives return straight away anyway.
+            if (value && value->type == EXPR_CALL && generator->symtab->depth > 0 &&
+                native_index(generator, value->as.call.callee) < 0 &&
+                coroutine_op(generator, value->as.call.callee) == OP_NOP) {
+                generate_call(generator, value->as.call.callee, value->as.call.args, 
+                              value->as.call.arg_count, OP_TAIL_CALL);
+                break;
+            }
+            
+            if (value) {
+                generate_expr(generator, value);
             } else {
                 // Default return value is nil
-                PrismValue nil;
-                nil.type = TYPE_NONE;
+                PrismValue nil = NONE_VAL;
                 int constant = codegen_emit_constant(generator, nil);
                 codegen_emit_byte(generator, OP_CONSTANT, 0);
                 codegen_emit_byte(generator, constant, 0);
@@ -394,19 +689,10 @@ static void generate_stmt(CodeGenerator* generator, Stmt* stmt) {
             
             codegen_emit_byte(generator, OP_RETURN, 0);
             break;
+        }
             
         case STMT_CALL:
-            // Generate code for the arguments
-            for (int i = 0; i < stmt->as.call.arg_count; i++) {
-                generate_expr(generator, stmt->as.call.args[i]);
-            }
-            
-            // Generate code for the function itself
-            generate_expr(generator, stmt->as.call.callee);
-            
-            // Emit the call instruction with the argument count
-            codegen_emit_byte(generator, OP_CALL, 0);
-            codegen_emit_byte(generator, stmt->as.call.arg_count, 0);
+            generate_call(generator, stmt->as.call.callee, stmt->as.call.args, stmt->as.call.arg_count, OP_CALL);
             
             // Pop the result since this is a statement
             codegen_emit_byte(generator, OP_POP, 0);
@@ -416,20 +702,20 @@ static void generate_stmt(CodeGenerator* generator, Stmt* stmt) {
 
 void codegen_generate(CodeGenerator* generator, Program* program) {
     // Reset the current chunk
-    current_chunk = &generator->chunks[0];
+    generator->current_chunk = 0;
     
     // Generate code for each statement
     for (int i = 0; i < program->count; i++) {
         generate_stmt(generator, program->statements[i]);
     }
     
-    // Add a final return if one wasn't provided
-    if (current_chunk->count == 0 || current_chunk->code[current_chunk->count - 1] != OP_RETURN) {
-        PrismValue nil;
-        nil.type = TYPE_NONE;
-        int constant = codegen_emit_constant(generator, nil);
-        codegen_emit_byte(generator, OP_CONSTANT, 0);
-        codegen_emit_byte(generator, constant, 0);
-        codegen_emit_byte(generator, OP_RETURN, 0);
+    emit_return_and_end(generator);
+    
+    // The chunk array is final now, so prototypes can point into it
+    for (int i = 0; i < generator->chunk_count; i++) {
+        FunctionProto* function = generator->functions[i];
+        function->chunk = &generator->chunks[i];
+        codegen_peephole(function->chunk);
+        function->max_stack = compute_max_stack(function->chunk);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,151 @@
+#include "../../include/core/coroutine.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/common/gc.h"
+#include <pthread.h>
+#include <string.h>
+
+static int grown_capacity(int capacity, int needed) {
+    if (capacity < 1) capacity = 1;
+    while (capacity < needed) capacity *= 2;
+    return capacity;
+}
+
+// A running coroutine's values are on the VM stack, and what it parked
+// before is stale
+static void trace_coroutine(GcHeap* heap, void* object) {
+    Coroutine* coroutine = object;
+    if (coroutine->state == COROUTINE_SUSPENDED) {
+        gc_visit(heap, coroutine->stack, coroutine->stack_count);
+    }
+}
+
+static void free_coroutine(void* object) {
+    Coroutine* coroutine = object;
+    prism_free(coroutine->stack);
+    prism_free(coroutine->frames);
+}
+
+static pthread_once_t kind_once = PTHREAD_ONCE_INIT;
+
+static void define_kind() {
+    gc_define_kind(GC_COROUTINE, trace_coroutine, free_coroutine);
+}
+
+Coroutine* coroutine_create(FunctionProto* function, const PrismValue* args, int arg_count) {
+    pthread_once(&kind_once, define_kind);
+    Coroutine* coroutine = gc_alloc(GC_COROUTINE, sizeof(Coroutine));
+    coroutine->caller = NULL;
+    coroutine->state = COROUTINE_SUSPENDED;
+    coroutine->started = false;
+
+    // The slice a call would have built: callee, arguments, then the
+    // remaining locals as none
+    coroutine->stack_count = 1 + function->local_count;
+    coroutine->stack_capacity = coroutine->stack_count;
+    coroutine->stack = prism_alloc(sizeof(PrismValue) * coroutine->stack_capacity);
+    memcpy(coroutine->stack, args, sizeof(PrismValue) * (arg_count + 1));
+    for (int i = 1 + function->arity; i < coroutine->stack_count; i++) {
+        coroutine->stack[i] = NONE_VAL;
+    }
+
+    coroutine->frame_count = 1;
+    coroutine->frame_capacity = 1;
+    coroutine->frames = prism_alloc(sizeof(CallFrame));
+    coroutine->frames[0].function = function;
+    coroutine->frames[0].chunk = function->chunk;
+    coroutine->frames[0].ip = function->chunk->code;
+    coroutine->frames[0].base = 1;
+    coroutine->frames[0].discard_result = false;
+    return coroutine;
+}
+
+bool coroutine_resume(VM* vm, Coroutine* coroutine, PrismValue value) {
+    if (coroutine->state == COROUTINE_DONE) {
+        prism_error("Cannot resume a finished coroutine");
+        return false;
+    }
+    if (coroutine->state == COROUTINE_RUNNING) {
+        prism_error("Cannot resume a running coroutine");
+        return false;
+    }
+
+    // Same limits as a call: the innermost frame gets its whole operand
+    // stack above the slice
+    FunctionProto* innermost = coroutine->frames[coroutine->frame_count - 1].function;
+    int base = vm->stack_top;
+    if (base + coroutine->stack_count + innermost->max_stack > STACK_MAX ||
+        vm->frame_count + coroutine->frame_count > STACK_MAX) {
+        prism_error("Stack overflow");
+        return false;
+    }
+
+    memcpy(&vm->stack[base], coroutine->stack, sizeof(PrismValue) * coroutine->stack_count);
+    for (int i = 0; i < coroutine->frame_count; i++) {
+        CallFrame* frame = &vm->frames[vm->frame_count + i];
+        *frame = coroutine->frames[i];
+        frame->base += base;
+    }
+
+    coroutine->stack_base = base;
+    coroutine->frame_base = vm->frame_count;
+    vm->stack_top = base + coroutine->stack_count;
+    vm->frame_count += coroutine->frame_count;
+
+    // The first resume starts the body; later ones answer a yield
+    if (coroutine->started) vm->stack[vm->stack_top++] = value;
+    coroutine->started = true;
+
+    coroutine->caller = vm->coroutine;
+    coroutine->state = COROUTINE_RUNNING;
+    vm->coroutine = coroutine;
+    return true;
+}
+
+void coroutine_suspend(VM* vm) {
+    Coroutine* coroutine = vm->coroutine;
+    int stack_count = vm->stack_top - coroutine->stack_base;
+    int frame_count = vm->frame_count - coroutine->frame_base;
+
+    if (stack_count > coroutine->stack_capacity) {
+        coroutine->stack_capacity = grown_capacity(coroutine->stack_capacity, stack_count);
+        coroutine->stack = prism_realloc(coroutine->stack, sizeof(PrismValue) * coroutine->stack_capacity);
+    }
+    if (frame_count > coroutine->frame_capacity) {
+        coroutine->frame_capacity = grown_capacity(coroutine->frame_capacity, frame_count);
+        coroutine->frames = prism_realloc(coroutine->frames, sizeof(CallFrame) * coroutine->frame_capacity);
+    }
+
+    memcpy(coroutine->stack, &vm->stack[coroutine->stack_base], sizeof(PrismValue) * stack_count);
+    for (int i = 0; i < frame_count; i++) {
+        coroutine->frames[i] = vm->frames[coroutine->frame_base + i];
+        coroutine->frames[i].base -= coroutine->stack_base;
+    }
+    coroutine->stack_count = stack_count;
+    coroutine->frame_count = frame_count;
+    gc_write_barrier(GC_COROUTINE, coroutine);
+
+    vm->stack_top = coroutine->stack_base;
+    vm->frame_count = coroutine->frame_base;
+    vm->coroutine = coroutine->caller;
+    coroutine->caller = NULL;
+    coroutine->state = COROUTINE_SUSPENDED;
+}
+
+void coroutine_finish(VM* vm) {
+    Coroutine* coroutine = vm->coroutine;
+
+    // Nothing is left to park
+    prism_free(coroutine->stack);
+    prism_free(coroutine->frames);
+    coroutine->stack = NULL;
+    coroutine->frames = NULL;
+    coroutine->stack_count = coroutine->stack_capacity = 0;
+    coroutine->frame_count = coroutine->frame_capacity = 0;
+
+    vm->stack_top = coroutine->stack_base;
+    vm->frame_count = coroutine->frame_base;
+    vm->coroutine = coroutine->caller;
+    coroutine->caller = NULL;
+    coroutine->state = COROUTINE_DONE;
+}
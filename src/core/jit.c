@@ -0,0 +1,1235 @@
+#include "../../include/core/jit.h"
+#include "../../include/core/arith.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/common/rope.h"
+#include <string.h>
+
+#ifdef PRISM_JIT
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Register use inside compiled code:
+ *
+ *   rbx  VM*
+ *   r12  slots of the current frame
+ *   r13  &vm->stack[vm->stack_top]
+ *   r14  vm->globals
+ *
+ * r13 is written back to vm->stack_top before every helper call and exit,
+ * and reloaded after helpers, so the interpreter and the C helpers always
+ * see the same stack. Entry is through a shared prologue that saves the
+ * callee-saved registers and jumps to the native code for the requested
+ * bytecode offset; every exit returns the bytecode offset to resume at. */
+
+struct JitCode {
+    uint8_t* code;
+    size_t size;
+    int* entries;   // native offset for each bytecode offset, -1 inside an instruction
+};
+
+typedef int (*JitFunction)(VM* vm, PrismValue* slots, uint8_t* entry);
+
+_Static_assert(sizeof(PrismValue) == 8 || sizeof(PrismValue) == 16,
+               "JIT templates assume 8- or 16-byte values");
+#define VALUE_SHIFT (sizeof(PrismValue) == 16 ? 4 : 3)
+
+/* Helpers called from compiled code. They work on vm->stack just like the
+ * interpreter handlers and return nonzero after reporting a runtime error. */
+
+static int jit_arith(VM* vm, int op) {
+    PrismValue* a = &vm->stack[vm->stack_top - 2];
+    if (!prism_arith(op, a[0], a[1], a)) return 1;
+    vm->stack_top--;
+    return 0;
+}
+
+static int jit_add_const(VM* vm, const PrismValue* constant) {
+    PrismValue* a = &vm->stack[vm->stack_top - 1];
+    return !prism_arith(OP_ADD, *a, *constant, a);
+}
+
+static int jit_add_locals(VM* vm, int a, int b) {
+    PrismValue* slots = &vm->stack[vm->frames[vm->frame_count - 1].base];
+    PrismValue* result = &vm->stack[vm->stack_top];
+    if (!prism_arith(OP_ADD, slots[a], slots[b], result)) return 1;
+    vm->stack_top++;
+    return 0;
+}
+
+static int jit_negate(VM* vm) {
+    PrismValue* a = &vm->stack[vm->stack_top - 1];
+    if (IS_INT(*a)) {
+        *a = INT_VAL(-AS_INT(*a));
+    } else if (IS_FLOAT(*a)) {
+        *a = FLOAT_VAL(-AS_FLOAT(*a));
+    } else {
+        prism_error("Can only negate numbers");
+        return 1;
+    }
+    return 0;
+}
+
+static int jit_call_native(VM* vm, int index, int arg_count) {
+    PrismValue* args = &vm->stack[vm->stack_top - arg_count];
+    rope_flatten_args(args, arg_count);
+    *args = vm->code_gen->natives[index].function(args, arg_count);
+    vm->stack_top += 1 - arg_count;
+    return prism_get_last_error()->type != ERROR_NONE;
+}
+
+static bool is_falsey(PrismValue condition) {
+    return (IS_BOOL(condition) && !AS_BOOL(condition)) ||
+           (IS_INT(condition) && AS_INT(condition) == 0) ||
+           (IS_FLOAT(condition) && AS_FLOAT(condition) == 0.0) ||
+           IS_NONE(condition);
+}
+
+// Pops the condition and returns 1 when the branch should be taken
+static int jit_pop_falsey(VM* vm) {
+    return is_falsey(vm->stack[--vm->stack_top]);
+}
+
+/* Machine code emission */
+
+#define JO 0x80
+#define JNE 0x85
+#define JMP 0xE9
+
+typedef struct {
+    size_t at;      // position of a rel32 field
+    int target;     // bytecode offset it should reach, -1 for the error exit
+} JitPatch;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+
+    JitPatch* patches;
+    int patch_count;
+    int patch_capacity;
+} Emitter;
+
+static void emit_bytes(Emitter* e, const uint8_t* bytes, size_t count) {
+    if (e->count + count > e->capacity) {
+        while (e->count + count > e->capacity) e->capacity *= 2;
+        e->bytes = prism_realloc(e->bytes, e->capacity);
+    }
+    memcpy(e->bytes + e->count, bytes, count);
+    e->count += count;
+}
+
+#define EMIT(e, ...) \
+    do { \
+        static const uint8_t bytes_[] = { __VA_ARGS__ }; \
+        emit_bytes((e), bytes_, sizeof(bytes_)); \
+    } while (0)
+
+static void emit_u32(Emitter* e, uint32_t value) {
+    emit_bytes(e, (const uint8_t*)&value, 4);
+}
+
+static void emit_u64(Emitter* e, uint64_t value) {
+    emit_bytes(e, (const uint8_t*)&value, 8);
+}
+
+// Leaves a rel32 hole to be pointed at a bytecode offset, or at the error exit
+static void emit_patch(Emitter* e, int target) {
+    if (e->patch_count >= e->patch_capacity) {
+        e->patch_capacity *= 2;
+        e->patches = prism_realloc(e->patches, sizeof(JitPatch) * e->patch_capacity);
+    }
+    e->patches[e->patch_count].at = e->count;
+    e->patches[e->patch_count].target = target;
+    e->patch_count++;
+    emit_u32(e, 0);
+}
+
+static void emitter_init(Emitter* e, size_t capacity) {
+    e->capacity = capacity;
+    e->bytes = prism_alloc(e->capacity);
+    e->count = 0;
+    e->patch_capacity = 16;
+    e->patches = prism_alloc(sizeof(JitPatch) * e->patch_capacity);
+    e->patch_count = 0;
+}
+
+// Copies the code into fresh pages while they are writable, then makes them
+// executable. Frees the emitter either way; NULL if the pages couldn't be set up.
+static uint8_t* emitter_install(Emitter* e, size_t* size) {
+    long page = sysconf(_SC_PAGESIZE);
+    *size = (e->count + page - 1) / page * page;
+    void* memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (memory != MAP_FAILED) {
+        memcpy(memory, e->bytes, e->count);
+        if (mprotect(memory, *size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, *size);
+            memory = MAP_FAILED;
+        }
+    }
+
+    prism_free(e->bytes);
+    prism_free(e->patches);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+// Forward branch within the current instruction, fixed up by emit_label
+static size_t emit_branch(Emitter* e, uint8_t opcode) {
+    if (opcode == JMP) {
+        EMIT(e, 0xE9);                              // jmp rel32
+    } else {
+        uint8_t bytes[] = { 0x0F, opcode };         // jcc rel32
+        emit_bytes(e, bytes, 2);
+    }
+    emit_u32(e, 0);
+    return e->count - 4;
+}
+
+static void emit_label(Emitter* e, size_t branch) {
+    int32_t rel = (int32_t)(e->count - (branch + 4));
+    memcpy(e->bytes + branch, &rel, 4);
+}
+
+// vm->stack_top = r13 - vm->stack
+static void emit_store_top(Emitter* e) {
+    EMIT(e, 0x4C, 0x89, 0xE8);                      // mov rax, r13
+    EMIT(e, 0x48, 0x29, 0xD8);                      // sub rax, rbx
+    EMIT(e, 0x48, 0x2D);                            // sub rax, stack
+    emit_u32(e, offsetof(VM, stack));
+    EMIT(e, 0x48, 0xC1, 0xE8, VALUE_SHIFT);         // shr rax, log2(sizeof(PrismValue))
+    EMIT(e, 0x89, 0x83);                            // mov [rbx + stack_top], eax
+    emit_u32(e, offsetof(VM, stack_top));
+}
+
+// r13 = &vm->stack[vm->stack_top]
+static void emit_load_top(Emitter* e) {
+    EMIT(e, 0x48, 0x63, 0x83);                      // movsxd rax, [rbx + stack_top]
+    emit_u32(e, offsetof(VM, stack_top));
+    EMIT(e, 0x48, 0xC1, 0xE0, VALUE_SHIFT);         // shl rax, log2(sizeof(PrismValue))
+    EMIT(e, 0x4C, 0x8D, 0xAC, 0x03);                // lea r13, [rbx + rax + stack]
+    emit_u32(e, offsetof(VM, stack));
+}
+
+static void emit_prologue(Emitter* e) {
+    EMIT(e, 0x53);                                  // push rbx
+    EMIT(e, 0x41, 0x54);                            // push r12
+    EMIT(e, 0x41, 0x55);                            // push r13
+    EMIT(e, 0x41, 0x56);                            // push r14
+    EMIT(e, 0x41, 0x57);                            // push r15 (keeps rsp 16-byte aligned)
+    EMIT(e, 0x48, 0x89, 0xFB);                      // mov rbx, rdi
+    EMIT(e, 0x49, 0x89, 0xF4);                      // mov r12, rsi
+    EMIT(e, 0x4C, 0x8B, 0xB3);                      // mov r14, [rbx + globals]
+    emit_u32(e, offsetof(VM, globals));
+    emit_load_top(e);
+    EMIT(e, 0xFF, 0xE2);                            // jmp rdx
+}
+
+static void emit_epilogue(Emitter* e) {
+    EMIT(e, 0x41, 0x5F);                            // pop r15
+    EMIT(e, 0x41, 0x5E);                            // pop r14
+    EMIT(e, 0x41, 0x5D);                            // pop r13
+    EMIT(e, 0x41, 0x5C);                            // pop r12
+    EMIT(e, 0x5B);                                  // pop rbx
+    EMIT(e, 0xC3);                                  // ret
+}
+
+// Hands ip back to the interpreter
+static void emit_exit(Emitter* e, int ip) {
+    emit_store_top(e);
+    EMIT(e, 0xB8);                                  // mov eax, ip
+    emit_u32(e, (uint32_t)ip);
+    emit_epilogue(e);
+}
+
+// Pushes the value rdx points at. Values move as 8-byte words so the
+// type and payload loads that follow can be forwarded from the stores.
+static void emit_push_from_rdx(Emitter* e) {
+    EMIT(e, 0x48, 0x8B, 0x02);                      // mov rax, [rdx]
+    EMIT(e, 0x49, 0x89, 0x45, 0x00);                // mov [r13], rax
+    if (sizeof(PrismValue) == 16) {
+        EMIT(e, 0x48, 0x8B, 0x4A, 0x08);            // mov rcx, [rdx + 8]
+        EMIT(e, 0x49, 0x89, 0x4D, 0x08);            // mov [r13 + 8], rcx
+    }
+    EMIT(e, 0x49, 0x83, 0xC5, sizeof(PrismValue));  // add r13, sizeof(PrismValue)
+}
+
+// Pops into the slot rdx points at
+static void emit_pop_to_rdx(Emitter* e) {
+    EMIT(e, 0x49, 0x83, 0xED, sizeof(PrismValue));  // sub r13, sizeof(PrismValue)
+    EMIT(e, 0x49, 0x8B, 0x45, 0x00);                // mov rax, [r13]
+    EMIT(e, 0x48, 0x89, 0x02);                      // mov [rdx], rax
+    if (sizeof(PrismValue) == 16) {
+        EMIT(e, 0x49, 0x8B, 0x4D, 0x08);            // mov rcx, [r13 + 8]
+        EMIT(e, 0x48, 0x89, 0x4A, 0x08);            // mov [rdx + 8], rcx
+    }
+}
+
+static void emit_slot_address(Emitter* e, int index) {
+    EMIT(e, 0x49, 0x8D, 0x94, 0x24);                // lea rdx, [r12 + index * size]
+    emit_u32(e, (uint32_t)(index * sizeof(PrismValue)));
+}
+
+static void emit_global_address(Emitter* e, int index) {
+    EMIT(e, 0x49, 0x8D, 0x96);                      // lea rdx, [r14 + index * size]
+    emit_u32(e, (uint32_t)(index * sizeof(PrismValue)));
+}
+
+// Calls helper(vm, esi/rsi, edx), with the other arguments already loaded.
+// The helper sees the current stack top and may move it.
+static void emit_call(Emitter* e, uint64_t helper) {
+    emit_store_top(e);
+    EMIT(e, 0x48, 0x89, 0xDF);                      // mov rdi, rbx
+    EMIT(e, 0x48, 0xB8);                            // mov rax, helper
+    emit_u64(e, helper);
+    EMIT(e, 0xFF, 0xD0);                            // call rax
+    EMIT(e, 0x41, 0x89, 0xC7);                      // mov r15d, eax
+    emit_load_top(e);
+    EMIT(e, 0x45, 0x85, 0xFF);                      // test r15d, r15d
+}
+
+// Leaves through the error exit if the helper failed
+static void emit_check(Emitter* e) {
+    EMIT(e, 0x0F, 0x85);                            // jnz error
+    emit_patch(e, -1);
+}
+
+static void emit_arith_helper(Emitter* e, OpCode op) {
+    EMIT(e, 0xBE);                                  // mov esi, op
+    emit_u32(e, op);
+    emit_call(e, (uint64_t)(uintptr_t)jit_arith);
+    emit_check(e);
+}
+
+static void emit_add_const_helper(Emitter* e, const PrismValue* constant) {
+    EMIT(e, 0x48, 0xBE);                            // mov rsi, &constant
+    emit_u64(e, (uint64_t)(uintptr_t)constant);
+    emit_call(e, (uint64_t)(uintptr_t)jit_add_const);
+    emit_check(e);
+}
+
+static void emit_add_locals_helper(Emitter* e, int a, int b) {
+    EMIT(e, 0xBE);                                  // mov esi, a
+    emit_u32(e, (uint32_t)a);
+    EMIT(e, 0xBA);                                  // mov edx, b
+    emit_u32(e, (uint32_t)b);
+    emit_call(e, (uint64_t)(uintptr_t)jit_add_locals);
+    emit_check(e);
+}
+
+#ifdef PRISM_NAN_BOXING
+
+/* Boxed small ints carry a 47-bit payload. Both operands' tags are checked
+ * inline and the result is reboxed when it still fits; anything else,
+ * including big ints and overflow, goes to the helper. */
+
+#define INT_TAG_HIGH ((uint32_t)(NANBOX_MAKE(NANBOX_TAG_OF(TYPE_INT), 0) >> NANBOX_TAG_SHIFT))
+#define PAYLOAD_SHIFT (64 - NANBOX_TAG_SHIFT)
+
+// rax = rax op rdx for two boxed small ints. Records branches to the slow
+// path in slow[] and returns how many there are.
+static int emit_boxed_int_op(Emitter* e, OpCode op, size_t* slow) {
+    int count = 0;
+
+    EMIT(e, 0x48, 0x89, 0xC1);                      // mov rcx, rax
+    EMIT(e, 0x48, 0xC1, 0xE9, NANBOX_TAG_SHIFT);    // shr rcx, 47
+    EMIT(e, 0x81, 0xF9);                            // cmp ecx, int tag
+    emit_u32(e, INT_TAG_HIGH);
+    slow[count++] = emit_branch(e, JNE);
+    EMIT(e, 0x48, 0x89, 0xD1);                      // mov rcx, rdx
+    EMIT(e, 0x48, 0xC1, 0xE9, NANBOX_TAG_SHIFT);    // shr rcx, 47
+    EMIT(e, 0x81, 0xF9);                            // cmp ecx, int tag
+    emit_u32(e, INT_TAG_HIGH);
+    slow[count++] = emit_branch(e, JNE);
+
+    EMIT(e, 0x48, 0xC1, 0xE0, PAYLOAD_SHIFT);       // shl rax, 17
+    EMIT(e, 0x48, 0xC1, 0xF8, PAYLOAD_SHIFT);       // sar rax, 17
+    EMIT(e, 0x48, 0xC1, 0xE2, PAYLOAD_SHIFT);       // shl rdx, 17
+    EMIT(e, 0x48, 0xC1, 0xFA, PAYLOAD_SHIFT);       // sar rdx, 17
+    if (op == OP_ADD) {
+        EMIT(e, 0x48, 0x01, 0xD0);                  // add rax, rdx
+    } else if (op == OP_SUBTRACT) {
+        EMIT(e, 0x48, 0x29, 0xD0);                  // sub rax, rdx
+    } else {
+        EMIT(e, 0x48, 0x0F, 0xAF, 0xC2);            // imul rax, rdx
+        slow[count++] = emit_branch(e, JO);
+    }
+
+    // Still a small int if sign-extending the low 47 bits gives it back
+    EMIT(e, 0x48, 0x89, 0xC1);                      // mov rcx, rax
+    EMIT(e, 0x48, 0xC1, 0xE1, PAYLOAD_SHIFT);       // shl rcx, 17
+    EMIT(e, 0x48, 0xC1, 0xF9, PAYLOAD_SHIFT);       // sar rcx, 17
+    EMIT(e, 0x48, 0x39, 0xC1);                      // cmp rcx, rax
+    slow[count++] = emit_branch(e, JNE);
+
+    EMIT(e, 0x48, 0xB9);                            // mov rcx, payload mask
+    emit_u64(e, NANBOX_PAYLOAD_MASK);
+    EMIT(e, 0x48, 0x21, 0xC8);                      // and rax, rcx
+    EMIT(e, 0x48, 0xB9);                            // mov rcx, int box
+    emit_u64(e, NANBOX_MAKE(NANBOX_TAG_OF(TYPE_INT), 0));
+    EMIT(e, 0x48, 0x09, 0xC8);                      // or rax, rcx
+    return count;
+}
+
+static void emit_arith(Emitter* e, OpCode op) {
+    if (op == OP_DIVIDE) {
+        emit_arith_helper(e, op);
+        return;
+    }
+
+    size_t slow[4];
+    EMIT(e, 0x49, 0x8B, 0x45, 0xF0);                // mov rax, [r13 - 16]
+    EMIT(e, 0x49, 0x8B, 0x55, 0xF8);                // mov rdx, [r13 - 8]
+    int slow_count = emit_boxed_int_op(e, op, slow);
+    EMIT(e, 0x49, 0x89, 0x45, 0xF0);                // mov [r13 - 16], rax
+    EMIT(e, 0x49, 0x83, 0xED, 0x08);                // sub r13, 8
+    size_t done = emit_branch(e, JMP);
+
+    for (int i = 0; i < slow_count; i++) emit_label(e, slow[i]);
+    emit_arith_helper(e, op);
+    emit_label(e, done);
+}
+
+static void emit_add_const(Emitter* e, const PrismValue* constant) {
+    size_t slow[4];
+    EMIT(e, 0x49, 0x8B, 0x45, 0xF8);                // mov rax, [r13 - 8]
+    EMIT(e, 0x48, 0xBA);                            // mov rdx, constant
+    emit_u64(e, *constant);
+    int slow_count = emit_boxed_int_op(e, OP_ADD, slow);
+    EMIT(e, 0x49, 0x89, 0x45, 0xF8);                // mov [r13 - 8], rax
+    size_t done = emit_branch(e, JMP);
+
+    for (int i = 0; i < slow_count; i++) emit_label(e, slow[i]);
+    emit_add_const_helper(e, constant);
+    emit_label(e, done);
+}
+
+static void emit_add_locals(Emitter* e, int a, int b) {
+    size_t slow[4];
+    EMIT(e, 0x49, 0x8B, 0x84, 0x24);                // mov rax, [r12 + a * 8]
+    emit_u32(e, (uint32_t)(a * sizeof(PrismValue)));
+    EMIT(e, 0x49, 0x8B, 0x94, 0x24);                // mov rdx, [r12 + b * 8]
+    emit_u32(e, (uint32_t)(b * sizeof(PrismValue)));
+    int slow_count = emit_boxed_int_op(e, OP_ADD, slow);
+    EMIT(e, 0x49, 0x89, 0x45, 0x00);                // mov [r13], rax
+    EMIT(e, 0x49, 0x83, 0xC5, 0x08);                // add r13, 8
+    size_t done = emit_branch(e, JMP);
+
+    for (int i = 0; i < slow_count; i++) emit_label(e, slow[i]);
+    emit_add_locals_helper(e, a, b);
+    emit_label(e, done);
+}
+
+#else
+
+/* With tagged structs an int is a type word and a plain int64 payload, so
+ * int-int arithmetic is done inline and anything else goes to the helper. */
+
+_Static_assert(TYPE_INT < 0x80, "type tag must fit an imm8");
+#define TYPE_AT(n)  ((uint8_t)(offsetof(PrismValue, type) - (n) * sizeof(PrismValue)))
+#define VALUE_AT(n) ((uint8_t)(offsetof(PrismValue, value) - (n) * sizeof(PrismValue)))
+
+static void emit_arith(Emitter* e, OpCode op) {
+    if (op == OP_DIVIDE) {
+        emit_arith_helper(e, op);
+        return;
+    }
+
+    EMIT(e, 0x41, 0x83, 0x7D, TYPE_AT(2), TYPE_INT); // cmp dword [r13 - 2 values], TYPE_INT
+    size_t a_not_int = emit_branch(e, JNE);
+    EMIT(e, 0x41, 0x83, 0x7D, TYPE_AT(1), TYPE_INT); // cmp dword [r13 - 1 value], TYPE_INT
+    size_t b_not_int = emit_branch(e, JNE);
+
+    EMIT(e, 0x49, 0x8B, 0x45, VALUE_AT(2));         // mov rax, a
+    if (op == OP_ADD) {
+        EMIT(e, 0x49, 0x03, 0x45, VALUE_AT(1));     // add rax, b
+    } else if (op == OP_SUBTRACT) {
+        EMIT(e, 0x49, 0x2B, 0x45, VALUE_AT(1));     // sub rax, b
+    } else {
+        EMIT(e, 0x49, 0x0F, 0xAF, 0x45, VALUE_AT(1)); // imul rax, b
+    }
+    EMIT(e, 0x49, 0x89, 0x45, VALUE_AT(2));         // mov a, rax
+    EMIT(e, 0x49, 0x83, 0xED, sizeof(PrismValue));  // sub r13, sizeof(PrismValue)
+    size_t done = emit_branch(e, JMP);
+
+    emit_label(e, a_not_int);
+    emit_label(e, b_not_int);
+    emit_arith_helper(e, op);
+    emit_label(e, done);
+}
+
+static void emit_add_const(Emitter* e, const PrismValue* constant) {
+    if (!IS_INT(*constant) || AS_INT(*constant) != (int32_t)AS_INT(*constant)) {
+        emit_add_const_helper(e, constant);
+        return;
+    }
+
+    EMIT(e, 0x41, 0x83, 0x7D, TYPE_AT(1), TYPE_INT); // cmp dword [r13 - 1 value], TYPE_INT
+    size_t not_int = emit_branch(e, JNE);
+    EMIT(e, 0x49, 0x81, 0x45, VALUE_AT(1));         // add qword [r13 - 1 value], imm32
+    emit_u32(e, (uint32_t)AS_INT(*constant));
+    size_t done = emit_branch(e, JMP);
+
+    emit_label(e, not_int);
+    emit_add_const_helper(e, constant);
+    emit_label(e, done);
+}
+
+static void emit_add_locals(Emitter* e, int a, int b) {
+    emit_slot_address(e, a);
+    EMIT(e, 0x49, 0x8D, 0xB4, 0x24);                // lea rsi, [r12 + b * size]
+    emit_u32(e, (uint32_t)(b * sizeof(PrismValue)));
+
+    EMIT(e, 0x83, 0x3A, TYPE_INT);                  // cmp dword [rdx], TYPE_INT
+    size_t a_not_int = emit_branch(e, JNE);
+    EMIT(e, 0x83, 0x3E, TYPE_INT);                  // cmp dword [rsi], TYPE_INT
+    size_t b_not_int = emit_branch(e, JNE);
+
+    EMIT(e, 0x48, 0x8B, 0x42, VALUE_AT(0));         // mov rax, [rdx + value]
+    EMIT(e, 0x48, 0x03, 0x46, VALUE_AT(0));         // add rax, [rsi + value]
+    EMIT(e, 0x41, 0xC7, 0x45, TYPE_AT(0));          // mov dword [r13 + type], TYPE_INT
+    emit_u32(e, TYPE_INT);
+    EMIT(e, 0x49, 0x89, 0x45, VALUE_AT(0));         // mov [r13 + value], rax
+    EMIT(e, 0x49, 0x83, 0xC5, sizeof(PrismValue));  // add r13, sizeof(PrismValue)
+    size_t done = emit_branch(e, JMP);
+
+    emit_label(e, a_not_int);
+    emit_label(e, b_not_int);
+    emit_add_locals_helper(e, a, b);
+    emit_label(e, done);
+}
+
+#endif
+
+static int jump_target(const OpCode* code, int ip) {
+    return ip + 3 + ((code[ip + 1] << 8) | code[ip + 2]);
+}
+
+// Quickened arithmetic maps back to the generic opcode, whose templates
+// cover every operand type
+static OpCode arith_kind(OpCode op) {
+    switch (op) {
+        case OP_ADD_INT_INT:
+        case OP_ADD_FLOAT_FLOAT:
+        case OP_ADD_STR_STR:
+            return OP_ADD;
+        case OP_SUBTRACT_INT_INT:
+        case OP_SUBTRACT_FLOAT_FLOAT:
+            return OP_SUBTRACT;
+        case OP_MULTIPLY_INT_INT:
+        case OP_MULTIPLY_FLOAT_FLOAT:
+            return OP_MULTIPLY;
+        default:
+            return op;
+    }
+}
+
+// Templates shared by both tiers. Returns false for opcodes they don't cover.
+static bool emit_common_op(Emitter* e, const CodeChunk* chunk, int ip) {
+    const OpCode* code = chunk->code;
+
+    switch (code[ip]) {
+        case OP_NOP:
+            return true;
+
+        case OP_CONSTANT:
+            EMIT(e, 0x48, 0xBA);                    // mov rdx, &constant
+            emit_u64(e, (uint64_t)(uintptr_t)&chunk->constants[code[ip + 1]]);
+            emit_push_from_rdx(e);
+            return true;
+
+        case OP_LOAD:
+            emit_slot_address(e, code[ip + 1]);
+            emit_push_from_rdx(e);
+            return true;
+
+        case OP_STORE:
+            emit_slot_address(e, code[ip + 1]);
+            emit_pop_to_rdx(e);
+            return true;
+
+        case OP_LOAD_GLOBAL:
+            emit_global_address(e, code[ip + 1]);
+            emit_push_from_rdx(e);
+            return true;
+
+        case OP_STORE_GLOBAL:
+            emit_global_address(e, code[ip + 1]);
+            emit_pop_to_rdx(e);
+            return true;
+
+        case OP_POP:
+            EMIT(e, 0x49, 0x83, 0xED, sizeof(PrismValue)); // sub r13, sizeof(PrismValue)
+            return true;
+
+        case OP_NEGATE:
+            emit_call(e, (uint64_t)(uintptr_t)jit_negate);
+            emit_check(e);
+            return true;
+
+        case OP_CALL_NATIVE:
+            EMIT(e, 0xBE);                          // mov esi, index
+            emit_u32(e, code[ip + 1]);
+            EMIT(e, 0xBA);                          // mov edx, argc
+            emit_u32(e, code[ip + 2]);
+            emit_call(e, (uint64_t)(uintptr_t)jit_call_native);
+            emit_check(e);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+JitCode* jit_compile(FunctionProto* function) {
+    CodeChunk* chunk = function->chunk;
+    const OpCode* code = chunk->code;
+
+    Emitter e;
+    emitter_init(&e, 64 + chunk->count * 32);
+
+    int* entries = prism_alloc(sizeof(int) * chunk->count);
+    for (int i = 0; i < chunk->count; i++) entries[i] = -1;
+
+    emit_prologue(&e);
+
+    for (int ip = 0; ip < chunk->count; ip += codegen_op_length(code[ip])) {
+        entries[ip] = (int)e.count;
+        OpCode op = arith_kind(code[ip]);
+
+        switch (op) {
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                emit_arith(&e, op);
+                break;
+
+            case OP_ADD_CONST:
+                emit_add_const(&e, &chunk->constants[code[ip + 1]]);
+                break;
+
+            case OP_ADD_LOCALS:
+                emit_add_locals(&e, code[ip + 1], code[ip + 2]);
+                break;
+
+            case OP_JUMP:
+                EMIT(&e, 0xE9);                     // jmp target
+                emit_patch(&e, jump_target(code, ip));
+                break;
+
+            case OP_JUMP_IF_FALSE:
+                emit_call(&e, (uint64_t)(uintptr_t)jit_pop_falsey);
+                EMIT(&e, 0x0F, 0x85);               // jnz target
+                emit_patch(&e, jump_target(code, ip));
+                break;
+
+            default:
+                // Calls, returns and anything else run in the interpreter
+                if (!emit_common_op(&e, chunk, ip)) emit_exit(&e, ip);
+                break;
+        }
+    }
+
+    // Jumps to offsets with no native entry leave through an exit stub
+    size_t error_exit = e.count;
+    emit_exit(&e, -1);
+
+    for (int i = 0; i < e.patch_count; i++) {
+        JitPatch* patch = &e.patches[i];
+        size_t target = error_exit;
+
+        if (patch->target >= 0) {
+            if (patch->target < chunk->count && entries[patch->target] >= 0) {
+                target = entries[patch->target];
+            } else {
+                target = e.count;
+                emit_exit(&e, patch->target);
+            }
+        }
+
+        int32_t rel = (int32_t)(target - (patch->at + 4));
+        memcpy(e.bytes + patch->at, &rel, 4);
+    }
+
+    size_t size;
+    uint8_t* memory = emitter_install(&e, &size);
+    if (!memory) {
+        prism_free(entries);
+        return NULL;
+    }
+
+    JitCode* jit = prism_alloc(sizeof(JitCode));
+    jit->code = memory;
+    jit->size = size;
+    jit->entries = entries;
+    return jit;
+}
+
+void jit_free(JitCode* jit) {
+    if (!jit) return;
+
+    munmap(jit->code, jit->size);
+    prism_free(jit->entries);
+    prism_free(jit);
+}
+
+int jit_enter(JitCode* jit, VM* vm, PrismValue* slots, int ip) {
+    if (jit->entries[ip] < 0) return ip;
+
+    JitFunction function = (JitFunction)(void*)jit->code;
+    return function(vm, slots, jit->code + jit->entries[ip]);
+}
+
+/* Tracing tier
+ *
+ * A trace is the straight-line path one execution took from an anchor - a
+ * function entry or the instruction after a call - to the next call or
+ * return. While it is recorded the interpreter reports each instruction
+ * along with the operand types it saw. The compiled trace drops the jumps,
+ * specializes int and float arithmetic to the recorded types and checks
+ * those types with guards. A failed guard, or a branch going the other way
+ * than it did while recording, is a side exit back to the interpreter at
+ * that instruction. */
+
+typedef struct {
+    int ip;
+    OpCode op;
+    PrismType a;        // operand types seen while recording
+    PrismType b;
+    bool taken;         // JUMP_IF_FALSE went to its target
+} TraceStep;
+
+struct TraceRecorder {
+    FunctionProto* function;
+    int start;
+    TraceStep* steps;
+    int count;
+    int capacity;
+};
+
+struct Trace {
+    uint8_t* code;      // inside one of the cache's blocks
+    size_t entry;       // native offset of the first step
+};
+
+// Executable memory shared by the traces of one function
+typedef struct TraceBlock {
+    uint8_t* code;
+    size_t size;
+    size_t used;
+    struct TraceBlock* next;
+} TraceBlock;
+
+#define TRACE_BLOCK_SIZE (64 * 1024)
+
+// Per-function tracing state, indexed by bytecode offset
+struct TraceCache {
+    int* hot_counts;    // arrivals at each anchor, -1 once abandoned
+    Trace** traces;
+    TraceBlock* blocks;
+};
+
+#define JE 0x84
+#define JP 0x8A
+
+// Leaves the trace for the interpreter at ip when the condition holds
+static void emit_side_exit(Emitter* e, uint8_t condition, int ip) {
+    uint8_t bytes[] = { 0x0F, condition };
+    emit_bytes(e, bytes, 2);
+    emit_patch(e, ip);
+}
+
+static bool can_specialize(OpCode op, PrismType a, PrismType b) {
+    if (a != b) return false;
+    return a == TYPE_FLOAT || (a == TYPE_INT && op != OP_DIVIDE);
+}
+
+#ifdef PRISM_NAN_BOXING
+
+// *rdx = *rsi op *rdi, for operands of the recorded type
+static void emit_typed_arith(Emitter* e, OpCode op, PrismType type, int ip) {
+    EMIT(e, 0x48, 0x8B, 0x06);                      // mov rax, [rsi]
+    EMIT(e, 0x48, 0x8B, 0x0F);                      // mov rcx, [rdi]
+
+    if (type == TYPE_INT) {
+        EMIT(e, 0x49, 0x89, 0xC1);                  // mov r9, rax
+        EMIT(e, 0x49, 0xC1, 0xE9, NANBOX_TAG_SHIFT); // shr r9, 47
+        EMIT(e, 0x41, 0x81, 0xF9);                  // cmp r9d, int tag
+        emit_u32(e, INT_TAG_HIGH);
+        emit_side_exit(e, JNE, ip);
+        EMIT(e, 0x49, 0x89, 0xC9);                  // mov r9, rcx
+        EMIT(e, 0x49, 0xC1, 0xE9, NANBOX_TAG_SHIFT); // shr r9, 47
+        EMIT(e, 0x41, 0x81, 0xF9);                  // cmp r9d, int tag
+        emit_u32(e, INT_TAG_HIGH);
+        emit_side_exit(e, JNE, ip);
+
+        EMIT(e, 0x48, 0xC1, 0xE0, PAYLOAD_SHIFT);   // shl rax, 17
+        EMIT(e, 0x48, 0xC1, 0xF8, PAYLOAD_SHIFT);   // sar rax, 17
+        EMIT(e, 0x48, 0xC1, 0xE1, PAYLOAD_SHIFT);   // shl rcx, 17
+        EMIT(e, 0x48, 0xC1, 0xF9, PAYLOAD_SHIFT);   // sar rcx, 17
+        if (op == OP_ADD) {
+            EMIT(e, 0x48, 0x01, 0xC8);              // add rax, rcx
+        } else if (op == OP_SUBTRACT) {
+            EMIT(e, 0x48, 0x29, 0xC8);              // sub rax, rcx
+        } else {
+            EMIT(e, 0x48, 0x0F, 0xAF, 0xC1);        // imul rax, rcx
+            emit_side_exit(e, JO, ip);
+        }
+
+        // Results that no longer fit a small int are boxed by the interpreter
+        EMIT(e, 0x49, 0x89, 0xC1);                  // mov r9, rax
+        EMIT(e, 0x49, 0xC1, 0xE1, PAYLOAD_SHIFT);   // shl r9, 17
+        EMIT(e, 0x49, 0xC1, 0xF9, PAYLOAD_SHIFT);   // sar r9, 17
+        EMIT(e, 0x4C, 0x39, 0xC8);                  // cmp rax, r9
+        emit_side_exit(e, JNE, ip);
+
+        EMIT(e, 0x49, 0xB9);                        // mov r9, payload mask
+        emit_u64(e, NANBOX_PAYLOAD_MASK);
+        EMIT(e, 0x4C, 0x21, 0xC8);                  // and rax, r9
+        EMIT(e, 0x49, 0xB9);                        // mov r9, int box
+        emit_u64(e, NANBOX_MAKE(NANBOX_TAG_OF(TYPE_INT), 0));
+        EMIT(e, 0x4C, 0x09, 0xC8);                  // or rax, r9
+        EMIT(e, 0x48, 0x89, 0x02);                  // mov [rdx], rax
+        return;
+    }
+
+    // Floats are the unboxed bit patterns
+    EMIT(e, 0x49, 0xB9);                            // mov r9, box prefix
+    emit_u64(e, NANBOX_PREFIX);
+    EMIT(e, 0x49, 0x89, 0xC2);                      // mov r10, rax
+    EMIT(e, 0x4D, 0x21, 0xCA);                      // and r10, r9
+    EMIT(e, 0x4D, 0x39, 0xCA);                      // cmp r10, r9
+    emit_side_exit(e, JE, ip);
+    EMIT(e, 0x49, 0x89, 0xCA);                      // mov r10, rcx
+    EMIT(e, 0x4D, 0x21, 0xCA);                      // and r10, r9
+    EMIT(e, 0x4D, 0x39, 0xCA);                      // cmp r10, r9
+    emit_side_exit(e, JE, ip);
+
+    EMIT(e, 0x66, 0x48, 0x0F, 0x6E, 0xC0);          // movq xmm0, rax
+    EMIT(e, 0x66, 0x48, 0x0F, 0x6E, 0xC9);          // movq xmm1, rcx
+    if (op == OP_DIVIDE) {
+        EMIT(e, 0x66, 0x0F, 0x57, 0xD2);            // xorpd xmm2, xmm2
+        EMIT(e, 0x66, 0x0F, 0x2E, 0xCA);            // ucomisd xmm1, xmm2
+        emit_side_exit(e, JE, ip);                  // division by zero is reported by the interpreter
+    }
+    switch (op) {
+        case OP_ADD:      EMIT(e, 0xF2, 0x0F, 0x58, 0xC1); break; // addsd xmm0, xmm1
+        case OP_SUBTRACT: EMIT(e, 0xF2, 0x0F, 0x5C, 0xC1); break; // subsd xmm0, xmm1
+        case OP_MULTIPLY: EMIT(e, 0xF2, 0x0F, 0x59, 0xC1); break; // mulsd xmm0, xmm1
+        default:          EMIT(e, 0xF2, 0x0F, 0x5E, 0xC1); break; // divsd xmm0, xmm1
+    }
+
+    // A NaN result must be canonicalized, which the interpreter does
+    EMIT(e, 0x66, 0x0F, 0x2E, 0xC0);                // ucomisd xmm0, xmm0
+    emit_side_exit(e, JP, ip);
+    EMIT(e, 0x66, 0x0F, 0xD6, 0x02);                // movq [rdx], xmm0
+}
+
+#else
+
+_Static_assert(offsetof(PrismValue, type) == 0, "templates address the type word as [reg]");
+
+// *rdx = *rsi op *rdi, for operands of the recorded type
+static void emit_typed_arith(Emitter* e, OpCode op, PrismType type, int ip) {
+    uint8_t guard_a[] = { 0x83, 0x3E, type };       // cmp dword [rsi], type
+    emit_bytes(e, guard_a, sizeof(guard_a));
+    emit_side_exit(e, JNE, ip);
+    uint8_t guard_b[] = { 0x83, 0x3F, type };       // cmp dword [rdi], type
+    emit_bytes(e, guard_b, sizeof(guard_b));
+    emit_side_exit(e, JNE, ip);
+
+    if (type == TYPE_INT) {
+        EMIT(e, 0x48, 0x8B, 0x46, VALUE_AT(0));     // mov rax, [rsi + value]
+        if (op == OP_ADD) {
+            EMIT(e, 0x48, 0x03, 0x47, VALUE_AT(0)); // add rax, [rdi + value]
+        } else if (op == OP_SUBTRACT) {
+            EMIT(e, 0x48, 0x2B, 0x47, VALUE_AT(0)); // sub rax, [rdi + value]
+        } else {
+            EMIT(e, 0x48, 0x0F, 0xAF, 0x47, VALUE_AT(0)); // imul rax, [rdi + value]
+        }
+        EMIT(e, 0xC7, 0x02);                        // mov dword [rdx], TYPE_INT
+        emit_u32(e, TYPE_INT);
+        EMIT(e, 0x48, 0x89, 0x42, VALUE_AT(0));     // mov [rdx + value], rax
+        return;
+    }
+
+    if (op == OP_DIVIDE) {
+        EMIT(e, 0x66, 0x0F, 0x57, 0xC9);            // xorpd xmm1, xmm1
+        EMIT(e, 0x66, 0x0F, 0x2E, 0x4F, VALUE_AT(0)); // ucomisd xmm1, [rdi + value]
+        emit_side_exit(e, JE, ip);                  // division by zero is reported by the interpreter
+    }
+    EMIT(e, 0xF2, 0x0F, 0x10, 0x46, VALUE_AT(0));   // movsd xmm0, [rsi + value]
+    switch (op) {
+        case OP_ADD:      EMIT(e, 0xF2, 0x0F, 0x58, 0x47, VALUE_AT(0)); break; // addsd xmm0, [rdi + value]
+        case OP_SUBTRACT: EMIT(e, 0xF2, 0x0F, 0x5C, 0x47, VALUE_AT(0)); break; // subsd xmm0, [rdi + value]
+        case OP_MULTIPLY: EMIT(e, 0xF2, 0x0F, 0x59, 0x47, VALUE_AT(0)); break; // mulsd xmm0, [rdi + value]
+        default:          EMIT(e, 0xF2, 0x0F, 0x5E, 0x47, VALUE_AT(0)); break; // divsd xmm0, [rdi + value]
+    }
+    EMIT(e, 0xC7, 0x02);                            // mov dword [rdx], TYPE_FLOAT
+    emit_u32(e, TYPE_FLOAT);
+    EMIT(e, 0xF2, 0x0F, 0x11, 0x42, VALUE_AT(0));   // movsd [rdx + value], xmm0
+}
+
+#endif
+
+#define STACK_AT(n) ((uint8_t)(-(n) * (int)sizeof(PrismValue)))
+
+static void emit_trace_step(Emitter* e, const CodeChunk* chunk, const TraceStep* step) {
+    const OpCode* code = chunk->code;
+    int ip = step->ip;
+    OpCode op = arith_kind(step->op);
+
+    switch (op) {
+        case OP_JUMP:
+            // The trace already continues at the target
+            break;
+
+        case OP_JUMP_IF_FALSE:
+            emit_call(e, (uint64_t)(uintptr_t)jit_pop_falsey);
+            if (step->taken) {
+                emit_side_exit(e, JE, ip + 3);
+            } else {
+                emit_side_exit(e, JNE, jump_target(code, ip));
+            }
+            break;
+
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            if (!can_specialize(op, step->a, step->b)) {
+                emit_arith_helper(e, op);
+                break;
+            }
+            EMIT(e, 0x49, 0x8D, 0x75, STACK_AT(2)); // lea rsi, [r13 - 2 values]
+            EMIT(e, 0x49, 0x8D, 0x7D, STACK_AT(1)); // lea rdi, [r13 - 1 value]
+            EMIT(e, 0x48, 0x89, 0xF2);              // mov rdx, rsi
+            emit_typed_arith(e, op, step->a, ip);
+            EMIT(e, 0x49, 0x83, 0xED, sizeof(PrismValue)); // sub r13, sizeof(PrismValue)
+            break;
+
+        case OP_ADD_CONST: {
+            const PrismValue* constant = &chunk->constants[code[ip + 1]];
+            if (!can_specialize(OP_ADD, step->a, step->b)) {
+                emit_add_const_helper(e, constant);
+                break;
+            }
+            EMIT(e, 0x49, 0x8D, 0x75, STACK_AT(1)); // lea rsi, [r13 - 1 value]
+            EMIT(e, 0x48, 0xBF);                    // mov rdi, &constant
+            emit_u64(e, (uint64_t)(uintptr_t)constant);
+            EMIT(e, 0x48, 0x89, 0xF2);              // mov rdx, rsi
+            emit_typed_arith(e, OP_ADD, step->a, ip);
+            break;
+        }
+
+        case OP_ADD_LOCALS:
+            if (!can_specialize(OP_ADD, step->a, step->b)) {
+                emit_add_locals_helper(e, code[ip + 1], code[ip + 2]);
+                break;
+            }
+            EMIT(e, 0x49, 0x8D, 0xB4, 0x24);        // lea rsi, [r12 + a * size]
+            emit_u32(e, (uint32_t)(code[ip + 1] * sizeof(PrismValue)));
+            EMIT(e, 0x49, 0x8D, 0xBC, 0x24);        // lea rdi, [r12 + b * size]
+            emit_u32(e, (uint32_t)(code[ip + 2] * sizeof(PrismValue)));
+            EMIT(e, 0x4C, 0x89, 0xEA);              // mov rdx, r13
+            emit_typed_arith(e, OP_ADD, step->a, ip);
+            EMIT(e, 0x49, 0x83, 0xC5, sizeof(PrismValue)); // add r13, sizeof(PrismValue)
+            break;
+
+        default:
+            // The trace ends at calls and returns
+            if (!emit_common_op(e, chunk, ip)) emit_exit(e, ip);
+            break;
+    }
+}
+
+// Appends the code to the cache's newest block, flipping it writable only
+// while the bytes are copied in. Frees the emitter either way.
+static uint8_t* cache_install(TraceCache* cache, Emitter* e) {
+    TraceBlock* block = cache->blocks;
+    uint8_t* memory = NULL;
+
+    if (block && block->size - block->used >= e->count &&
+        mprotect(block->code, block->size, PROT_READ | PROT_WRITE) == 0) {
+        memory = block->code + block->used;
+        memcpy(memory, e->bytes, e->count);
+        block->used += (e->count + 15) & ~(size_t)15;
+        if (mprotect(block->code, block->size, PROT_READ | PROT_EXEC) != 0) memory = NULL;
+
+        prism_free(e->bytes);
+        prism_free(e->patches);
+        return memory;
+    }
+
+    size_t size = TRACE_BLOCK_SIZE;
+    while (size < e->count) size *= 2;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        memcpy(code, e->bytes, e->count);
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, size);
+            code = MAP_FAILED;
+        }
+    }
+
+    size_t used = e->count;
+    prism_free(e->bytes);
+    prism_free(e->patches);
+    if (code == MAP_FAILED) return NULL;
+
+    block = prism_alloc(sizeof(TraceBlock));
+    block->code = code;
+    block->size = size;
+    block->used = (used + 15) & ~(size_t)15;
+    block->next = cache->blocks;
+    cache->blocks = block;
+    return block->code;
+}
+
+static Trace* trace_compile(TraceRecorder* recorder) {
+    const CodeChunk* chunk = recorder->function->chunk;
+
+    Emitter e;
+    emitter_init(&e, 64 + recorder->count * 64);
+    emit_prologue(&e);
+
+    size_t entry = e.count;
+    for (int i = 0; i < recorder->count; i++) {
+        emit_trace_step(&e, chunk, &recorder->steps[i]);
+    }
+
+    // Side exits share one stub per instruction they resume at
+    size_t error_exit = e.count;
+    emit_exit(&e, -1);
+
+    size_t* stubs = prism_alloc(sizeof(size_t) * (e.patch_count + 1));
+    for (int i = 0; i < e.patch_count; i++) {
+        JitPatch* patch = &e.patches[i];
+        size_t target = error_exit;
+
+        if (patch->target >= 0) {
+            target = 0;
+            for (int j = 0; j < i && !target; j++) {
+                if (e.patches[j].target == patch->target) target = stubs[j];
+            }
+            if (!target) {
+                target = e.count;
+                emit_exit(&e, patch->target);
+            }
+        }
+
+        stubs[i] = target;
+        int32_t rel = (int32_t)(target - (patch->at + 4));
+        memcpy(e.bytes + patch->at, &rel, 4);
+    }
+    prism_free(stubs);
+
+    uint8_t* memory = cache_install(recorder->function->traces, &e);
+    if (!memory) return NULL;
+
+    Trace* trace = prism_alloc(sizeof(Trace));
+    trace->code = memory;
+    trace->entry = entry;
+    return trace;
+}
+
+bool trace_is_hot(FunctionProto* function, int ip) {
+    TraceCache* cache = function->traces;
+    if (!cache) {
+        int count = function->chunk->count;
+        cache = prism_alloc(sizeof(TraceCache));
+        cache->hot_counts = prism_alloc(sizeof(int) * count);
+        cache->traces = prism_alloc(sizeof(Trace*) * count);
+        function->traces = cache;
+    }
+
+    int* count = &cache->hot_counts[ip];
+    return *count >= 0 && ++*count == TRACE_THRESHOLD;
+}
+
+Trace* trace_find(FunctionProto* function, int ip) {
+    return function->traces ? function->traces->traces[ip] : NULL;
+}
+
+TraceRecorder* trace_start(FunctionProto* function, int ip) {
+    TraceRecorder* recorder = prism_alloc(sizeof(TraceRecorder));
+    recorder->function = function;
+    recorder->start = ip;
+    recorder->capacity = 32;
+    recorder->steps = prism_alloc(sizeof(TraceStep) * recorder->capacity);
+    return recorder;
+}
+
+void trace_abort(TraceRecorder* recorder) {
+    recorder->function->traces->hot_counts[recorder->start] = -1;
+    prism_free(recorder->steps);
+    prism_free(recorder);
+}
+
+static void trace_finish(TraceRecorder* recorder) {
+    // Short traces cost more to enter and leave than they save
+    Trace* trace = recorder->count >= TRACE_MIN_LENGTH ? trace_compile(recorder) : NULL;
+    if (!trace) {
+        trace_abort(recorder);
+        return;
+    }
+
+    recorder->function->traces->traces[recorder->start] = trace;
+
+    prism_free(recorder->steps);
+    prism_free(recorder);
+}
+
+bool trace_record(TraceRecorder* recorder, VM* vm, PrismValue* slots, int ip) {
+    const CodeChunk* chunk = recorder->function->chunk;
+    OpCode op = chunk->code[ip];
+
+    if (recorder->count >= TRACE_MAX_LENGTH) {
+        trace_abort(recorder);
+        return false;
+    }
+
+    if (recorder->count >= recorder->capacity) {
+        recorder->capacity *= 2;
+        recorder->steps = prism_realloc(recorder->steps, sizeof(TraceStep) * recorder->capacity);
+    }
+
+    TraceStep* step = &recorder->steps[recorder->count++];
+    step->ip = ip;
+    step->op = op;
+    step->a = TYPE_NONE;
+    step->b = TYPE_NONE;
+    step->taken = false;
+
+    const PrismValue* top = &vm->stack[vm->stack_top];
+    switch (arith_kind(op)) {
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            step->a = VALUE_TYPE(top[-2]);
+            step->b = VALUE_TYPE(top[-1]);
+            break;
+
+        case OP_ADD_CONST:
+            step->a = VALUE_TYPE(top[-1]);
+            step->b = VALUE_TYPE(chunk->constants[chunk->code[ip + 1]]);
+            break;
+
+        case OP_ADD_LOCALS:
+            step->a = VALUE_TYPE(slots[chunk->code[ip + 1]]);
+            step->b = VALUE_TYPE(slots[chunk->code[ip + 2]]);
+            break;
+
+        case OP_JUMP_IF_FALSE:
+            step->taken = is_falsey(top[-1]);
+            break;
+
+        case OP_CALL:
+        case OP_CALL_DISCARD:
+        case OP_TAIL_CALL:
+        case OP_RESUME:
+        case OP_YIELD:
+        case OP_RETURN:
+        case OP_RETURN_NIL:
+        case OP_END:
+            trace_finish(recorder);
+            return false;
+
+        default:
+            break;
+    }
+    return true;
+}
+
+int trace_enter(Trace* trace, VM* vm, PrismValue* slots) {
+    JitFunction function = (JitFunction)(void*)trace->code;
+    return function(vm, slots, trace->code + trace->entry);
+}
+
+void trace_free_all(FunctionProto* function) {
+    TraceCache* cache = function->traces;
+    if (!cache) return;
+
+    for (int i = 0; i < function->chunk->count; i++) {
+        prism_free(cache->traces[i]);
+    }
+
+    TraceBlock* block = cache->blocks;
+    while (block) {
+        TraceBlock* next = block->next;
+        munmap(block->code, block->size);
+        prism_free(block);
+        block = next;
+    }
+
+    prism_free(cache->hot_counts);
+    prism_free(cache->traces);
+    prism_free(cache);
+    function->traces = NULL;
+}
+
+#else
+
+JitCode* jit_compile(FunctionProto* function) {
+    (void)function;
+    return NULL;
+}
+
+void jit_free(JitCode* jit) {
+    (void)jit;
+}
+
+int jit_enter(JitCode* jit, VM* vm, PrismValue* slots, int ip) {
+    (void)jit;
+    (void)vm;
+    (void)slots;
+    return ip;
+}
+
+bool trace_is_hot(FunctionProto* function, int ip) {
+    (void)function;
+    (void)ip;
+    return false;
+}
+
+Trace* trace_find(FunctionProto* function, int ip) {
+    (void)function;
+    (void)ip;
+    return NULL;
+}
+
+TraceRecorder* trace_start(FunctionProto* function, int ip) {
+    (void)function;
+    (void)ip;
+    return NULL;
+}
+
+void trace_abort(TraceRecorder* recorder) {
+    (void)recorder;
+}
+
+bool trace_record(TraceRecorder* recorder, VM* vm, PrismValue* slots, int ip) {
+    (void)recorder;
+    (void)vm;
+    (void)slots;
+    (void)ip;
+    return false;
+}
+
+int trace_enter(Trace* trace, VM* vm, PrismValue* slots) {
+    (void)trace;
+    (void)vm;
+    (void)slots;
+    return -1;
+}
+
+void trace_free_all(FunctionProto* function) {
+    (void)function;
+}
+
+#endif
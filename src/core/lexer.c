@@ -1,18 +1,46 @@
 #include "../../include/core/lexer.h"
+#include "../../include/core/scan.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
+#include "../../include/common/arena.h"
 #include <string.h>
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #define INITIAL_TOKEN_CAPACITY 64
 
-static bool is_alpha(char c) {
-    return isalpha(c) || c == '_';
+static bool has_class(char c, uint8_t class) {
+    return char_class[(uint8_t)c] & class;
 }
 
-static bool is_alphanumeric(char c) {
-    return isalnum(c) || c == '_';
+/* Keywords, placed by a perfect hash of their first and last characters
+ * and length. A candidate is checked with one memcmp; the empty slots
+ * have length 0 and never match. To add a keyword, find a hash that
+ * keeps every keyword in a slot of its own. */
+#define KEYWORD_SLOTS 8
+
+static size_t keyword_hash(const char* text, size_t length) {
+    return ((uint8_t)text[0] + (uint8_t)text[length - 1] + length) & (KEYWORD_SLOTS - 1);
+}
+
+static const struct {
+    const char* word;
+    size_t length;
+    TokenType type;
+} keywords[KEYWORD_SLOTS] = {
+    [0] = { "exposed", 7, TOKEN_EXPOSED },
+    [2] = { "prism", 5, TOKEN_PRISM },
+    [3] = { "run", 3, TOKEN_RUN },
+    [4] = { "function", 8, TOKEN_FUNCTION },
+    [5] = { "internal", 8, TOKEN_INTERNAL },
+    [7] = { "None", 4, TOKEN_NONE }
+};
+
+// Gives one of the token arrays room for the list's capacity
+static void* token_array(Lexer* lexer, void* items, size_t item_size, int old_capacity) {
+    size_t size = item_size * lexer->tokens.capacity;
+    if (lexer->arena) return arena_grow(lexer->arena, items, item_size * old_capacity, size);
+    return prism_realloc(items, size);
 }
 
 Lexer* lexer_create(const char* source, const char* filename) {
@@ -21,42 +49,91 @@ Lexer* lexer_create(const char* source, const char* filename) {
     lexer->filename = filename;
     lexer->start = 0;
     lexer->current = 0;
-    lexer->line = 1;
-    lexer->column = 0;
-    lexer->token_count = 0;
-    lexer->token_capacity = INITIAL_TOKEN_CAPACITY;
-    lexer->tokens = prism_alloc(sizeof(Token) * lexer->token_capacity);
+    lexer->scan = scan_kernels();
+    lexer->arena = arena_current();
+    
+    TokenList* tokens = &lexer->tokens;
+    tokens->source = source;
+    tokens->capacity = INITIAL_TOKEN_CAPACITY;
+    tokens->types = token_array(lexer, NULL, sizeof(uint8_t), 0);
+    tokens->starts = token_array(lexer, NULL, sizeof(uint32_t), 0);
+    tokens->lengths = token_array(lexer, NULL, sizeof(uint32_t), 0);
     return lexer;
 }
 
 void lexer_free(Lexer* lexer) {
     if (!lexer) return;
     
-    for (int i = 0; i < lexer->token_count; i++) {
-        if (lexer->tokens[i].lexeme) prism_free(lexer->tokens[i].lexeme);
+    if (!lexer->arena) {
+        prism_free(lexer->tokens.types);
+        prism_free(lexer->tokens.starts);
+        prism_free(lexer->tokens.lengths);
     }
-    
-    prism_free(lexer->tokens);
+    prism_free(lexer->tokens.line_starts);
     prism_free(lexer);
 }
 
 static void add_token(Lexer* lexer, TokenType type) {
-    if (lexer->token_count >= lexer->token_capacity) {
-        lexer->token_capacity *= 2;
-        lexer->tokens = prism_realloc(lexer->tokens, sizeof(Token) * lexer->token_capacity);
+    TokenList* tokens = &lexer->tokens;
+    if (tokens->count >= tokens->capacity) {
+        int old_capacity = tokens->capacity;
+        tokens->capacity *= 2;
+        tokens->types = token_array(lexer, tokens->types, sizeof(uint8_t), old_capacity);
+        tokens->starts = token_array(lexer, tokens->starts, sizeof(uint32_t), old_capacity);
+        tokens->lengths = token_array(lexer, tokens->lengths, sizeof(uint32_t), old_capacity);
     }
     
-    int length = lexer->current - lexer->start;
-    char* lexeme = prism_alloc(length + 1);
-    strncpy(lexeme, lexer->source + lexer->start, length);
-    lexeme[length] = '\0';
+    tokens->types[tokens->count] = (uint8_t)type;
+    tokens->starts[tokens->count] = (uint32_t)lexer->start;
+    tokens->lengths[tokens->count] = (uint32_t)(lexer->current - lexer->start);
+    tokens->count++;
+}
+
+// Finds the start of every line in one pass over the source
+static void index_lines(TokenList* tokens) {
+    size_t (*line)(const char* p) = scan_kernels()->line;
+    int capacity = 64;
+    tokens->line_starts = prism_alloc(sizeof(uint32_t) * capacity);
+    tokens->line_starts[0] = 0;
+    tokens->line_count = 1;
     
-    lexer->tokens[lexer->token_count].type = type;
-    lexer->tokens[lexer->token_count].lexeme = lexeme;
-    lexer->tokens[lexer->token_count].line = lexer->line;
-    lexer->tokens[lexer->token_count].column = lexer->column - length;
+    const char* p = tokens->source;
+    for (;;) {
+        p += line(p);
+        if (*p == '\0') break;
+        p++;
+        
+        if (tokens->line_count >= capacity) {
+            capacity *= 2;
+            tokens->line_starts = prism_realloc(tokens->line_starts, sizeof(uint32_t) * capacity);
+        }
+        tokens->line_starts[tokens->line_count++] = (uint32_t)(p - tokens->source);
+    }
+}
+
+void token_position(TokenList* tokens, uint32_t offset, int* line, int* column) {
+    if (!tokens->line_starts) index_lines(tokens);
+    
+    // The last line starting at or before offset
+    int low = 0;
+    int high = tokens->line_count - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (tokens->line_starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
     
-    lexer->token_count++;
+    *line = low + 1;
+    *column = (int)(offset - tokens->line_starts[low]) + 1;
+}
+
+static void error_at(Lexer* lexer, int offset, const char* message) {
+    int line, column;
+    token_position(&lexer->tokens, (uint32_t)offset, &line, &column);
+    prism_error_at(lexer->filename, line, column, "%s", message);
 }
 
 static bool is_at_end(Lexer* lexer) {
@@ -65,7 +142,6 @@ static bool is_at_end(Lexer* lexer) {
 
 static char advance(Lexer* lexer) {
     lexer->current++;
-    lexer->column++;
     return lexer->source[lexer->current - 1];
 }
 
@@ -84,10 +160,41 @@ static bool match(Lexer* lexer, char expected) {
     if (lexer->source[lexer->current] != expected) return false;
     
     lexer->current++;
-    lexer->column++;
     return true;
 }
 
+static void skip(Lexer* lexer, size_t length) {
+    lexer->current += (int)length;
+}
+
+// Skips the run of characters in the class
+static void skip_class(Lexer* lexer, uint8_t class) {
+    int current = lexer->current;
+    while (has_class(lexer->source[current], class)) current++;
+    lexer->current = current;
+}
+
+// Most runs are short, and cheaper to step through here than to hand to a
+// kernel, which takes over once a run has gone on for SHORT_RUN characters.
+// Past that the vector kernels win: long comments, string bodies and runs
+// of indentation.
+#define SHORT_RUN 16
+
+static size_t run_length(const char* p, uint8_t class, size_t (*kernel)(const char* p)) {
+    for (size_t i = 0; i < SHORT_RUN; i++) {
+        if (!has_class(p[i], class)) return i;
+    }
+    return SHORT_RUN + kernel(p + SHORT_RUN);
+}
+
+// The same for a run ending at the first end character or the NUL
+static size_t run_until(const char* p, char end, size_t (*kernel)(const char* p)) {
+    for (size_t i = 0; i < SHORT_RUN; i++) {
+        if (p[i] == end || p[i] == '\0') return i;
+    }
+    return SHORT_RUN + kernel(p + SHORT_RUN);
+}
+
 static void skip_whitespace(Lexer* lexer) {
     for (;;) {
         char c = peek(lexer);
@@ -95,19 +202,15 @@ static void skip_whitespace(Lexer* lexer) {
             case ' ':
             case '\t':
             case '\r':
-                advance(lexer);
+                skip(lexer, run_length(lexer->source + lexer->current, CHAR_SPACE, lexer->scan->blanks));
                 break;
             case '\n':
-                lexer->line++;
-                lexer->column = 0;
                 advance(lexer);
                 break;
             case '!':
                 if (peek_next(lexer) == '!') {
                     // Comment until end of line
-                    while (peek(lexer) != '\n' && !is_at_end(lexer)) {
-                        advance(lexer);
-                    }
+                    skip(lexer, run_until(lexer->source + lexer->current, '\n', lexer->scan->line));
                 } else {
                     return;
                 }
@@ -119,42 +222,30 @@ static void skip_whitespace(Lexer* lexer) {
 }
 
 static void scan_identifier(Lexer* lexer) {
-    while (is_alphanumeric(peek(lexer))) {
-        advance(lexer);
-    }
+    skip(lexer, run_length(lexer->source + lexer->current, CHAR_IDENT, lexer->scan->identifier));
     
     // Check for keywords
-    int length = lexer->current - lexer->start;
-    char* text = prism_alloc(length + 1);
-    strncpy(text, lexer->source + lexer->start, length);
-    text[length] = '\0';
-    
+    const char* text = lexer->source + lexer->start;
+    size_t length = lexer->current - lexer->start;
+    size_t slot = keyword_hash(text, length);
     TokenType type = TOKEN_IDENTIFIER;
     
-    if (strcmp(text, "function") == 0) type = TOKEN_FUNCTION;
-    else if (strcmp(text, "prism") == 0) type = TOKEN_PRISM;
-    else if (strcmp(text, "internal") == 0) type = TOKEN_INTERNAL;
-    else if (strcmp(text, "exposed") == 0) type = TOKEN_EXPOSED;
-    else if (strcmp(text, "run") == 0) type = TOKEN_RUN;
-    else if (strcmp(text, "None") == 0) type = TOKEN_NONE;
+    if (keywords[slot].length == length && memcmp(keywords[slot].word, text, length) == 0) {
+        type = keywords[slot].type;
+    }
     
-    prism_free(text);
     add_token(lexer, type);
 }
 
 static void scan_number(Lexer* lexer) {
-    while (isdigit(peek(lexer))) {
-        advance(lexer);
-    }
+    skip_class(lexer, CHAR_DIGIT);
     
     // Look for decimal
-    if (peek(lexer) == '.' && isdigit(peek_next(lexer))) {
+    if (peek(lexer) == '.' && has_class(peek_next(lexer), CHAR_DIGIT)) {
         // Consume the .
         advance(lexer);
         
-        while (isdigit(peek(lexer))) {
-            advance(lexer);
-        }
+        skip_class(lexer, CHAR_DIGIT);
         
         add_token(lexer, TOKEN_FLOAT);
     } else {
@@ -163,30 +254,16 @@ static void scan_number(Lexer* lexer) {
 }
 
 static void scan_string(Lexer* lexer) {
-    while (peek(lexer) != '"' && !is_at_end(lexer)) {
-        if (peek(lexer) == '\n') {
-            lexer->line++;
-            lexer->column = 0;
-        }
-        advance(lexer);
-    }
+    skip(lexer, run_until(lexer->source + lexer->current, '"', lexer->scan->string));
     
     if (is_at_end(lexer)) {
-        prism_error_at(lexer->filename, lexer->line, lexer->column, "Unterminated string");
+        error_at(lexer, lexer->start, "Unterminated string");
         return;
     }
     
     // Consume closing "
     advance(lexer);
-    
-    // Trim surrounding quotes
-    int length = lexer->current - lexer->start - 2;
-    char* value = prism_alloc(length + 1);
-    strncpy(value, lexer->source + lexer->start + 1, length);
-    value[length] = '\0';
-    
     add_token(lexer, TOKEN_STRING);
-    prism_free(value);
 }
 
 static void scan_token(Lexer* lexer) {
@@ -205,7 +282,7 @@ static void scan_token(Lexer* lexer) {
             if (match(lexer, '>')) {
                 add_token(lexer, TOKEN_ARROW);
             } else {
-                prism_error_at(lexer->filename, lexer->line, lexer->column, "Unexpected character");
+                error_at(lexer, lexer->current - 1, "Unexpected character");
             }
             break;
             
@@ -213,7 +290,7 @@ static void scan_token(Lexer* lexer) {
             if (match(lexer, '>')) {
                 add_token(lexer, TOKEN_RETURN_TYPE);
             } else {
-                prism_error_at(lexer->filename, lexer->line, lexer->column, "Unexpected character");
+                error_at(lexer, lexer->current - 1, "Unexpected character");
             }
             break;
             
@@ -222,12 +299,12 @@ static void scan_token(Lexer* lexer) {
             break;
             
         default:
-            if (isdigit(c)) {
+            if (has_class(c, CHAR_DIGIT)) {
                 scan_number(lexer);
-            } else if (is_alpha(c)) {
+            } else if (has_class(c, CHAR_ALPHA)) {
                 scan_identifier(lexer);
             } else {
-                prism_error_at(lexer->filename, lexer->line, lexer->column, "Unexpected character");
+                error_at(lexer, lexer->current - 1, "Unexpected character");
             }
             break;
     }
@@ -235,22 +312,18 @@ static void scan_token(Lexer* lexer) {
 
 void lexer_scan_tokens(Lexer* lexer) {
     while (!is_at_end(lexer)) {
-        lexer->start = lexer->current;
         skip_whitespace(lexer);
+        lexer->start = lexer->current;
         if (!is_at_end(lexer)) {
             scan_token(lexer);
         }
     }
     
     // Add EOF token
-    lexer->tokens[lexer->token_count].type = TOKEN_EOF;
-    lexer->tokens[lexer->token_count].lexeme = NULL;
-    lexer->tokens[lexer->token_count].line = lexer->line;
-    lexer->tokens[lexer->token_count].column = lexer->column;
-    lexer->token_count++;
+    lexer->start = lexer->current;
+    add_token(lexer, TOKEN_EOF);
 }
 
-Token* lexer_get_tokens(Lexer* lexer, int* count) {
-    *count = lexer->token_count;
-    return lexer->tokens;
+TokenList* lexer_get_tokens(Lexer* lexer) {
+    return &lexer->tokens;
 }
\ No newline at end of file
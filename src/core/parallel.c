@@ -0,0 +1,248 @@
+#include "../../include/core/parallel.h"
+#include "../../include/core/scheduler.h"
+#include "../../include/core/jit.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/common/rope.h"
+#include <string.h>
+
+typedef struct PrismTask {
+    SchedulerTask task;
+
+    // What the task runs on: a private program copy and globals snapshot,
+    // and the snapshot's own copies of the strings and boxed ints it
+    // started with
+    CodeGenerator* program;
+    PrismValue* globals;
+    int global_count;
+    void** copies;
+    int copy_count;
+    int function_index;
+    bool use_jit;
+    bool use_tracing;
+
+    // Set by the worker. A string or boxed int result is copied out of the
+    // task's heap.
+    bool ok;
+    PrismValue result;
+} PrismTask;
+
+static void* duplicate(const void* data, size_t size) {
+    void* copy = prism_alloc(size > 0 ? size : 1);
+    if (size > 0) memcpy(copy, data, size);
+    return copy;
+}
+
+/* Copies everything the VM writes to while running: the code, which
+ * quickening rewrites, and the prototypes, which hold call counts and
+ * compiled code. Names, string constants and natives are only read, so the
+ * copy shares them with the original. */
+static CodeGenerator* copy_program(CodeGenerator* source) {
+    CodeGenerator* copy = duplicate(source, sizeof(CodeGenerator));
+    int count = source->chunk_count;
+
+    copy->chunks = prism_alloc(sizeof(CodeChunk) * count);
+    copy->functions = prism_alloc(sizeof(FunctionProto*) * count);
+
+    for (int i = 0; i < count; i++) {
+        FunctionProto* function = duplicate(source->functions[i], sizeof(FunctionProto));
+        function->chunk = &copy->chunks[i];
+        function->call_count = 0;
+        function->jit = NULL;
+        function->traces = NULL;
+        copy->functions[i] = function;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const CodeChunk* from = &source->chunks[i];
+        CodeChunk* chunk = &copy->chunks[i];
+        chunk->code = duplicate(from->code, sizeof(OpCode) * from->count);
+        chunk->lines = duplicate(from->lines, sizeof(int) * from->count);
+        chunk->count = from->count;
+        chunk->capacity = from->count;
+        chunk->constants = duplicate(from->constants, sizeof(PrismValue) * from->constant_count);
+        chunk->constant_count = from->constant_count;
+        chunk->constant_capacity = from->constant_count;
+
+        // Calls go to the copied bodies
+        for (int j = 0; j < chunk->constant_count; j++) {
+            PrismValue value = chunk->constants[j];
+            if (IS_FUNCTION(value) || VALUE_TYPE(value) == TYPE_PRISM) {
+                FunctionProto* function = AS_PTR(value);
+                chunk->constants[j] = PTR_VAL(VALUE_TYPE(value), copy->functions[function->chunk_index]);
+            }
+        }
+    }
+    return copy;
+}
+
+static void free_program_copy(CodeGenerator* copy) {
+    for (int i = 0; i < copy->chunk_count; i++) {
+        prism_free(copy->chunks[i].code);
+        prism_free(copy->chunks[i].lines);
+        prism_free(copy->chunks[i].constants);
+
+        jit_free(copy->functions[i]->jit);
+        trace_free_all(copy->functions[i]);
+        prism_free(copy->functions[i]);
+    }
+    prism_free(copy->functions);
+    prism_free(copy->chunks);
+    prism_free(copy);
+}
+
+static bool is_heap_string(PrismValue* value) {
+    return IS_STRING(*value) && !IS_SMALL_STRING(*value) && AS_PTR(*value);
+}
+
+// A boxed int's box, which may belong to a collector
+static bool is_boxed_int(PrismValue* value) {
+#ifdef PRISM_NAN_BOXING
+    return IS_BIGINT(*value);
+#else
+    (void)value;
+    return false;
+#endif
+}
+
+// Points the value at a copy of what it points to that no collector owns,
+// freed with prism_free
+static void* copy_out(PrismValue* value) {
+    if (is_heap_string(value)) {
+        char* copy = strdup(AS_STRING(*value));
+        *value = STRING_VAL(copy);
+        return copy;
+    }
+#ifdef PRISM_NAN_BOXING
+    if (is_boxed_int(value)) {
+        int64_t* copy = duplicate(AS_PTR(*value), sizeof(int64_t));
+        *value = BIGINT_VAL(copy);
+        return copy;
+    }
+#endif
+    return NULL;
+}
+
+/* The spawning VM's collector may move or free any string or boxed int it
+ * made, so the task gets copies of those in its snapshot, with ropes
+ * flattened first. Flattening writes to a rope, so it happens here, on the
+ * thread that built it. */
+static void copy_strings(PrismTask* task) {
+    rope_flatten_args(task->globals, task->global_count);
+    task->copies = prism_alloc(sizeof(void*) * (task->global_count + 1));
+    for (int i = 0; i < task->global_count; i++) {
+        void* copy = copy_out(&task->globals[i]);
+        if (copy) task->copies[task->copy_count++] = copy;
+    }
+}
+
+static void free_task(PrismTask* task) {
+    free_program_copy(task->program);
+    for (int i = 0; i < task->copy_count; i++) {
+        prism_free(task->copies[i]);
+    }
+    prism_free(task->copies);
+    prism_free(task->globals);
+    if (task->ok && (is_heap_string(&task->result) || is_boxed_int(&task->result))) {
+        prism_free(AS_PTR(task->result));
+    }
+    prism_free(task);
+}
+
+static void run_prism_task(void* arg) {
+    PrismTask* task = arg;
+
+    // A failure here is reported by the inline rerun instead
+    prism_set_quiet_errors(true);
+
+    VM* vm = vm_create();
+    vm->code_gen = task->program;
+    vm->globals = task->globals;
+    vm->global_count = task->global_count;
+    vm->use_jit = task->use_jit;
+    vm->use_tracing = task->use_tracing;
+
+    InterpretResult result = vm_run_prism(vm, task->program->functions[task->function_index]);
+    task->ok = result == INTERPRET_OK && vm->error.type == ERROR_NONE;
+    if (task->ok) {
+        task->result = vm->stack[0];
+        copy_out(&task->result);
+    }
+
+    // The program and globals belong to the task
+    vm->code_gen = NULL;
+    vm->globals = NULL;
+    vm_free(vm);
+    prism_set_quiet_errors(false);
+}
+
+void parallel_spawn(VM* vm, FunctionProto* prism) {
+    if (!vm->use_parallel) return;
+
+    if (!vm->scheduler) {
+        vm->scheduler = scheduler_create(0);
+        if (!vm->scheduler) {
+            // Prisms still run, just inline
+            vm->use_parallel = false;
+            return;
+        }
+    }
+    if (!vm->tasks) {
+        vm->tasks = prism_alloc(sizeof(PrismTask*) * vm->code_gen->chunk_count);
+    }
+    if (vm->tasks[prism->chunk_index]) return;
+
+    PrismTask* task = prism_alloc(sizeof(PrismTask));
+    task->task.run = run_prism_task;
+    task->task.arg = task;
+    task->program = copy_program(vm->code_gen);
+    task->globals = duplicate(vm->globals, sizeof(PrismValue) * vm->global_count);
+    task->global_count = vm->global_count;
+    copy_strings(task);
+    task->function_index = prism->chunk_index;
+    task->use_jit = vm->use_jit;
+    task->use_tracing = vm->use_tracing;
+
+    vm->tasks[prism->chunk_index] = task;
+    scheduler_spawn(vm->scheduler, &task->task);
+}
+
+bool parallel_join(VM* vm, FunctionProto* prism, PrismValue* result) {
+    PrismTask* task = vm->tasks ? vm->tasks[prism->chunk_index] : NULL;
+    if (!task) return false;
+
+    scheduler_join(vm->scheduler, &task->task);
+    vm->tasks[prism->chunk_index] = NULL;
+
+    bool ok = task->ok;
+    if (ok) {
+        *result = task->result;
+        if (is_heap_string(result)) *result = prism_string_value(AS_STRING(*result), strlen(AS_STRING(*result)));
+        if (is_boxed_int(result)) *result = INT_VAL(AS_INT(*result));
+
+        // A function value from the copy stands for the original
+        if (IS_FUNCTION(*result) || VALUE_TYPE(*result) == TYPE_PRISM) {
+            FunctionProto* function = AS_PTR(*result);
+            if (task->program->functions[function->chunk_index] == function) {
+                *result = PTR_VAL(VALUE_TYPE(*result), vm->code_gen->functions[function->chunk_index]);
+            }
+        }
+    }
+
+    free_task(task);
+    return ok;
+}
+
+void parallel_finish(VM* vm) {
+    if (!vm->tasks) return;
+
+    for (int i = 0; i < vm->code_gen->chunk_count; i++) {
+        PrismTask* task = vm->tasks[i];
+        if (!task) continue;
+
+        scheduler_join(vm->scheduler, &task->task);
+        free_task(task);
+    }
+    prism_free(vm->tasks);
+    vm->tasks = NULL;
+}
@@ -1,40 +1,91 @@
 #include "../../include/core/parser.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
+#include "../../include/common/intern.h"
 #include <string.h>
 
-Parser* parser_create(Token* tokens, int token_count) {
+Parser* parser_create(TokenList* tokens) {
     Parser* parser = prism_alloc(sizeof(Parser));
     parser->tokens = tokens;
-    parser->token_count = token_count;
     parser->current = 0;
     return parser;
 }
 
 void parser_free(Parser* parser) {
-    if (parser) prism_free(parser);
+    if (!parser) return;
+    
+    prism_free(parser->args);
+    prism_free(parser->params);
+    prism_free(parser->param_types);
+    prism_free(parser->body);
+    prism_free(parser);
+}
+
+// Makes room for one more item on a list stack
+static void* reserve(void* items, int count, int* capacity, size_t item_size) {
+    if (count < *capacity) return items;
+    *capacity = *capacity ? *capacity * 2 : 16;
+    return prism_realloc(items, item_size * *capacity);
+}
+
+static int peek(Parser* parser) {
+    return parser->current;
+}
+
+static int previous(Parser* parser) {
+    return parser->current - 1;
+}
+
+static TokenType token_type(Parser* parser, int token) {
+    return (TokenType)parser->tokens->types[token];
+}
+
+static const char* token_text(Parser* parser, int token) {
+    return parser->tokens->source + parser->tokens->starts[token];
+}
+
+// The token's text, interned
+static const char* token_name(Parser* parser, int token) {
+    return intern_string(token_text(parser, token), parser->tokens->lengths[token]);
+}
+
+static bool token_is(Parser* parser, int token, const char* word) {
+    size_t length = strlen(word);
+    return parser->tokens->lengths[token] == length && memcmp(token_text(parser, token), word, length) == 0;
 }
 
-static Token* peek(Parser* parser) {
-    return &parser->tokens[parser->current];
+// A NUL-terminated copy of a number's text, which in the source runs
+// straight on into the next token
+static const char* token_number(Parser* parser, int token, char* buffer, size_t size) {
+    size_t length = parser->tokens->lengths[token] < size - 1 ? parser->tokens->lengths[token] : size - 1;
+    memcpy(buffer, token_text(parser, token), length);
+    buffer[length] = '\0';
+    return buffer;
 }
 
-static Token* previous(Parser* parser) {
-    return &parser->tokens[parser->current - 1];
+// A string literal's value, interned: the text between the quotes
+static const char* token_string(Parser* parser, int token) {
+    return intern_string(token_text(parser, token) + 1, parser->tokens->lengths[token] - 2);
+}
+
+static void error_at(Parser* parser, int token, const char* message) {
+    int line, column;
+    token_position(parser->tokens, parser->tokens->starts[token], &line, &column);
+    prism_error_at(token_name(parser, token), line, column, "%s", message);
 }
 
 static bool is_at_end(Parser* parser) {
-    return peek(parser)->type == TOKEN_EOF;
+    return token_type(parser, peek(parser)) == TOKEN_EOF;
 }
 
-static Token* advance(Parser* parser) {
+static int advance(Parser* parser) {
     if (!is_at_end(parser)) parser->current++;
     return previous(parser);
 }
 
 static bool check(Parser* parser, TokenType type) {
     if (is_at_end(parser)) return false;
-    return peek(parser)->type == type;
+    return token_type(parser, peek(parser)) == type;
 }
 
 static bool match(Parser* parser, TokenType type) {
@@ -45,55 +96,50 @@ static bool match(Parser* parser, TokenType type) {
     return false;
 }
 
-static Token* consume(Parser* parser, TokenType type, const char* message) {
+static int consume(Parser* parser, TokenType type, const char* message) {
     if (check(parser, type)) {
         return advance(parser);
     }
     
-    Token* token = peek(parser);
-    prism_error_at(token->lexeme, token->line, token->column, "%s", message);
-    return token;
+    error_at(parser, peek(parser), message);
+    return peek(parser);
 }
 
 static PrismType parse_type(Parser* parser) {
-    Token* token = advance(parser);
+    int token = advance(parser);
     
-    if (strcmp(token->lexeme, "int") == 0) return TYPE_INT;
-    if (strcmp(token->lexeme, "float") == 0) return TYPE_FLOAT;
-    if (strcmp(token->lexeme, "bool") == 0) return TYPE_BOOL;
-    if (strcmp(token->lexeme, "string") == 0) return TYPE_STRING;
-    if (strcmp(token->lexeme, "None") == 0) return TYPE_NONE;
+    if (token_is(parser, token, "int")) return TYPE_INT;
+    if (token_is(parser, token, "float")) return TYPE_FLOAT;
+    if (token_is(parser, token, "bool")) return TYPE_BOOL;
+    if (token_is(parser, token, "string")) return TYPE_STRING;
+    if (token_is(parser, token, "None")) return TYPE_NONE;
     
-    prism_error_at(token->lexeme, token->line, token->column, "Unknown type");
+    error_at(parser, token, "Unknown type");
     return TYPE_NONE;
 }
 
 static Expr* parse_expression(Parser* parser);
 
 static Expr* parse_primary(Parser* parser) {
+    char digits[64];
+    
     if (match(parser, TOKEN_INTEGER)) {
-        PrismValue value;
-        value.type = TYPE_INT;
-        value.value.i = atoi(previous(parser)->lexeme);
+        PrismValue value = INT_VAL(atoi(token_number(parser, previous(parser), digits, sizeof(digits))));
         return ast_create_literal_expr(value);
     }
     
     if (match(parser, TOKEN_FLOAT)) {
-        PrismValue value;
-        value.type = TYPE_FLOAT;
-        value.value.f = atof(previous(parser)->lexeme);
+        PrismValue value = FLOAT_VAL(atof(token_number(parser, previous(parser), digits, sizeof(digits))));
         return ast_create_literal_expr(value);
     }
     
     if (match(parser, TOKEN_STRING)) {
-        PrismValue value;
-        value.type = TYPE_STRING;
-        value.value.s = strdup(previous(parser)->lexeme);
+        PrismValue value = STRING_VAL((char*)token_string(parser, previous(parser)));
         return ast_create_literal_expr(value);
     }
     
     if (match(parser, TOKEN_IDENTIFIER)) {
-        return ast_create_variable_expr(previous(parser)->lexeme);
+        return ast_create_variable_expr(token_name(parser, previous(parser)));
     }
     
     if (match(parser, TOKEN_LPAREN)) {
@@ -102,8 +148,7 @@ static Expr* parse_primary(Parser* parser) {
         return expr;
     }
     
-    Token* token = peek(parser);
-    prism_error_at(token->lexeme, token->line, token->column, "Expect expression");
+    error_at(parser, peek(parser), "Expect expression");
     return NULL;
 }
 
@@ -113,28 +158,25 @@ static Expr* parse_call(Parser* parser) {
     while (true) {
         if (match(parser, TOKEN_LPAREN)) {
             // Parse function call
-            Expr** args = NULL;
-            int arg_count = 0;
+            int base = parser->arg_count;
             
             if (!check(parser, TOKEN_RPAREN)) {
                 do {
                     Expr* arg = parse_expression(parser);
                     
-                    // Add arg to args array
-                    arg_count++;
-                    args = prism_realloc(args, sizeof(Expr*) * arg_count);
-                    args[arg_count - 1] = arg;
+                    // Parsing the arg may have grown the stack
+                    parser->args = reserve(parser->args, parser->arg_count, &parser->arg_capacity, sizeof(Expr*));
+                    parser->args[parser->arg_count++] = arg;
                 } while (match(parser, TOKEN_COMMA));
             }
             
             consume(parser, TOKEN_RPAREN, "Expect ')' after arguments");
-            expr = ast_create_call_expr(expr, args, arg_count);
-            
-            if (args) prism_free(args);
+            expr = ast_create_call_expr(expr, parser->args + base, parser->arg_count - base);
+            parser->arg_count = base;
         } else if (match(parser, TOKEN_DOT)) {
             // Parse property access
-            Token* name = consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'");
-            expr = ast_create_variable_expr(name->lexeme);
+            int name = consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'");
+            expr = ast_create_variable_expr(token_name(parser, name));
         } else {
             break;
         }
@@ -174,38 +216,51 @@ static Stmt* parse_var_declaration(Parser* parser) {
     bool exposed = match(parser, TOKEN_EXPOSED);
     bool internal = match(parser, TOKEN_INTERNAL);
     
-    Token* name = consume(parser, TOKEN_IDENTIFIER, "Expect variable name");
+    int name = consume(parser, TOKEN_IDENTIFIER, "Expect variable name");
     
     consume(parser, TOKEN_ARROW, "Expect '->' after variable name");
     
     Expr* initializer = parse_expression(parser);
     
-    return ast_create_var_decl_stmt(name->lexeme, TYPE_NONE, exposed, internal, initializer);
+    return ast_create_var_decl_stmt(token_name(parser, name), TYPE_NONE, exposed, internal, initializer);
+}
+
+// Pushes the statements up to the closing ')' onto the body stack and
+// returns where they start
+static int parse_body(Parser* parser) {
+    int base = parser->body_count;
+    
+    while (!check(parser, TOKEN_RPAREN) && !is_at_end(parser)) {
+        Stmt* stmt = parse_statement(parser);
+        parser->body = reserve(parser->body, parser->body_count, &parser->body_capacity, sizeof(Stmt*));
+        parser->body[parser->body_count++] = stmt;
+    }
+    return base;
 }
 
 static Stmt* parse_function_declaration(Parser* parser) {
-    Token* name = consume(parser, TOKEN_IDENTIFIER, "Expect function name");
+    int name = consume(parser, TOKEN_IDENTIFIER, "Expect function name");
     
     // Parse parameters
     consume(parser, TOKEN_LBRACKET, "Expect '[' after function name");
     
-    char** params = NULL;
-    PrismType* param_types = NULL;
-    int param_count = 0;
+    // Nested declarations push theirs on top while the body is parsed
+    int param_base = parser->param_count;
     
     if (!check(parser, TOKEN_RBRACKET)) {
         do {
-            Token* param_name = consume(parser, TOKEN_IDENTIFIER, "Expect parameter name");
+            int param_name = consume(parser, TOKEN_IDENTIFIER, "Expect parameter name");
             consume(parser, TOKEN_COLON, "Expect ':' after parameter name");
             PrismType param_type = parse_type(parser);
             
-            // Add parameter to params array
-            param_count++;
-            params = prism_realloc(params, sizeof(char*) * param_count);
-            param_types = prism_realloc(param_types, sizeof(PrismType) * param_count);
-            
-            params[param_count - 1] = strdup(param_name->lexeme);
-            param_types[param_count - 1] = param_type;
+            if (parser->param_count == parser->param_capacity) {
+                parser->param_capacity = parser->param_capacity ? parser->param_capacity * 2 : 16;
+                parser->params = prism_realloc(parser->params, sizeof(char*) * parser->param_capacity);
+                parser->param_types = prism_realloc(parser->param_types, sizeof(PrismType) * parser->param_capacity);
+            }
+            parser->params[parser->param_count] = (char*)token_name(parser, param_name);
+            parser->param_types[parser->param_count] = param_type;
+            parser->param_count++;
         } while (match(parser, TOKEN_COMMA));
     }
     
@@ -213,53 +268,37 @@ static Stmt* parse_function_declaration(Parser* parser) {
     
     // Parse function body
     consume(parser, TOKEN_LPAREN, "Expect '(' before function body");
-    
-    Stmt** body = NULL;
-    int body_count = 0;
-    
-    while (!check(parser, TOKEN_RPAREN) && !is_at_end(parser)) {
-        Stmt* stmt = parse_statement(parser);
-        
-        // Add statement to body array
-        body_count++;
-        body = prism_realloc(body, sizeof(Stmt*) * body_count);
-        body[body_count - 1] = stmt;
-    }
-    
+    int body_base = parse_body(parser);
     consume(parser, TOKEN_RPAREN, "Expect ')' after function body");
     
     // Parse return type
     consume(parser, TOKEN_RETURN_TYPE, "Expect '>>' after function body");
     PrismType return_type = parse_type(parser);
     
-    return ast_create_func_decl_stmt(name->lexeme, params, param_types, param_count, body, body_count, return_type);
+    Stmt* stmt = ast_create_func_decl_stmt(token_name(parser, name), parser->params + param_base, parser->param_types + param_base,
+                                           parser->param_count - param_base, parser->body + body_base,
+                                           parser->body_count - body_base, return_type);
+    parser->param_count = param_base;
+    parser->body_count = body_base;
+    return stmt;
 }
 
 static Stmt* parse_prism_declaration(Parser* parser) {
-    Token* name = consume(parser, TOKEN_IDENTIFIER, "Expect prism name");
+    int name = consume(parser, TOKEN_IDENTIFIER, "Expect prism name");
     
     // Parse prism body
     consume(parser, TOKEN_LPAREN, "Expect '(' before prism body");
-    
-    Stmt** body = NULL;
-    int body_count = 0;
-    
-    while (!check(parser, TOKEN_RPAREN) && !is_at_end(parser)) {
-        Stmt* stmt = parse_statement(parser);
-        
-        // Add statement to body array
-        body_count++;
-        body = prism_realloc(body, sizeof(Stmt*) * body_count);
-        body[body_count - 1] = stmt;
-    }
-    
+    int body_base = parse_body(parser);
     consume(parser, TOKEN_RPAREN, "Expect ')' after prism body");
     
     // Parse return type
     consume(parser, TOKEN_RETURN_TYPE, "Expect '>>' after prism body");
     PrismType return_type = parse_type(parser);
     
-    return ast_create_prism_decl_stmt(name->lexeme, body, body_count, return_type);
+    Stmt* stmt = ast_create_prism_decl_stmt(token_name(parser, name), parser->body + body_base,
+                                            parser->body_count - body_base, return_type);
+    parser->body_count = body_base;
+    return stmt;
 }
 
 static Stmt* parse_statement(Parser* parser) {
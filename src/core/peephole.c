@@ -0,0 +1,100 @@
+#include "../../include/core/codegen.h"
+#include "../../include/common/memory.h"
+#include <string.h>
+
+/* Peephole pass over a finished chunk. Instructions are copied into a new
+ * buffer, with the sequences below replaced by one superinstruction:
+ *
+ *   CONSTANT k; ADD            ->  ADD_CONST k
+ *   LOAD a; LOAD b; ADD        ->  ADD_LOCALS a b
+ *   CALL n; POP                ->  CALL_DISCARD n
+ *   CONSTANT nil; RETURN       ->  RETURN_NIL
+ *
+ * A sequence is only fused when no jump lands inside it. Jump offsets are
+ * rewritten afterwards from a map of old to new instruction offsets. */
+
+static bool is_jump(OpCode op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE;
+}
+
+static int jump_target(const OpCode* code, int ip) {
+    return ip + 3 + ((code[ip + 1] << 8) | code[ip + 2]);
+}
+
+// The instruction at ip is op, and nothing jumps to it
+static bool matches(const CodeChunk* chunk, const bool* targets, int ip, OpCode op) {
+    return ip < chunk->count && chunk->code[ip] == op && !targets[ip];
+}
+
+void codegen_peephole(CodeChunk* chunk) {
+    const OpCode* code = chunk->code;
+    int count = chunk->count;
+    
+    bool* targets = prism_alloc(sizeof(bool) * (count + 1));
+    int* new_offset = prism_alloc(sizeof(int) * (count + 1));
+    OpCode* out = prism_alloc(sizeof(OpCode) * chunk->capacity);
+    int* out_lines = prism_alloc(sizeof(int) * chunk->capacity);
+    
+    for (int ip = 0; ip < count; ip += codegen_op_length(code[ip])) {
+        if (is_jump(code[ip])) {
+            int target = jump_target(code, ip);
+            if (target >= 0 && target <= count) targets[target] = true;
+        }
+    }
+    
+    int n = 0;
+    int ip = 0;
+    while (ip < count) {
+        OpCode op = code[ip];
+        int length = codegen_op_length(op);
+        int next = ip + length;
+        new_offset[ip] = n;
+        out_lines[n] = chunk->lines[ip];
+        
+        if (op == OP_CONSTANT && matches(chunk, targets, next, OP_ADD)) {
+            out[n++] = OP_ADD_CONST;
+            out[n++] = code[ip + 1];
+            ip = next + 1;
+        } else if (op == OP_LOAD && matches(chunk, targets, next, OP_LOAD) &&
+                   matches(chunk, targets, next + 2, OP_ADD)) {
+            out[n++] = OP_ADD_LOCALS;
+            out[n++] = code[ip + 1];
+            out[n++] = code[next + 1];
+            ip = next + 3;
+        } else if (op == OP_CALL && matches(chunk, targets, next, OP_POP)) {
+            out[n++] = OP_CALL_DISCARD;
+            out[n++] = code[ip + 1];
+            ip = next + 1;
+        } else if (op == OP_CONSTANT && IS_NONE(chunk->constants[code[ip + 1]]) &&
+                   matches(chunk, targets, next, OP_RETURN)) {
+            out[n++] = OP_RETURN_NIL;
+            ip = next + 1;
+        } else {
+            memcpy(&out[n], &code[ip], sizeof(OpCode) * length);
+            for (int i = 1; i < length; i++) out_lines[n + i] = chunk->lines[ip + i];
+            n += length;
+            ip = next;
+        }
+    }
+    new_offset[count] = n;
+    
+    // Offsets are relative to the end of the jump instruction, so every jump
+    // is re-aimed at the new position of its old target
+    for (int old_ip = 0; old_ip < count; old_ip += codegen_op_length(code[old_ip])) {
+        if (!is_jump(code[old_ip])) continue;
+        
+        int new_ip = new_offset[old_ip];
+        int jump = new_offset[jump_target(code, old_ip)] - (new_ip + 3);
+        out[new_ip + 1] = (jump >> 8) & 0xFF;
+        out[new_ip + 2] = jump & 0xFF;
+    }
+    
+    prism_free(chunk->code);
+    prism_free(chunk->lines);
+    chunk->code = out;
+    chunk->lines = out_lines;
+    chunk->count = n;
+    
+    prism_free(targets);
+    prism_free(new_offset);
+}
@@ -0,0 +1,149 @@
+#include "../../include/core/pool.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/lib/io.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+struct WorkerPool {
+    pthread_t* workers;
+    int worker_count;
+
+    // Jobs waiting for a worker, oldest first
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t all_done;
+    PrismJob* head;
+    PrismJob* tail;
+    int unfinished;     // queued or running
+    bool stopping;
+};
+
+static void run_job(PrismJob* job) {
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buffer, &size);
+
+    VM* vm = vm_create();
+    vm->use_jit = job->use_jit;
+    vm->use_tracing = job->use_tracing;
+    vm->output = out;
+    job->result = vm_interpret(vm, job->source, job->filename);
+    job->error = vm->error.type != ERROR_NONE && vm->error.message ? strdup(vm->error.message) : NULL;
+    vm_free(vm);
+    // Finishes the job's outstanding file writes and releases the worker's ring
+    prism_io_cleanup();
+
+    if (out) {
+        fclose(out);
+        job->output = buffer;
+        job->output_size = size;
+    } else {
+        job->output = NULL;
+        job->output_size = 0;
+    }
+}
+
+static void* worker_main(void* arg) {
+    WorkerPool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (!pool->head) break;
+
+        PrismJob* job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) pool->tail = NULL;
+
+        pthread_mutex_unlock(&pool->lock);
+        run_job(job);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->unfinished == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WorkerPool* pool_create(int worker_count) {
+    if (worker_count <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? (int)cores : 1;
+    }
+
+    WorkerPool* pool = prism_alloc(sizeof(WorkerPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    pool->workers = prism_alloc(sizeof(pthread_t) * worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            prism_error("Could not start worker thread");
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    if (pool->worker_count == 0) {
+        pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int pool_worker_count(WorkerPool* pool) {
+    return pool->worker_count;
+}
+
+void pool_submit(WorkerPool* pool, PrismJob* job) {
+    job->next = NULL;
+    job->output = NULL;
+    job->output_size = 0;
+    job->error = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->unfinished++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->unfinished > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(WorkerPool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Workers drain the queue before they see the stop flag
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    prism_free(pool->workers);
+    prism_free(pool);
+}
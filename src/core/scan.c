@@ -0,0 +1,232 @@
+#include "../../include/core/scan.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// The vector kernels read past the end of the source on purpose
+#ifdef __SANITIZE_ADDRESS__
+#define NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define NO_ASAN
+#endif
+
+#define INLINE static inline __attribute__((always_inline))
+
+const uint8_t char_class[256] = {
+    [' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\r'] = CHAR_SPACE,
+    ['0' ... '9'] = CHAR_DIGIT,
+    ['a' ... 'z'] = CHAR_ALPHA, ['A' ... 'Z'] = CHAR_ALPHA, ['_'] = CHAR_ALPHA
+};
+
+// What ends a run
+typedef enum {
+    FIND_BLANKS,
+    FIND_IDENTIFIER,
+    FIND_LINE,
+    FIND_STRING
+} Find;
+
+static size_t scalar_run(const char* p, uint8_t class) {
+    const char* s = p;
+    while (char_class[(uint8_t)*s] & class) s++;
+    return s - p;
+}
+
+static size_t scalar_blanks(const char* p) {
+    return scalar_run(p, CHAR_SPACE);
+}
+
+static size_t scalar_identifier(const char* p) {
+    return scalar_run(p, CHAR_IDENT);
+}
+
+static size_t scalar_line(const char* p) {
+    const char* s = p;
+    while (*s && *s != '\n') s++;
+    return s - p;
+}
+
+static size_t scalar_string(const char* p) {
+    const char* s = p;
+    while (*s && *s != '"') s++;
+    return s - p;
+}
+
+#ifdef SCAN_X86
+
+/* SSE2, 16 bytes at a time. Letters and digits are range checks done with
+ * signed compares: adding 128 - low to a byte maps the range low..low+n-1
+ * onto the n smallest signed values. OR-ing in 0x20 folds upper case onto
+ * lower case without moving anything else into 'a'..'z'. */
+
+// Bit i is set where byte i ends the run
+INLINE NO_ASAN uint32_t sse2_stops(__m128i bytes, Find find) {
+    __m128i keep;
+    switch (find) {
+        case FIND_BLANKS:
+            keep = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                             _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+                                _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+            return ~(uint32_t)_mm_movemask_epi8(keep) & 0xFFFF;
+        case FIND_IDENTIFIER: {
+            __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+            __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(lower, _mm_set1_epi8(128 - 'a')),
+                                            _mm_set1_epi8(-128 + 26));
+            __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(bytes, _mm_set1_epi8(128 - '0')),
+                                           _mm_set1_epi8(-128 + 10));
+            keep = _mm_or_si128(_mm_or_si128(letter, digit), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+            return ~(uint32_t)_mm_movemask_epi8(keep) & 0xFFFF;
+        }
+        case FIND_LINE:
+            return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+                                                  _mm_cmpeq_epi8(bytes, _mm_setzero_si128())));
+        case FIND_STRING:
+            return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+                                                  _mm_cmpeq_epi8(bytes, _mm_setzero_si128())));
+    }
+    return 0;
+}
+
+// The first block starts at or before p; the bits for the bytes before p
+// are shifted out
+INLINE NO_ASAN size_t sse2_find(const char* p, Find find) {
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned skip = (unsigned)(p - block);
+    uint32_t stops = sse2_stops(_mm_load_si128((const __m128i*)block), find) >> skip;
+    size_t offset = 0;      // from p to the first byte the bits stand for
+    
+    if (!stops) {
+        offset = 16 - skip;
+        for (;;) {
+            block += 16;
+            stops = sse2_stops(_mm_load_si128((const __m128i*)block), find);
+            if (stops) break;
+            offset += 16;
+        }
+    }
+
+    return offset + __builtin_ctz(stops);
+}
+
+static NO_ASAN size_t sse2_blanks(const char* p) {
+    return sse2_find(p, FIND_BLANKS);
+}
+
+static NO_ASAN size_t sse2_identifier(const char* p) {
+    return sse2_find(p, FIND_IDENTIFIER);
+}
+
+static NO_ASAN size_t sse2_line(const char* p) {
+    return sse2_find(p, FIND_LINE);
+}
+
+static NO_ASAN size_t sse2_string(const char* p) {
+    return sse2_find(p, FIND_STRING);
+}
+
+// The same 32 bytes at a time
+#define AVX2 __attribute__((target("avx2")))
+
+INLINE AVX2 NO_ASAN uint32_t avx2_stops(__m256i bytes, Find find) {
+    __m256i keep;
+    switch (find) {
+        case FIND_BLANKS:
+            keep = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                                                   _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+                                   _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r')));
+            return ~(uint32_t)_mm256_movemask_epi8(keep);
+        case FIND_IDENTIFIER: {
+            __m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+            __m256i letter = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26),
+                                               _mm256_add_epi8(lower, _mm256_set1_epi8(128 - 'a')));
+            __m256i digit = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 10),
+                                              _mm256_add_epi8(bytes, _mm256_set1_epi8(128 - '0')));
+            keep = _mm256_or_si256(_mm256_or_si256(letter, digit),
+                                   _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_')));
+            return ~(uint32_t)_mm256_movemask_epi8(keep);
+        }
+        case FIND_LINE:
+            return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+                                                        _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())));
+        case FIND_STRING:
+            return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')),
+                                                        _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())));
+    }
+    return 0;
+}
+
+INLINE AVX2 NO_ASAN size_t avx2_find(const char* p, Find find) {
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)31);
+    unsigned skip = (unsigned)(p - block);
+    uint32_t stops = avx2_stops(_mm256_load_si256((const __m256i*)block), find) >> skip;
+    size_t offset = 0;
+    
+    if (!stops) {
+        offset = 32 - skip;
+        for (;;) {
+            block += 32;
+            stops = avx2_stops(_mm256_load_si256((const __m256i*)block), find);
+            if (stops) break;
+            offset += 32;
+        }
+    }
+
+    return offset + __builtin_ctz(stops);
+}
+
+static AVX2 NO_ASAN size_t avx2_blanks(const char* p) {
+    return avx2_find(p, FIND_BLANKS);
+}
+
+static AVX2 NO_ASAN size_t avx2_identifier(const char* p) {
+    return avx2_find(p, FIND_IDENTIFIER);
+}
+
+static AVX2 NO_ASAN size_t avx2_line(const char* p) {
+    return avx2_find(p, FIND_LINE);
+}
+
+static AVX2 NO_ASAN size_t avx2_string(const char* p) {
+    return avx2_find(p, FIND_STRING);
+}
+
+#endif
+
+static const ScanKernels levels[] = {
+    { SCAN_SCALAR, "scalar", scalar_blanks, scalar_identifier, scalar_line, scalar_string },
+#ifdef SCAN_X86
+    { SCAN_SSE2, "sse2", sse2_blanks, sse2_identifier, sse2_line, sse2_string },
+    { SCAN_AVX2, "avx2", avx2_blanks, avx2_identifier, avx2_line, avx2_string }
+#endif
+};
+
+static const ScanKernels* active;
+static pthread_once_t chosen = PTHREAD_ONCE_INIT;
+
+ScanLevel scan_best_level() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+static void choose() {
+    active = &levels[scan_best_level()];
+}
+
+const ScanKernels* scan_kernels() {
+    pthread_once(&chosen, choose);
+    return active;
+}
+
+void scan_set_level(ScanLevel level) {
+    pthread_once(&chosen, choose);
+    ScanLevel best = scan_best_level();
+    active = &levels[level < best ? level : best];
+}
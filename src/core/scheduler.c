@@ -0,0 +1,246 @@
+#include "../../include/core/scheduler.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define INITIAL_DEQUE_CAPACITY 16
+
+/* Tasks between top and bottom, as ever-increasing positions taken modulo
+ * the capacity. The owner works at the bottom and thieves at the top, so
+ * they only contend when the deque is nearly empty. */
+typedef struct {
+    pthread_mutex_t lock;
+    SchedulerTask** tasks;
+    int top;
+    int bottom;
+    int capacity;
+} Deque;
+
+typedef struct {
+    Scheduler* scheduler;
+    int index;
+    pthread_t thread;
+    Deque deque;
+} Worker;
+
+struct Scheduler {
+    Worker* workers;
+    int worker_count;
+    int started;        // threads running; a deque without one is only stolen from
+
+    // Guards everything below; changed is signalled whenever a task is
+    // queued or finishes, and when the scheduler stops
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int queued;
+    unsigned next_deque;
+    bool stopping;
+};
+
+// The worker running on this thread, NULL outside the pool
+static _Thread_local Worker* current_worker;
+
+static void deque_init(Deque* deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->tasks = prism_alloc(sizeof(SchedulerTask*) * INITIAL_DEQUE_CAPACITY);
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->capacity = INITIAL_DEQUE_CAPACITY;
+}
+
+static void deque_free(Deque* deque) {
+    pthread_mutex_destroy(&deque->lock);
+    prism_free(deque->tasks);
+}
+
+static void deque_push(Deque* deque, SchedulerTask* task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        int capacity = deque->capacity * 2;
+        SchedulerTask** tasks = prism_alloc(sizeof(SchedulerTask*) * capacity);
+        for (int i = deque->top; i < deque->bottom; i++) {
+            tasks[i % capacity] = deque->tasks[i % deque->capacity];
+        }
+        prism_free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom++ % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Newest task, for the owner
+static SchedulerTask* deque_pop(Deque* deque) {
+    SchedulerTask* task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        task = deque->tasks[--deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// Oldest task, for thieves
+static SchedulerTask* deque_steal(Deque* deque) {
+    SchedulerTask* task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        task = deque->tasks[deque->top++ % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// Takes a task from the worker's own deque, or steals one, starting with
+// the worker after it. Outside the pool every deque is a victim.
+static SchedulerTask* find_task(Scheduler* scheduler, Worker* self) {
+    SchedulerTask* task = self ? deque_pop(&self->deque) : NULL;
+    int start = self ? self->index + 1 : 0;
+
+    for (int i = 0; !task && i < scheduler->worker_count; i++) {
+        Worker* victim = &scheduler->workers[(start + i) % scheduler->worker_count];
+        if (victim != self) task = deque_steal(&victim->deque);
+    }
+
+    if (task) {
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->queued--;
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    return task;
+}
+
+static void run_task(Scheduler* scheduler, SchedulerTask* task) {
+    task->run(task->arg);
+
+    pthread_mutex_lock(&scheduler->lock);
+    task->done = true;
+    pthread_cond_broadcast(&scheduler->changed);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    Scheduler* scheduler = worker->scheduler;
+    current_worker = worker;
+
+    for (;;) {
+        SchedulerTask* task = find_task(scheduler, worker);
+        if (task) {
+            run_task(scheduler, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        while (scheduler->queued <= 0 && !scheduler->stopping) {
+            pthread_cond_wait(&scheduler->changed, &scheduler->lock);
+        }
+        // Queued work is still drained after a stop
+        bool stop = scheduler->stopping && scheduler->queued <= 0;
+        pthread_mutex_unlock(&scheduler->lock);
+        if (stop) break;
+    }
+    return NULL;
+}
+
+Scheduler* scheduler_create(int worker_count) {
+    if (worker_count <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? (int)cores : 1;
+    }
+
+    Scheduler* scheduler = prism_alloc(sizeof(Scheduler));
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->changed, NULL);
+
+    // Deques are all set up before any worker can go looking for a victim
+    scheduler->workers = prism_alloc(sizeof(Worker) * worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        scheduler->workers[i].scheduler = scheduler;
+        scheduler->workers[i].index = i;
+        deque_init(&scheduler->workers[i].deque);
+    }
+    scheduler->worker_count = worker_count;
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&scheduler->workers[i].thread, NULL, worker_main, &scheduler->workers[i]) != 0) {
+            prism_error("Could not start worker thread");
+            break;
+        }
+        scheduler->started++;
+    }
+
+    if (scheduler->started == 0) {
+        scheduler_free(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+int scheduler_worker_count(Scheduler* scheduler) {
+    return scheduler->started;
+}
+
+void scheduler_spawn(Scheduler* scheduler, SchedulerTask* task) {
+    task->done = false;
+
+    Worker* worker = current_worker && current_worker->scheduler == scheduler ? current_worker : NULL;
+    if (!worker) {
+        pthread_mutex_lock(&scheduler->lock);
+        worker = &scheduler->workers[scheduler->next_deque++ % scheduler->worker_count];
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    deque_push(&worker->deque, task);
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->queued++;
+    pthread_cond_broadcast(&scheduler->changed);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+void scheduler_join(Scheduler* scheduler, SchedulerTask* task) {
+    Worker* self = current_worker && current_worker->scheduler == scheduler ? current_worker : NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&scheduler->lock);
+        bool done = task->done;
+        pthread_mutex_unlock(&scheduler->lock);
+        if (done) return;
+
+        // Help out rather than block while the task is still queued or
+        // others are waiting to run
+        SchedulerTask* other = find_task(scheduler, self);
+        if (other) {
+            run_task(scheduler, other);
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        while (!task->done && scheduler->queued <= 0) {
+            pthread_cond_wait(&scheduler->changed, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+void scheduler_free(Scheduler* scheduler) {
+    if (!scheduler) return;
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->stopping = true;
+    pthread_cond_broadcast(&scheduler->changed);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (int i = 0; i < scheduler->started; i++) {
+        pthread_join(scheduler->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < scheduler->worker_count; i++) {
+        deque_free(&scheduler->workers[i].deque);
+    }
+
+    pthread_cond_destroy(&scheduler->changed);
+    pthread_mutex_destroy(&scheduler->lock);
+    prism_free(scheduler->workers);
+    prism_free(scheduler);
+}
@@ -1,44 +1,32 @@
 #include "../../include/core/symtab.h"
 #include "../../include/common/memory.h"
-#include <string.h>
 
 SymbolTable* symtab_create() {
     SymbolTable* table = prism_alloc(sizeof(SymbolTable));
-    table->current = prism_alloc(sizeof(Scope));
+    table->arena = arena_create();
+    table->current = arena_alloc(table->arena, sizeof(Scope));
     table->current->entries = NULL;
     table->current->parent = NULL;
+    table->depth = 0;
+    table->current_vars = 0;
     return table;
 }
 
-static void free_scope(Scope* scope) {
-    SymbolEntry* entry = scope->entries;
-    while (entry) {
-        SymbolEntry* next = entry->next;
-        prism_free(entry->name);
-        prism_free(entry);
-        entry = next;
-    }
-    prism_free(scope);
-}
-
 void symtab_free(SymbolTable* table) {
     if (!table) return;
     
-    Scope* scope = table->current;
-    while (scope) {
-        Scope* parent = scope->parent;
-        free_scope(scope);
-        scope = parent;
-    }
-    
+    arena_free(table->arena);
     prism_free(table);
 }
 
 void symtab_enter_scope(SymbolTable* table) {
-    Scope* scope = prism_alloc(sizeof(Scope));
+    ArenaMark mark = arena_mark(table->arena);
+    Scope* scope = arena_alloc(table->arena, sizeof(Scope));
     scope->entries = NULL;
     scope->parent = table->current;
+    scope->mark = mark;
     table->current = scope;
+    table->depth++;
 }
 
 void symtab_exit_scope(SymbolTable* table) {
@@ -46,16 +34,18 @@ void symtab_exit_scope(SymbolTable* table) {
     
     Scope* old = table->current;
     table->current = old->parent;
-    free_scope(old);
+    table->depth--;
+    arena_rewind(table->arena, old->mark);
 }
 
 void symtab_define(SymbolTable* table, const char* name, PrismType type, bool exposed, bool internal, void* value) {
-    SymbolEntry* entry = prism_alloc(sizeof(SymbolEntry));
-    entry->name = strdup(name);
+    SymbolEntry* entry = arena_alloc(table->arena, sizeof(SymbolEntry));
+    entry->name = name;
     entry->type = type;
     entry->exposed = exposed;
     entry->internal = internal;
     entry->data = value;
+    entry->depth = table->depth;
     entry->next = table->current->entries;
     table->current->entries = entry;
 }
@@ -63,7 +53,7 @@ void symtab_define(SymbolTable* table, const char* name, PrismType type, bool ex
 SymbolEntry* symtab_lookup_current(SymbolTable* table, const char* name) {
     SymbolEntry* entry = table->current->entries;
     while (entry) {
-        if (strcmp(entry->name, name) == 0) {
+        if (entry->name == name) {
             return entry;
         }
         entry = entry->next;
@@ -76,7 +66,7 @@ SymbolEntry* symtab_lookup(SymbolTable* table, const char* name) {
     while (scope) {
         SymbolEntry* entry = scope->entries;
         while (entry) {
-            if (strcmp(entry->name, name) == 0) {
+            if (entry->name == name) {
                 return entry;
             }
             entry = entry->next;
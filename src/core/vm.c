@@ -1,26 +1,63 @@
 #include "../../include/core/vm.h"
+#include "../../include/core/arith.h"
+#include "../../include/core/jit.h"
+#include "../../include/core/coroutine.h"
+#include "../../include/core/parallel.h"
+#include "../../include/core/scheduler.h"
 #include "../../include/core/lexer.h"
 #include "../../include/core/parser.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
+#include "../../include/common/util.h"
+#include "../../include/common/rope.h"
+#include "../../include/common/gc.h"
+#include "../../include/common/arena.h"
+#include "../../include/lib/std.h"
+#include "../../include/lib/io.h"
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+static void request_collection(void* vm);
 
 VM* vm_create() {
     VM* vm = prism_alloc(sizeof(VM));
     vm->code_gen = NULL;
     vm->stack_top = 0;
     vm->frame_count = 0;
+    vm->globals = NULL;
+    vm->global_count = 0;
+    vm->use_jit = false;
+    vm->use_tracing = false;
+    vm->recorder = NULL;
+    vm->output = NULL;
+    vm->use_parallel = false;
+    vm->scheduler = NULL;
+    vm->tasks = NULL;
+    vm->coroutine = NULL;
+    vm->fuel = -1;
+    vm->deadline = 0;
+    vm->slice = 0;
+    vm->suspended = false;
+    vm->heap = gc_create(request_collection, vm);
     return vm;
 }
 
 void vm_free(VM* vm) {
     if (!vm) return;
     
+    if (vm->recorder) trace_abort(vm->recorder);
+    
+    // Tasks share strings with the program, so they go first
+    parallel_finish(vm);
+    scheduler_free(vm->scheduler);
     if (vm->code_gen) {
         codegen_free(vm->code_gen);
     }
     
+    prism_free(vm->globals);
+    gc_free(vm->heap);
+    prism_reset_error(&vm->error);
     prism_free(vm);
 }
 
@@ -38,9 +75,7 @@ void vm_push(VM* vm, PrismValue value) {
 PrismValue vm_pop(VM* vm) {
     if (vm->stack_top <= 0) {
         prism_error("Stack underflow");
-        PrismValue error_val;
-        error_val.type = TYPE_NONE;
-        return error_val;
+        return NONE_VAL;
     }
     
     vm->stack_top--;
@@ -50,333 +85,1008 @@ PrismValue vm_pop(VM* vm) {
 PrismValue vm_peek(VM* vm, int distance) {
     if (vm->stack_top <= distance) {
         prism_error("Stack underflow on peek");
-        PrismValue error_val;
-        error_val.type = TYPE_NONE;
-        return error_val;
+        return NONE_VAL;
     }
     
     return vm->stack[vm->stack_top - 1 - distance];
 }
 
+// The prototype behind a call target, or NULL after reporting why it
+// can't be called with arg_count arguments
+static FunctionProto* callee_function(PrismValue callee, int arg_count) {
+    if (!IS_FUNCTION(callee) && VALUE_TYPE(callee) != TYPE_PRISM) {
+        prism_error("Can only call functions and prisms");
+        return NULL;
+    }
+    
+    FunctionProto* function = AS_PTR(callee);
+    if (arg_count != function->arity) {
+        prism_error("%s expects %d arguments but got %d", 
+                   function->name, function->arity, arg_count);
+        return NULL;
+    }
+    
+    return function;
+}
+
+static int64_t now_nanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Gives the unspent part of the slice back to fuel, so the next checkpoint
+// takes the slow path
+static void reclaim_slice(VM* vm) {
+    if (vm->fuel >= 0 && vm->slice > 0) vm->fuel += vm->slice;
+    vm->slice = 0;
+}
+
+// The heap wants a collection, which the next checkpoint makes
+static void request_collection(void* vm) {
+    reclaim_slice(vm);
+}
+
+void vm_collect(VM* vm, bool full) {
+    GcHeap* heap = vm->heap;
+    gc_begin(heap, full);
+    
+    gc_visit(heap, vm->stack, vm->stack_top);
+    gc_visit(heap, vm->globals, vm->global_count);
+    // A resume pops the coroutine it runs, and its resumers may be
+    // referred to by nothing else
+    for (Coroutine* coroutine = vm->coroutine; coroutine; coroutine = coroutine->caller) {
+        PrismValue running = PTR_VAL(TYPE_COROUTINE, coroutine);
+        gc_visit(heap, &running, 1);
+    }
+    if (vm->code_gen) {
+        for (int i = 0; i < vm->code_gen->chunk_count; i++) {
+            CodeChunk* chunk = &vm->code_gen->chunks[i];
+            gc_visit(heap, chunk->constants, chunk->constant_count);
+        }
+    }
+    
+    gc_end(heap);
+}
+
+void vm_set_fuel(VM* vm, int64_t fuel) {
+    vm->fuel = fuel < 0 ? -1 : fuel;
+    vm->slice = 0;
+}
+
+int64_t vm_fuel_left(VM* vm) {
+    if (vm->fuel < 0) return -1;
+    return vm->fuel + (vm->slice > 0 ? vm->slice : 0);
+}
+
+void vm_set_deadline(VM* vm, int64_t nanoseconds) {
+    vm->deadline = nanoseconds < 0 ? 0 : now_nanoseconds() + nanoseconds;
+    reclaim_slice(vm);
+}
+
+// Called at a checkpoint once the slice is used up, or early when the heap
+// wants collecting. True if the run should suspend; otherwise the
+// checkpoint is paid for out of a fresh slice.
+static bool slice_expired(VM* vm) {
+    if (gc_pending(vm->heap)) vm_collect(vm, false);
+    
+    if (vm->fuel == 0 || (vm->deadline && now_nanoseconds() >= vm->deadline)) {
+        // The checkpoint runs again on resume and pays then
+        vm->slice = 0;
+        return true;
+    }
+    
+    int64_t next = vm->deadline ? VM_CLOCK_STRIDE : INT64_MAX;
+    if (vm->fuel > 0) {
+        if (next > vm->fuel) next = vm->fuel;
+        vm->fuel -= next;
+    }
+    vm->slice = next - 1;
+    return false;
+}
+
+#ifdef PRISM_PROFILE_PAIRS
+static uint64_t pair_counts[OP_COUNT][OP_COUNT];
+static OpCode last_op = OP_NOP;
+
+#define PROFILE_PAIR(op) (pair_counts[last_op][(op)]++, last_op = (op))
+
+typedef struct {
+    OpCode first;
+    OpCode second;
+    uint64_t count;
+} OpPair;
+
+static int compare_pairs(const void* a, const void* b) {
+    uint64_t x = ((const OpPair*)a)->count;
+    uint64_t y = ((const OpPair*)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void vm_print_pair_profile(FILE* out) {
+    OpPair* pairs = prism_alloc(sizeof(OpPair) * OP_COUNT * OP_COUNT);
+    int pair_count = 0;
+    uint64_t total = 0;
+    
+    for (int i = 0; i < OP_COUNT; i++) {
+        for (int j = 0; j < OP_COUNT; j++) {
+            if (pair_counts[i][j] == 0) continue;
+            pairs[pair_count++] = (OpPair){ i, j, pair_counts[i][j] };
+            total += pair_counts[i][j];
+        }
+    }
+    
+    qsort(pairs, pair_count, sizeof(OpPair), compare_pairs);
+    
+    fprintf(out, "opcode pairs (%llu dispatches)\n", (unsigned long long)total);
+    for (int i = 0; i < pair_count && i < 20; i++) {
+        fprintf(out, "  %-20s %-20s %12llu  %5.1f%%\n",
+                codegen_op_name(pairs[i].first), codegen_op_name(pairs[i].second),
+                (unsigned long long)pairs[i].count, 100.0 * pairs[i].count / total);
+    }
+    
+    prism_free(pairs);
+}
+#else
+#define PROFILE_PAIR(op) ((void)0)
+#endif
+
+/* Every frame is checked against its function's max_stack when it is
+ * pushed, so instructions inside the loop push and pop unchecked. */
 static InterpretResult run(VM* vm) {
-    CodeChunk* chunk = &vm->code_gen->chunks[0];
-    int ip = 0;
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    CodeChunk* chunk = frame->chunk;
+    OpCode* ip = frame->ip;
+    PrismValue* slots = &vm->stack[frame->base];
+    const NativeFunction* natives = vm->code_gen->natives;
     
-    #define READ_BYTE() (chunk->code[ip++])
+    #define READ_BYTE() (*ip++)
+    #define READ_SHORT() (ip += 2, (int)((ip[-2] << 8) | ip[-1]))
     #define READ_CONSTANT() (chunk->constants[READ_BYTE()])
+    #define QUICKEN(op) (ip[-1] = (op))
+    #define PUSH(value) (vm->stack[vm->stack_top++] = (value))
+    #define POP() (vm->stack[--vm->stack_top])
+    #define LOAD_FRAME() \
+        do { \
+            frame = &vm->frames[vm->frame_count - 1]; \
+            chunk = frame->chunk; \
+            ip = frame->ip; \
+            slots = &vm->stack[frame->base]; \
+        } while (0)
+    
+    // Counts a call into function, compiling it once it turns hot
+    #define COUNT_CALL(function) \
+        do { \
+            if (vm->use_jit && !(function)->jit && \
+                ++(function)->call_count == JIT_THRESHOLD) { \
+                (function)->jit = jit_compile(function); \
+            } \
+        } while (0)
+    
+    // Taken first thing by calls, tail calls and resumes. Out of fuel or time,
+    // the run stops with ip on the instruction so it runs again on resume.
+    #define CHECKPOINT() \
+        do { \
+            if (--vm->slice < 0 && slice_expired(vm)) { \
+                frame->ip = ip - 1; \
+                if (vm->recorder) { \
+                    trace_abort(vm->recorder); \
+                    vm->recorder = NULL; \
+                } \
+                vm->suspended = true; \
+                return INTERPRET_SUSPENDED; \
+            } \
+        } while (0)
+    
+    // Runs the current frame's compiled code, if any, from ip until it
+    // hands back an instruction it has no template for
+    #define ENTER_JIT() \
+        do { \
+            if (frame->function->jit && !vm->recorder) { \
+                int resume = jit_enter(frame->function->jit, vm, slots, (int)(ip - chunk->code)); \
+                if (resume < 0) return INTERPRET_RUNTIME_ERROR; \
+                ip = chunk->code + resume; \
+            } \
+        } while (0)
+    
+    // Runs the trace anchored at ip, or starts recording one once the
+    // anchor is hot
+    #define ENTER_TRACE() \
+        do { \
+            if (vm->use_tracing) { \
+                int at = (int)(ip - chunk->code); \
+                Trace* trace = trace_find(frame->function, at); \
+                if (trace) { \
+                    int resume = trace_enter(trace, vm, slots); \
+                    if (resume < 0) return INTERPRET_RUNTIME_ERROR; \
+                    ip = chunk->code + resume; \
+                } else if (!vm->recorder && trace_is_hot(frame->function, at)) { \
+                    vm->recorder = trace_start(frame->function, at); \
+                    START_RECORDING(); \
+                } \
+            } \
+        } while (0)
+    
+    // Shows the recorder the instruction about to run
+    #define RECORD() \
+        do { \
+            if (!trace_record(vm->recorder, vm, slots, (int)(ip - 1 - chunk->code))) { \
+                vm->recorder = NULL; \
+                STOP_RECORDING(); \
+            } \
+        } while (0)
+    
+#ifdef PRISM_COMPUTED_GOTO
+    // One indirect jump per handler instead of a single shared switch branch
+    static void* dispatch_table[] = {
+        [OP_NOP] = &&op_NOP,
+        [OP_CONSTANT] = &&op_CONSTANT,
+        [OP_ADD] = &&op_ADD,
+        [OP_SUBTRACT] = &&op_SUBTRACT,
+        [OP_MULTIPLY] = &&op_MULTIPLY,
+        [OP_DIVIDE] = &&op_DIVIDE,
+        [OP_NEGATE] = &&op_NEGATE,
+        [OP_RETURN] = &&op_RETURN,
+        [OP_CALL] = &&op_CALL,
+        [OP_LOAD] = &&op_LOAD,
+        [OP_STORE] = &&op_STORE,
+        [OP_JUMP] = &&op_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+        [OP_POP] = &&op_POP,
+        [OP_LOAD_GLOBAL] = &&op_LOAD_GLOBAL,
+        [OP_STORE_GLOBAL] = &&op_STORE_GLOBAL,
+        [OP_CALL_NATIVE] = &&op_CALL_NATIVE,
+        [OP_TAIL_CALL] = &&op_TAIL_CALL,
+        [OP_SPAWN] = &&op_SPAWN,
+        [OP_COROUTINE] = &&op_COROUTINE,
+        [OP_RESUME] = &&op_RESUME,
+        [OP_YIELD] = &&op_YIELD,
+        [OP_END] = &&op_END,
+        [OP_ADD_INT_INT] = &&op_ADD_INT_INT,
+        [OP_ADD_FLOAT_FLOAT] = &&op_ADD_FLOAT_FLOAT,
+        [OP_ADD_STR_STR] = &&op_ADD_STR_STR,
+        [OP_SUBTRACT_INT_INT] = &&op_SUBTRACT_INT_INT,
+        [OP_SUBTRACT_FLOAT_FLOAT] = &&op_SUBTRACT_FLOAT_FLOAT,
+        [OP_MULTIPLY_INT_INT] = &&op_MULTIPLY_INT_INT,
+        [OP_MULTIPLY_FLOAT_FLOAT] = &&op_MULTIPLY_FLOAT_FLOAT,
+        [OP_ADD_CONST] = &&op_ADD_CONST,
+        [OP_ADD_LOCALS] = &&op_ADD_LOCALS,
+        [OP_CALL_DISCARD] = &&op_CALL_DISCARD,
+        [OP_RETURN_NIL] = &&op_RETURN_NIL
+    };
+    
+    // While a trace is being recorded every opcode dispatches through
+    // record_op first, so the normal loop pays nothing for tracing
+    static void* record_table[] = {
+        [0 ... OP_COUNT - 1] = &&record_op
+    };
+    void** dispatch = dispatch_table;
+    
+    #define DISPATCH() \
+        do { \
+            OpCode next_op = READ_BYTE(); \
+            PROFILE_PAIR(next_op); \
+            goto *dispatch[next_op]; \
+        } while (0)
+    #define CASE(op) op_##op
+    #define NEXT() DISPATCH()
+    #define START_RECORDING() (dispatch = record_table)
+    #define STOP_RECORDING() (dispatch = dispatch_table)
+    
+    DISPATCH();
+    {
+            record_op: {
+                RECORD();
+                goto *dispatch_table[ip[-1]];
+            }
+            
+#else
+    #define CASE(op) case OP_##op
+    #define NEXT() break
+    #define START_RECORDING() ((void)0)
+    #define STOP_RECORDING() ((void)0)
     
     for (;;) {
-        OpCode instruction = READ_BYTE();
-        
-        switch (instruction) {
-            case OP_NOP:
-                break;
+        OpCode next_op = READ_BYTE();
+        PROFILE_PAIR(next_op);
+        if (vm->recorder) RECORD();
+        switch (next_op) {
+#endif
+            CASE(NOP):
+                NEXT();
                 
-            case OP_CONSTANT: {
+            CASE(CONSTANT): {
                 PrismValue constant = READ_CONSTANT();
-                vm_push(vm, constant);
-                break;
+                PUSH(constant);
+                NEXT();
             }
             
-            case OP_ADD: {
+            CASE(ADD):
+            generic_add: {
                 if (vm->stack_top < 2) {
                     prism_error("Not enough operands for addition");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                PrismValue b = vm_pop(vm);
-                PrismValue a = vm_pop(vm);
+                PrismValue b = POP();
+                PrismValue a = POP();
                 
-                if (a.type == TYPE_INT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_INT;
-                    result.value.i = a.value.i + b.value.i;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f + b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_INT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = (double)a.value.i + b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f + (double)b.value.i;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_STRING && b.type == TYPE_STRING) {
-                    PrismValue result;
-                    result.type = TYPE_STRING;
-                    
-                    size_t len_a = strlen(a.value.s);
-                    size_t len_b = strlen(b.value.s);
-                    
-                    result.value.s = prism_alloc(len_a + len_b + 1);
-                    strcpy(result.value.s, a.value.s);
-                    strcat(result.value.s, b.value.s);
-                    
-                    vm_push(vm, result);
+                if (IS_INT(a) && IS_INT(b)) {
+                    QUICKEN(OP_ADD_INT_INT);
+                    PrismValue result = INT_VAL(AS_INT(a) + AS_INT(b));
+                    PUSH(result);
+                } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+                    QUICKEN(OP_ADD_FLOAT_FLOAT);
+                    PrismValue result = FLOAT_VAL(AS_FLOAT(a) + AS_FLOAT(b));
+                    PUSH(result);
+                } else if (IS_TEXT(a) && IS_TEXT(b)) {
+                    QUICKEN(OP_ADD_STR_STR);
+                    PUSH(rope_concat(a, b));
                 } else {
-                    prism_error("Invalid operand types for addition");
-                    return INTERPRET_RUNTIME_ERROR;
+                    PrismValue result;
+                    if (!prism_arith(OP_ADD, a, b, &result)) return INTERPRET_RUNTIME_ERROR;
+                    PUSH(result);
                 }
-                break;
+                NEXT();
             }
             
-            case OP_SUBTRACT: {
+            CASE(SUBTRACT):
+            generic_subtract: {
                 if (vm->stack_top < 2) {
                     prism_error("Not enough operands for subtraction");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                PrismValue b = vm_pop(vm);
-                PrismValue a = vm_pop(vm);
+                PrismValue b = POP();
+                PrismValue a = POP();
                 
-                if (a.type == TYPE_INT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_INT;
-                    result.value.i = a.value.i - b.value.i;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f - b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_INT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = (double)a.value.i - b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f - (double)b.value.i;
-                    vm_push(vm, result);
+                if (IS_INT(a) && IS_INT(b)) {
+                    QUICKEN(OP_SUBTRACT_INT_INT);
+                    PrismValue result = INT_VAL(AS_INT(a) - AS_INT(b));
+                    PUSH(result);
+                } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+                    QUICKEN(OP_SUBTRACT_FLOAT_FLOAT);
+                    PrismValue result = FLOAT_VAL(AS_FLOAT(a) - AS_FLOAT(b));
+                    PUSH(result);
                 } else {
-                    prism_error("Invalid operand types for subtraction");
-                    return INTERPRET_RUNTIME_ERROR;
+                    PrismValue result;
+                    if (!prism_arith(OP_SUBTRACT, a, b, &result)) return INTERPRET_RUNTIME_ERROR;
+                    PUSH(result);
                 }
-                break;
+                NEXT();
             }
             
-            case OP_MULTIPLY: {
+            CASE(MULTIPLY):
+            generic_multiply: {
                 if (vm->stack_top < 2) {
                     prism_error("Not enough operands for multiplication");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                PrismValue b = vm_pop(vm);
-                PrismValue a = vm_pop(vm);
+                PrismValue b = POP();
+                PrismValue a = POP();
                 
-                if (a.type == TYPE_INT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_INT;
-                    result.value.i = a.value.i * b.value.i;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f * b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_INT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = (double)a.value.i * b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f * (double)b.value.i;
-                    vm_push(vm, result);
+                if (IS_INT(a) && IS_INT(b)) {
+                    QUICKEN(OP_MULTIPLY_INT_INT);
+                    PrismValue result = INT_VAL(AS_INT(a) * AS_INT(b));
+                    PUSH(result);
+                } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+                    QUICKEN(OP_MULTIPLY_FLOAT_FLOAT);
+                    PrismValue result = FLOAT_VAL(AS_FLOAT(a) * AS_FLOAT(b));
+                    PUSH(result);
                 } else {
-                    prism_error("Invalid operand types for multiplication");
-                    return INTERPRET_RUNTIME_ERROR;
+                    PrismValue result;
+                    if (!prism_arith(OP_MULTIPLY, a, b, &result)) return INTERPRET_RUNTIME_ERROR;
+                    PUSH(result);
                 }
-                break;
+                NEXT();
             }
             
-            case OP_DIVIDE: {
-                if (vm->stack_top < 2) {
-                    prism_error("Not enough operands for division");
-                    return INTERPRET_RUNTIME_ERROR;
+            /* Quickened arithmetic. The generic handlers above rewrite their own
+             * opcode into one of these the first time they see matching operand
+             * types; each keeps a guard and rewrites itself back on a miss. The
+             * depth of the stack at an instruction is fixed, so the two operands
+             * the generic handler found there are there every time. */
+            CASE(ADD_INT_INT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_INT(*a) || !IS_INT(*b)) {
+                    QUICKEN(OP_ADD);
+                    goto generic_add;
                 }
                 
-                PrismValue b = vm_pop(vm);
-                PrismValue a = vm_pop(vm);
+                *a = INT_VAL(AS_INT(*a) + AS_INT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(ADD_FLOAT_FLOAT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_FLOAT(*a) || !IS_FLOAT(*b)) {
+                    QUICKEN(OP_ADD);
+                    goto generic_add;
+                }
                 
-                if ((b.type == TYPE_INT && b.value.i == 0) ||
-                    (b.type == TYPE_FLOAT && b.value.f == 0.0)) {
-                    prism_error("Division by zero");
+                *a = FLOAT_VAL(AS_FLOAT(*a) + AS_FLOAT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(ADD_STR_STR): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_TEXT(*a) || !IS_TEXT(*b)) {
+                    QUICKEN(OP_ADD);
+                    goto generic_add;
+                }
+                
+                *a = rope_concat(*a, *b);
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(SUBTRACT_INT_INT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_INT(*a) || !IS_INT(*b)) {
+                    QUICKEN(OP_SUBTRACT);
+                    goto generic_subtract;
+                }
+                
+                *a = INT_VAL(AS_INT(*a) - AS_INT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(SUBTRACT_FLOAT_FLOAT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_FLOAT(*a) || !IS_FLOAT(*b)) {
+                    QUICKEN(OP_SUBTRACT);
+                    goto generic_subtract;
+                }
+                
+                *a = FLOAT_VAL(AS_FLOAT(*a) - AS_FLOAT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(MULTIPLY_INT_INT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_INT(*a) || !IS_INT(*b)) {
+                    QUICKEN(OP_MULTIPLY);
+                    goto generic_multiply;
+                }
+                
+                *a = INT_VAL(AS_INT(*a) * AS_INT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            CASE(MULTIPLY_FLOAT_FLOAT): {
+                PrismValue* a = &vm->stack[vm->stack_top - 2];
+                PrismValue* b = a + 1;
+                if (!IS_FLOAT(*a) || !IS_FLOAT(*b)) {
+                    QUICKEN(OP_MULTIPLY);
+                    goto generic_multiply;
+                }
+                
+                *a = FLOAT_VAL(AS_FLOAT(*a) * AS_FLOAT(*b));
+                vm->stack_top--;
+                NEXT();
+            }
+            
+            /* Superinstructions from codegen_peephole. Their operands sit
+             * where QUICKEN would write, so they never rewrite themselves. */
+            CASE(ADD_CONST): {
+                PrismValue* a = &vm->stack[vm->stack_top - 1];
+                PrismValue b = READ_CONSTANT();
+                
+                if (IS_INT(*a) && IS_INT(b)) {
+                    *a = INT_VAL(AS_INT(*a) + AS_INT(b));
+                } else if (!prism_arith(OP_ADD, *a, b, a)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                NEXT();
+            }
+            
+            CASE(ADD_LOCALS): {
+                PrismValue a = slots[READ_BYTE()];
+                PrismValue b = slots[READ_BYTE()];
+                PrismValue result;
                 
-                if (a.type == TYPE_INT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = (double)a.value.i / (double)b.value.i;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f / b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_INT && b.type == TYPE_FLOAT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = (double)a.value.i / b.value.f;
-                    vm_push(vm, result);
-                } else if (a.type == TYPE_FLOAT && b.type == TYPE_INT) {
-                    PrismValue result;
-                    result.type = TYPE_FLOAT;
-                    result.value.f = a.value.f / (double)b.value.i;
-                    vm_push(vm, result);
-                } else {
-                    prism_error("Invalid operand types for division");
+                if (IS_INT(a) && IS_INT(b)) {
+                    result = INT_VAL(AS_INT(a) + AS_INT(b));
+                } else if (!prism_arith(OP_ADD, a, b, &result)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                PUSH(result);
+                NEXT();
             }
             
-            case OP_NEGATE: {
+            CASE(DIVIDE): {
+                if (vm->stack_top < 2) {
+                    prism_error("Not enough operands for division");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                
+                PrismValue b = POP();
+                PrismValue a = POP();
+                
+                PrismValue result;
+                if (!prism_arith(OP_DIVIDE, a, b, &result)) return INTERPRET_RUNTIME_ERROR;
+                PUSH(result);
+                NEXT();
+            }
+            
+            CASE(NEGATE): {
                 if (vm->stack_top < 1) {
                     prism_error("Not enough operands for negation");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                PrismValue operand = vm_pop(vm);
+                PrismValue operand = POP();
                 PrismValue result;
                 
-                if (operand.type == TYPE_INT) {
-                    result.type = TYPE_INT;
-                    result.value.i = -operand.value.i;
-                } else if (operand.type == TYPE_FLOAT) {
-                    result.type = TYPE_FLOAT;
-                    result.value.f = -operand.value.f;
+                if (IS_INT(operand)) {
+                    result = INT_VAL(-AS_INT(operand));
+                } else if (IS_FLOAT(operand)) {
+                    result = FLOAT_VAL(-AS_FLOAT(operand));
                 } else {
                     prism_error("Can only negate numbers");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                vm_push(vm, result);
-                break;
+                PUSH(result);
+                NEXT();
             }
             
-            case OP_RETURN: {
+            CASE(RETURN_NIL):
+                PUSH(NONE_VAL);
+                goto return_value;
+                
+            CASE(RETURN):
+            return_value: {
+                PrismValue result = POP();
+                vm->frame_count--;
+                
+                // A coroutine's outermost body is done, and the result
+                // goes to whoever resumed it
+                if (vm->coroutine && vm->frame_count == vm->coroutine->frame_base) {
+                    coroutine_finish(vm);
+                    PUSH(result);
+                    LOAD_FRAME();
+                    ENTER_JIT();
+                    NEXT();
+                }
+                
                 if (vm->frame_count == 0) {
-                    // Exit the program
+                    // Exit the program, leaving the script's result on the stack
+                    vm->stack_top = 0;
+                    PUSH(result);
                     return INTERPRET_OK;
                 }
                 
-                // Return from function
-                vm->frame_count--;
-                ip = vm->frames[vm->frame_count];
-                break;
+                // Drop the callee, arguments and locals, then resume the caller
+                vm->stack_top = frame->base - 1;
+                if (!frame->discard_result) PUSH(result);
+                LOAD_FRAME();
+                ENTER_TRACE();
+                ENTER_JIT();
+                NEXT();
             }
             
-            case OP_CALL: {
+            CASE(CALL):
+            CASE(CALL_DISCARD): {
+                CHECKPOINT();
+                bool discard_result = ip[-1] == OP_CALL_DISCARD;
                 int arg_count = READ_BYTE();
-                PrismValue callee = vm_peek(vm, arg_count);
+                FunctionProto* function = callee_function(vm->stack[vm->stack_top - arg_count - 1], arg_count);
+                if (!function) return INTERPRET_RUNTIME_ERROR;
+                
+                // A prism started by OP_SPAWN already has its result
+                PrismValue joined;
+                if (vm->tasks && vm->tasks[function->chunk_index] && parallel_join(vm, function, &joined)) {
+                    vm->stack_top -= arg_count + 1;
+                    if (!discard_result) PUSH(joined);
+                    NEXT();
+                }
+                
+                int base = vm->stack_top - arg_count;
+                if (vm->frame_count >= STACK_MAX ||
+                    base + function->local_count + function->max_stack > STACK_MAX) {
+                    prism_error("Stack overflow");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 
-                // Save current IP
-                vm->frames[vm->frame_count++] = ip;
+                // Locals past the parameters start out as none
+                for (int i = function->arity; i < function->local_count; i++) {
+                    vm->stack[base + i] = NONE_VAL;
+                }
+                vm->stack_top = base + function->local_count;
+                
+                frame->ip = ip;
+                frame = &vm->frames[vm->frame_count++];
+                frame->function = function;
+                frame->chunk = function->chunk;
+                frame->ip = function->chunk->code;
+                frame->base = base;
+                frame->discard_result = discard_result;
                 
-                // Jump to function
-                ip = (int)callee.value.i;
-                break;
+                chunk = frame->chunk;
+                ip = frame->ip;
+                slots = &vm->stack[base];
+                
+                COUNT_CALL(function);
+                ENTER_TRACE();
+                ENTER_JIT();
+                NEXT();
             }
             
-            case OP_LOAD: {
-                int index = READ_BYTE();
-                // TODO: symbol lookup
-                break;
+            CASE(TAIL_CALL): {
+                CHECKPOINT();
+                int arg_count = READ_BYTE();
+                PrismValue* callee = &vm->stack[vm->stack_top - arg_count - 1];
+                FunctionProto* function = callee_function(*callee, arg_count);
+                if (!function) return INTERPRET_RUNTIME_ERROR;
+                
+                PrismValue joined;
+                if (vm->tasks && vm->tasks[function->chunk_index] && parallel_join(vm, function, &joined)) {
+                    vm->stack_top -= arg_count + 1;
+                    PUSH(joined);
+                    goto return_value;
+                }
+                
+                // Slide the callee and arguments down over the current frame's
+                // callee slot and locals, then run the new body in this frame
+                int base = frame->base;
+                if (base + function->local_count + function->max_stack > STACK_MAX) {
+                    prism_error("Stack overflow");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                
+                memmove(&vm->stack[base - 1], callee, sizeof(PrismValue) * (arg_count + 1));
+                for (int i = function->arity; i < function->local_count; i++) {
+                    vm->stack[base + i] = NONE_VAL;
+                }
+                vm->stack_top = base + function->local_count;
+                
+                frame->function = function;
+                frame->chunk = function->chunk;
+                chunk = frame->chunk;
+                ip = chunk->code;
+                
+                COUNT_CALL(function);
+                ENTER_TRACE();
+                ENTER_JIT();
+                NEXT();
             }
             
-            case OP_STORE: {
-                int index = READ_BYTE();
-                // TODO: symbol storage
-                break;
+            CASE(SPAWN): {
+                PrismValue prism = READ_CONSTANT();
+                if (vm->use_parallel) parallel_spawn(vm, AS_PTR(prism));
+                NEXT();
             }
             
-            case OP_JUMP: {
-                int offset = READ_BYTE();
+            CASE(COROUTINE): {
+                int arg_count = READ_BYTE();
+                PrismValue* callee = &vm->stack[vm->stack_top - arg_count - 1];
+                FunctionProto* function = callee_function(*callee, arg_count);
+                if (!function) return INTERPRET_RUNTIME_ERROR;
+                
+                Coroutine* coroutine = coroutine_create(function, callee, arg_count);
+                vm->stack_top -= arg_count;
+                vm->stack[vm->stack_top - 1] = PTR_VAL(TYPE_COROUTINE, coroutine);
+                NEXT();
+            }
+            
+            CASE(RESUME): {
+                CHECKPOINT();
+                PrismValue value = POP();
+                PrismValue target = POP();
+                if (VALUE_TYPE(target) != TYPE_COROUTINE) {
+                    prism_error("Can only resume coroutines");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                
+                frame->ip = ip;
+                if (!coroutine_resume(vm, AS_PTR(target), value)) return INTERPRET_RUNTIME_ERROR;
+                LOAD_FRAME();
+                ENTER_JIT();
+                NEXT();
+            }
+            
+            CASE(YIELD): {
+                if (!vm->coroutine) {
+                    prism_error("Can only yield inside a coroutine");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                
+                PrismValue value = POP();
+                frame->ip = ip;
+                coroutine_suspend(vm);
+                PUSH(value);
+                LOAD_FRAME();
+                ENTER_JIT();
+                NEXT();
+            }
+            
+            CASE(CALL_NATIVE): {
+                const NativeFunction* native = &natives[READ_BYTE()];
+                int arg_count = READ_BYTE();
+                
+                // The native reads its arguments in place and the result
+                // takes the slot of the first one
+                PrismValue* args = &vm->stack[vm->stack_top - arg_count];
+                rope_flatten_args(args, arg_count);
+                *args = native->function(args, arg_count);
+                vm->stack_top += 1 - arg_count;
+                
+                if (vm->error.type != ERROR_NONE) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                NEXT();
+            }
+            
+            CASE(LOAD): {
+                PUSH(slots[READ_BYTE()]);
+                NEXT();
+            }
+            
+            CASE(STORE): {
+                slots[READ_BYTE()] = POP();
+                NEXT();
+            }
+            
+            CASE(LOAD_GLOBAL): {
+                PUSH(vm->globals[READ_BYTE()]);
+                NEXT();
+            }
+            
+            CASE(STORE_GLOBAL): {
+                vm->globals[READ_BYTE()] = POP();
+                NEXT();
+            }
+            
+            // Offsets are unsigned, so every jump is forward for now; a
+            // backward one must take CHECKPOINT() like the calls do
+            CASE(JUMP): {
+                int offset = READ_SHORT();
                 ip += offset;
-                break;
+                NEXT();
             }
             
-            case OP_JUMP_IF_FALSE: {
-                int offset = READ_BYTE();
-                PrismValue condition = vm_pop(vm);
+            CASE(JUMP_IF_FALSE): {
+                int offset = READ_SHORT();
+                PrismValue condition = POP();
                 
-                if ((condition.type == TYPE_BOOL && !condition.value.b) ||
-                    (condition.type == TYPE_INT && condition.value.i == 0) ||
-                    (condition.type == TYPE_FLOAT && condition.value.f == 0.0) ||
-                    (condition.type == TYPE_NONE)) {
+                if ((IS_BOOL(condition) && !AS_BOOL(condition)) ||
+                    (IS_INT(condition) && AS_INT(condition) == 0) ||
+                    (IS_FLOAT(condition) && AS_FLOAT(condition) == 0.0) ||
+                    (IS_NONE(condition))) {
                     ip += offset;
                 }
-                break;
+                NEXT();
             }
             
-            case OP_POP: {
-                vm_pop(vm);
-                break;
+            CASE(POP): {
+                vm->stack_top--;
+                NEXT();
             }
+            
+            CASE(END): {
+                // Ran off the end of the chunk without an explicit return
+                return INTERPRET_OK;
+            }
+            
+#ifndef PRISM_COMPUTED_GOTO
+            default:
+                prism_error("Unknown opcode %d", ip[-1]);
+                return INTERPRET_RUNTIME_ERROR;
         }
-        
-        if (ip >= chunk->count) {
-            return INTERPRET_OK;
-        }
+#endif
     }
     
     #undef READ_BYTE
+    #undef READ_SHORT
     #undef READ_CONSTANT
+    #undef QUICKEN
+    #undef PUSH
+    #undef POP
+    #undef LOAD_FRAME
+    #undef COUNT_CALL
+    #undef CHECKPOINT
+    #undef ENTER_JIT
+    #undef ENTER_TRACE
+    #undef RECORD
+    #undef START_RECORDING
+    #undef STOP_RECORDING
+    #undef CASE
+    #undef NEXT
+#ifdef PRISM_COMPUTED_GOTO
+    #undef DISPATCH
+#endif
     
     return INTERPRET_OK;
 }
 
-InterpretResult vm_interpret(VM* vm, const char* source, const char* filename) {
-    // Create lexer
-    Lexer* lexer = lexer_create(source, filename);
-    lexer_scan_tokens(lexer);
+// Runs or resumes the script with its output selected, and tidies up once
+// it has finished rather than suspended
+static InterpretResult run_script(VM* vm) {
+    vm->suspended = false;
     
-    int token_count;
-    Token* tokens = lexer_get_tokens(lexer, &token_count);
+    FILE* previous = prism_output();
+    GcHeap* previous_heap = gc_current();
+    prism_set_output(vm->output);
+    gc_set_current(vm->heap);
+    InterpretResult result = run(vm);
+    gc_set_current(previous_heap);
+    prism_set_output(previous);
+    if (result == INTERPRET_SUSPENDED) return result;
     
-    if (prism_get_last_error()->type != ERROR_NONE) {
-        lexer_free(lexer);
-        return INTERPRET_COMPILE_ERROR;
+    // Prisms spawned but never called still hold a copy of the program
+    parallel_finish(vm);
+    return result;
+}
+
+/* Each entry point makes the VM's error state current while it runs and
+ * restores the caller's on the way out, so that a VM taking its turn on a
+ * thread neither sees nor leaves behind another VM's error. */
+static PrismError* enter(VM* vm, bool fresh) {
+    PrismError* previous = prism_get_last_error();
+    prism_set_error_state(&vm->error);
+    if (fresh) prism_reset_error(&vm->error);
+    return previous;
+}
+
+static InterpretResult leave(PrismError* previous, InterpretResult result) {
+    prism_set_error_state(previous);
+    return result;
+}
+
+static InterpretResult run_from_start(VM* vm) {
+    if (!vm->code_gen) return INTERPRET_RUNTIME_ERROR;
+    
+    FunctionProto* script = vm->code_gen->functions[0];
+    if (script->max_stack > STACK_MAX) {
+        prism_error("Script needs %d stack slots, the VM provides %d", script->max_stack, STACK_MAX);
+        return INTERPRET_RUNTIME_ERROR;
     }
     
-    // Parse tokens
-    Parser* parser = parser_create(tokens, token_count);
-    Program* program = parser_parse(parser);
+    // Globals start out as none on every run
+    if (vm->global_count != vm->code_gen->global_count) {
+        vm->global_count = vm->code_gen->global_count;
+        vm->globals = prism_realloc(vm->globals, sizeof(PrismValue) * (vm->global_count + 1));
+    }
+    for (int i = 0; i < vm->global_count; i++) {
+        vm->globals[i] = NONE_VAL;
+    }
     
-    if (prism_get_last_error()->type != ERROR_NONE) {
-        parser_free(parser);
-        lexer_free(lexer);
-        return INTERPRET_COMPILE_ERROR;
+    // Coroutines left running by an error in the previous run are collected
+    // once nothing refers to them
+    vm->coroutine = NULL;
+    
+    // A recording cut short by an error in the previous run is dropped
+    if (vm->recorder) {
+        trace_abort(vm->recorder);
+        vm->recorder = NULL;
     }
     
-    // Generate code
-    vm->code_gen = codegen_create();
-    codegen_generate(vm->code_gen, program);
+    vm->stack_top = 0;
+    vm->frame_count = 1;
+    
+    CallFrame* frame = &vm->frames[0];
+    frame->function = script;
+    frame->chunk = script->chunk;
+    frame->ip = script->chunk->code;
+    frame->base = 0;
+    frame->discard_result = false;
     
-    if (prism_get_last_error()->type != ERROR_NONE) {
-        ast_free_program(program);
-        parser_free(parser);
-        lexer_free(lexer);
-        return INTERPRET_COMPILE_ERROR;
+    return run_script(vm);
+}
+
+InterpretResult vm_run(VM* vm) {
+    PrismError* previous = enter(vm, true);
+    return leave(previous, run_from_start(vm));
+}
+
+InterpretResult vm_resume(VM* vm) {
+    PrismError* previous = enter(vm, false);
+    if (!vm->code_gen || !vm->suspended) {
+        prism_error("Can only resume a suspended VM");
+        return leave(previous, INTERPRET_RUNTIME_ERROR);
     }
     
-    // Run the bytecode
+    return leave(previous, run_script(vm));
+}
+
+static InterpretResult run_prism(VM* vm, FunctionProto* prism) {
+    if (!vm->code_gen) return INTERPRET_RUNTIME_ERROR;
+    
+    // The prism sits in slot 0 as its own callee, as if the script had
+    // called it, so tail calls have a slot to slide into
+    int base = 1;
+    if (base + prism->local_count + prism->max_stack > STACK_MAX) {
+        prism_error("Stack overflow");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    
+    vm->stack[0] = PTR_VAL(TYPE_PRISM, prism);
+    for (int i = 0; i < prism->local_count; i++) {
+        vm->stack[base + i] = NONE_VAL;
+    }
+    vm->stack_top = base + prism->local_count;
+    vm->frame_count = 1;
+    vm->coroutine = NULL;
+    
+    CallFrame* frame = &vm->frames[0];
+    frame->function = prism;
+    frame->chunk = prism->chunk;
+    frame->ip = prism->chunk->code;
+    frame->base = base;
+    frame->discard_result = false;
+    
+    FILE* previous = prism_output();
+    GcHeap* previous_heap = gc_current();
+    prism_set_output(vm->output);
+    gc_set_current(vm->heap);
     InterpretResult result = run(vm);
     
-    // Cleanup
-    ast_free_program(program);
+    // Flattened while the heap is current, so the caller gets a plain string
+    if (result == INTERPRET_OK) rope_flatten_args(vm->stack, 1);
+    gc_set_current(previous_heap);
+    prism_set_output(previous);
+    return result;
+}
+
+InterpretResult vm_run_prism(VM* vm, FunctionProto* prism) {
+    PrismError* previous = enter(vm, true);
+    return leave(previous, run_prism(vm, prism));
+}
+
+static InterpretResult interpret(VM* vm, const char* source, const char* filename) {
+    // The tokens and the tree live in one arena, freed once code is generated
+    Arena* arena = arena_create();
+    Arena* previous_arena = arena_current();
+    arena_set_current(arena);
+    
+    // Create lexer
+    Lexer* lexer = lexer_create(source, filename);
+    lexer_scan_tokens(lexer);
+    
+    // Parse tokens
+    Parser* parser = NULL;
+    Program* program = NULL;
+    if (prism_get_last_error()->type == ERROR_NONE) {
+        parser = parser_create(lexer_get_tokens(lexer));
+        program = parser_parse(parser);
+    }
+    arena_set_current(previous_arena);
+    
+    // Generate code, with the standard library registered so calls to
+    // natives can be bound at compile time
+    if (prism_get_last_error()->type == ERROR_NONE) {
+        vm->code_gen = codegen_create();
+        prism_std_register_all(vm);
+        prism_io_register_all(vm);
+        codegen_generate(vm->code_gen, program);
+    }
+    
     parser_free(parser);
     lexer_free(lexer);
+    arena_free(arena);
     
-    return result;
+    if (prism_get_last_error()->type != ERROR_NONE) {
+        return INTERPRET_COMPILE_ERROR;
+    }
+    
+    // Run the bytecode
+    return run_from_start(vm);
+}
+
+InterpretResult vm_interpret(VM* vm, const char* source, const char* filename) {
+    PrismError* previous = enter(vm, true);
+    return leave(previous, interpret(vm, source, filename));
 }
\ No newline at end of file
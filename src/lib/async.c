@@ -0,0 +1,504 @@
+#include "../../include/lib/async.h"
+#include "../../include/core/scheduler.h"
+#include "../../include/common/memory.h"
+#include "../../include/common/error.h"
+#include "../../include/common/gc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(PRISM_NO_IO_URING)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define PRISM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+// Submission queue size; the completion queue is twice as large
+#define RING_ENTRIES 64
+// Helper threads for the blocking fallback
+#define FALLBACK_WORKERS 8
+// Largest single transfer handed to the kernel
+#define MAX_TRANSFER (1u << 30)
+
+typedef enum {
+    FUTURE_READ,
+    FUTURE_WRITE,
+    FUTURE_APPEND
+} FutureKind;
+
+struct PrismFuture {
+    FutureKind kind;
+    char* path;
+    int fd;
+    bool opened;            // false if the error is from opening the file
+
+    // The data read so far, or a copy of the data to write
+    char* buffer;
+    size_t size;
+    size_t transferred;
+    int error;              // errno of the failure, 0 if none
+
+    // What await gives, settled the first time it is called; the path and
+    // the buffer are freed then
+    bool settled;
+    PrismValue result;
+    char* message;          // why it failed, NULL if it didn't
+
+    // Only touched by the thread that started the operation
+    bool done;
+    bool on_ring;
+    struct PrismFuture* prev;
+    struct PrismFuture* next;
+
+    SchedulerTask task;     // the blocking transfer, for the fallback
+};
+
+// Operations the calling thread started and hasn't waited for yet
+static _Thread_local PrismFuture* pending;
+
+static void track(PrismFuture* future) {
+    future->prev = NULL;
+    future->next = pending;
+    if (pending) pending->prev = future;
+    pending = future;
+}
+
+static void untrack(PrismFuture* future) {
+    if (future->prev) future->prev->next = future->next;
+    else if (pending == future) pending = future->next;
+    if (future->next) future->next->prev = future->prev;
+    future->prev = future->next = NULL;
+}
+
+// Accounts for one transfer, result being a byte count or a negated errno.
+// True once the operation is over.
+static bool advance(PrismFuture* future, long result) {
+    if (result < 0) {
+        future->error = (int)-result;
+        return true;
+    }
+
+    future->transferred += result;
+    if (future->transferred == future->size) return true;
+    if (result == 0) {
+        // A read stops early if the file shrank; a write must not
+        if (future->kind != FUTURE_READ) future->error = EIO;
+        return true;
+    }
+    return false;
+}
+
+// Closes the file and terminates what was read
+static void conclude(PrismFuture* future) {
+    if (future->fd >= 0) {
+        close(future->fd);
+        future->fd = -1;
+    }
+    if (future->kind == FUTURE_READ && future->buffer) {
+        future->buffer[future->transferred] = '\0';
+    }
+}
+
+static size_t transfer_length(PrismFuture* future) {
+    size_t remaining = future->size - future->transferred;
+    return remaining < MAX_TRANSFER ? remaining : MAX_TRANSFER;
+}
+
+/* Blocking fallback: each operation runs start to finish on one of the
+ * helper threads. */
+
+static Scheduler* helpers;
+static pthread_once_t helpers_once = PTHREAD_ONCE_INIT;
+
+static void start_helpers() {
+    helpers = scheduler_create(FALLBACK_WORKERS);
+}
+
+static void run_blocking(void* arg) {
+    PrismFuture* future = arg;
+    long result;
+
+    do {
+        char* at = future->buffer + future->transferred;
+        if (future->kind == FUTURE_READ) {
+            result = pread(future->fd, at, transfer_length(future), (off_t)future->transferred);
+        } else {
+            result = pwrite(future->fd, at, transfer_length(future), (off_t)future->transferred);
+        }
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            result = -errno;
+        }
+    } while (!advance(future, result));
+
+    conclude(future);
+}
+
+#ifdef PRISM_IO_URING
+
+/* One ring per thread, so submissions need no locking. The kernel reads the
+ * submission queue and writes the completion queue; each side publishes its
+ * tail with a release store and consumes the other's with an acquire load. */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned cq_entries;
+    int in_flight;          // queued or submitted, not yet completed
+    unsigned unsubmitted;   // queued but not yet taken by the kernel
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+} Ring;
+
+static _Thread_local Ring* ring;
+static _Thread_local bool ring_unavailable;
+
+// Plain reads and writes arrived in Linux 5.6, along with the probe
+static bool ring_supports_transfers(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = prism_alloc(size);
+
+    bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                     probe->last_op >= IORING_OP_WRITE &&
+                     (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                     (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+
+    prism_free(probe);
+    return supported;
+}
+
+static void ring_close(Ring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    prism_free(ring);
+}
+
+static void* map_ring(int fd, size_t size, off_t offset) {
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static Ring* ring_open() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0) return NULL;
+    if (!ring_supports_transfers(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    Ring* ring = prism_alloc(sizeof(Ring));
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->cq_entries = params.cq_entries;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both queues with a single call
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+        ring->sq_map = map_ring(fd, ring->sq_map_size, IORING_OFF_SQ_RING);
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->sq_map = map_ring(fd, ring->sq_map_size, IORING_OFF_SQ_RING);
+        ring->cq_map = map_ring(fd, ring->cq_map_size, IORING_OFF_CQ_RING);
+    }
+    ring->sqes = map_ring(fd, ring->sqes_size, IORING_OFF_SQES);
+
+    if (!ring->sq_map || !ring->cq_map || !ring->sqes) {
+        ring_close(ring);
+        return NULL;
+    }
+
+    char* sq = ring->sq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = ring->cq_map;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+// The calling thread's ring, set up on first use; NULL if io_uring can't
+// be used here
+static Ring* thread_ring() {
+    if (!ring && !ring_unavailable) {
+        ring = ring_open();
+        ring_unavailable = !ring;
+    }
+    return ring;
+}
+
+// Hands queued entries to the kernel, and with wait set blocks until at
+// least one completion has been posted. Entries the kernel doesn't take
+// now, for lack of resources, stay queued for the next call.
+static void ring_enter(Ring* ring, bool wait) {
+    long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, wait ? 1 : 0,
+                             wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted > 0) ring->unsubmitted -= (unsigned)submitted;
+}
+
+static void ring_queue(Ring* ring, PrismFuture* future);
+
+static void ring_reap(Ring* ring) {
+    unsigned head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        PrismFuture* future = (PrismFuture*)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+
+        // Free the slot before queueing the rest of a short transfer
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        ring->in_flight--;
+
+        if (advance(future, result)) {
+            conclude(future);
+            future->done = true;
+        } else {
+            ring_queue(ring, future);
+        }
+    }
+}
+
+static void ring_queue(Ring* ring, PrismFuture* future) {
+    // Every operation in flight needs room for its completion
+    while (ring->in_flight >= (int)ring->cq_entries ||
+           *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) {
+        ring_enter(ring, ring->in_flight > 0);
+        ring_reap(ring);
+    }
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    // O_APPEND files ignore the offset and always write at the end
+    sqe->opcode = future->kind == FUTURE_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = future->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(future->buffer + future->transferred);
+    sqe->len = (unsigned)transfer_length(future);
+    sqe->off = future->transferred;
+    sqe->user_data = (uint64_t)(uintptr_t)future;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->in_flight++;
+    ring->unsubmitted++;
+}
+
+#endif /* PRISM_IO_URING */
+
+static void wait_for(PrismFuture* future);
+
+static void trace_future(GcHeap* heap, void* object) {
+    PrismFuture* future = object;
+    gc_visit(heap, &future->result, 1);
+}
+
+// The kernel or a helper may still be writing to the buffer of a future
+// nothing refers to any more
+static void free_future(void* object) {
+    PrismFuture* future = object;
+    wait_for(future);
+    prism_free(future->path);
+    prism_free(future->buffer);
+    prism_free(future->message);
+}
+
+static pthread_once_t kind_once = PTHREAD_ONCE_INIT;
+
+static void define_kind() {
+    gc_define_kind(GC_FUTURE, trace_future, free_future);
+}
+
+static PrismFuture* new_future(FutureKind kind, const char* path) {
+    pthread_once(&kind_once, define_kind);
+    PrismFuture* future = gc_alloc(GC_FUTURE, sizeof(PrismFuture));
+    memset(future, 0, sizeof(PrismFuture));
+    future->kind = kind;
+    future->path = strdup(path);
+    future->fd = -1;
+    future->result = NONE_VAL;
+    return future;
+}
+
+// Starts the transfers once the file is open
+static void start(PrismFuture* future) {
+    if (future->size == 0) {
+        conclude(future);
+        future->done = true;
+        return;
+    }
+    track(future);
+
+#ifdef PRISM_IO_URING
+    Ring* ring = thread_ring();
+    if (ring) {
+        future->on_ring = true;
+        ring_queue(ring, future);
+        // Submitted straight away so the kernel works while the script runs
+        ring_enter(ring, false);
+        return;
+    }
+#endif
+
+    pthread_once(&helpers_once, start_helpers);
+    if (!helpers) {
+        // Without helper threads the transfer just blocks
+        run_blocking(future);
+        future->done = true;
+        untrack(future);
+        return;
+    }
+
+    future->task.run = run_blocking;
+    future->task.arg = future;
+    scheduler_spawn(helpers, &future->task);
+}
+
+// Failures to open are reported when the future is awaited, like any other
+static void fail_open(PrismFuture* future) {
+    future->error = errno;
+    conclude(future);
+    future->done = true;
+}
+
+PrismFuture* async_read_file(const char* path) {
+    PrismFuture* future = new_future(FUTURE_READ, path);
+
+    struct stat info;
+    future->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (future->fd < 0 || fstat(future->fd, &info) < 0) {
+        fail_open(future);
+        return future;
+    }
+    future->opened = true;
+
+    future->size = (size_t)info.st_size;
+    future->buffer = prism_alloc(future->size + 1);
+    start(future);
+    return future;
+}
+
+PrismFuture* async_write_file(const char* path, const char* content, bool append) {
+    PrismFuture* future = new_future(append ? FUTURE_APPEND : FUTURE_WRITE, path);
+
+    future->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+    if (future->fd < 0) {
+        fail_open(future);
+        return future;
+    }
+    future->opened = true;
+
+    // The string may not outlive the transfer
+    future->size = strlen(content);
+    future->buffer = prism_alloc(future->size + 1);
+    memcpy(future->buffer, content, future->size);
+    start(future);
+    return future;
+}
+
+static void wait_for(PrismFuture* future) {
+#ifdef PRISM_IO_URING
+    if (future->on_ring) {
+        while (!future->done) {
+            ring_enter(ring, true);
+            ring_reap(ring);
+        }
+    }
+#endif
+
+    if (!future->done) {
+        scheduler_join(helpers, &future->task);
+        future->done = true;
+    }
+    untrack(future);
+}
+
+// Copies what was read into the current heap and keeps the answer, so the
+// path and the buffer can go
+static void settle(PrismFuture* future) {
+    wait_for(future);
+
+    bool read = future->kind == FUTURE_READ;
+    if (future->error == 0) {
+        future->result = read ? prism_string_value(future->buffer, future->transferred) : BOOL_VAL(true);
+    } else {
+        char message[1024];
+        if (!future->opened) {
+            snprintf(message, sizeof(message), "Could not open file '%s' for %s", future->path,
+                     read ? "reading" : future->kind == FUTURE_WRITE ? "writing" : "appending");
+        } else {
+            snprintf(message, sizeof(message), "Could not %s file '%s': %s", read ? "read" : "write",
+                     future->path, strerror(future->error));
+        }
+        future->message = strdup(message);
+        future->result = read ? prism_string_value("", 0) : BOOL_VAL(false);
+    }
+    gc_write_barrier(GC_FUTURE, future);
+
+    prism_free(future->path);
+    prism_free(future->buffer);
+    future->path = NULL;
+    future->buffer = NULL;
+    future->settled = true;
+}
+
+bool async_await(PrismFuture* future, PrismValue* result) {
+    if (!future->settled) settle(future);
+
+    *result = future->result;
+    if (future->message) {
+        prism_error("%s", future->message);
+        return false;
+    }
+    return true;
+}
+
+void async_finish() {
+    while (pending) {
+        wait_for(pending);
+    }
+
+#ifdef PRISM_IO_URING
+    if (ring) {
+        ring_close(ring);
+        ring = NULL;
+    }
+    ring_unavailable = false;
+#endif
+}
@@ -1,7 +1,9 @@
 #include "../../include/lib/io.h"
+#include "../../include/lib/async.h"
 #include "../../include/common/memory.h"
 #include "../../include/common/error.h"
 #include "../../include/common/util.h"
+#include "../../include/common/gc.h"
 #include "../../include/core/vm.h"
 #include "../../include/core/codegen.h"
 #include <stdio.h>
@@ -21,6 +23,10 @@ static IoFunction io_functions[] = {
     {"append_file", prism_io_append_file},
     {"file_exists", prism_io_file_exists},
     {"delete_file", prism_io_delete_file},
+    {"read_file_async", prism_io_read_file_async},
+    {"write_file_async", prism_io_write_file_async},
+    {"append_file_async", prism_io_append_file_async},
+    {"await", prism_io_await},
     {NULL, NULL} // Sentinel
 };
 
@@ -29,41 +35,38 @@ void prism_io_init() {
 };
 
 void prism_io_cleanup() {
-    // TODO: io cleanup
+    // Outstanding writes still land before the program exits
+    async_finish();
 };
 
 PrismValue prism_io_read_file(PrismValue* args, int arg_count) {
-    if (arg_count < 1 || args[0].type != TYPE_STRING) {
+    if (arg_count < 1 || !IS_STRING(args[0])) {
         prism_error("read_file requires a string filename argument");
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup("");
-        return result;
+        return prism_string_value("", 0);
     }
     
-    FILE* file = fopen(args[0].value.s, "r");
+    FILE* file = fopen(AS_STRING(args[0]), "r");
     if (!file) {
-        prism_error("Could not open file '%s' for reading", args[0].value.s);
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup("");
-        return result;
+        prism_error("Could not open file '%s' for reading", AS_STRING(args[0]));
+        return prism_string_value("", 0);
     }
     
     // Get file size
     fseek(file, 0, SEEK_END);
     long size = ftell(file);
     rewind(file);
+    if (size < 0) {
+        fclose(file);
+        prism_error("Could not read file '%s'", AS_STRING(args[0]));
+        return prism_string_value("", 0);
+    }
     
     // Allocate buffer
-    char* buffer = prism_alloc(size + 1);
+    char* buffer = gc_alloc_string(size);
     if (!buffer) {
         fclose(file);
-        prism_error("Not enough memory to read file '%s'", args[0].value.s);
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup("");
-        return result;
+        prism_error("Not enough memory to read file '%s'", AS_STRING(args[0]));
+        return prism_string_value("", 0);
     }
     
     // Read file content
@@ -71,98 +74,103 @@ PrismValue prism_io_read_file(PrismValue* args, int arg_count) {
     buffer[read_size] = '\0';
     fclose(file);
     
-    PrismValue result;
-    result.type = TYPE_STRING;
-    result.value.s = buffer;
-    return result;
+    return STRING_VAL(buffer);
 }
 
 PrismValue prism_io_write_file(PrismValue* args, int arg_count) {
-    if (arg_count < 2 || args[0].type != TYPE_STRING || args[1].type != TYPE_STRING) {
+    if (arg_count < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
         prism_error("write_file requires string filename and content arguments");
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        return BOOL_VAL(false);
     }
     
-    FILE* file = fopen(args[0].value.s, "w");
+    FILE* file = fopen(AS_STRING(args[0]), "w");
     if (!file) {
-        prism_error("Could not open file '%s' for writing", args[0].value.s);
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        prism_error("Could not open file '%s' for writing", AS_STRING(args[0]));
+        return BOOL_VAL(false);
     }
     
-    fputs(args[1].value.s, file);
+    fputs(AS_STRING(args[1]), file);
     fclose(file);
     
-    PrismValue result;
-    result.type = TYPE_BOOL;
-    result.value.b = true;
-    return result;
+    return BOOL_VAL(true);
 }
 
 PrismValue prism_io_append_file(PrismValue* args, int arg_count) {
-    if (arg_count < 2 || args[0].type != TYPE_STRING || args[1].type != TYPE_STRING) {
+    if (arg_count < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
         prism_error("append_file requires string filename and content arguments");
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        return BOOL_VAL(false);
     }
     
-    FILE* file = fopen(args[0].value.s, "a");
+    FILE* file = fopen(AS_STRING(args[0]), "a");
     if (!file) {
-        prism_error("Could not open file '%s' for appending", args[0].value.s);
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        prism_error("Could not open file '%s' for appending", AS_STRING(args[0]));
+        return BOOL_VAL(false);
     }
     
-    fputs(args[1].value.s, file);
+    fputs(AS_STRING(args[1]), file);
     fclose(file);
     
-    PrismValue result;
-    result.type = TYPE_BOOL;
-    result.value.b = true;
-    return result;
+    return BOOL_VAL(true);
 }
 
 PrismValue prism_io_file_exists(PrismValue* args, int arg_count) {
-    if (arg_count < 1 || args[0].type != TYPE_STRING) {
+    if (arg_count < 1 || !IS_STRING(args[0])) {
         prism_error("file_exists requires a string filename argument");
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        return BOOL_VAL(false);
     }
     
     struct stat buffer;
-    bool exists = (stat(args[0].value.s, &buffer) == 0);
+    bool exists = (stat(AS_STRING(args[0]), &buffer) == 0);
     
-    PrismValue result;
-    result.type = TYPE_BOOL;
-    result.value.b = exists;
-    return result;
+    return BOOL_VAL(exists);
 }
 
 PrismValue prism_io_delete_file(PrismValue* args, int arg_count) {
-    if (arg_count < 1 || args[0].type != TYPE_STRING) {
+    if (arg_count < 1 || !IS_STRING(args[0])) {
         prism_error("delete_file requires a string filename argument");
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        return BOOL_VAL(false);
+    }
+    
+    int status = unlink(AS_STRING(args[0]));
+    
+    return BOOL_VAL((status == 0));
+}
+
+PrismValue prism_io_read_file_async(PrismValue* args, int arg_count) {
+    if (arg_count < 1 || !IS_STRING(args[0])) {
+        prism_error("read_file_async requires a string filename argument");
+        return NONE_VAL;
     }
     
-    int status = unlink(args[0].value.s);
+    return PTR_VAL(TYPE_FUTURE, async_read_file(AS_STRING(args[0])));
+}
+
+PrismValue prism_io_write_file_async(PrismValue* args, int arg_count) {
+    if (arg_count < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
+        prism_error("write_file_async requires string filename and content arguments");
+        return NONE_VAL;
+    }
+    
+    return PTR_VAL(TYPE_FUTURE, async_write_file(AS_STRING(args[0]), AS_STRING(args[1]), false));
+}
+
+PrismValue prism_io_append_file_async(PrismValue* args, int arg_count) {
+    if (arg_count < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
+        prism_error("append_file_async requires string filename and content arguments");
+        return NONE_VAL;
+    }
+    
+    return PTR_VAL(TYPE_FUTURE, async_write_file(AS_STRING(args[0]), AS_STRING(args[1]), true));
+}
+
+PrismValue prism_io_await(PrismValue* args, int arg_count) {
+    if (arg_count < 1 || VALUE_TYPE(args[0]) != TYPE_FUTURE) {
+        prism_error("await requires a future argument");
+        return NONE_VAL;
+    }
     
     PrismValue result;
-    result.type = TYPE_BOOL;
-    result.value.b = (status == 0);
+    async_await(AS_PTR(args[0]), &result);
     return result;
 }
 
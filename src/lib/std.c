@@ -5,6 +5,7 @@
 #include "../../include/common/util.h"
 #include "../../include/core/vm.h"
 #include "../../include/core/codegen.h"
+#include "../../include/core/coroutine.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -12,6 +13,7 @@
 typedef struct {
     const char* name;
     PrismValue (*function)(PrismValue*, int);
+    bool pure;      // no I/O, so safe to call from a prism on another thread
 } StdFunction;
 
 // Forward declarations
@@ -23,17 +25,19 @@ PrismValue prism_std_string(PrismValue* args, int arg_count);
 PrismValue prism_std_int(PrismValue* args, int arg_count);
 PrismValue prism_std_float(PrismValue* args, int arg_count);
 PrismValue prism_std_bool(PrismValue* args, int arg_count);
+PrismValue prism_std_done(PrismValue* args, int arg_count);
 
 static StdFunction std_functions[] = {
-    {"print", prism_std_print},
-    {"render", prism_std_render},
-    {"input", prism_std_input},
-    {"type", prism_std_type},
-    {"string", prism_std_string},
-    {"int", prism_std_int},
-    {"float", prism_std_float},
-    {"bool", prism_std_bool},
-    {NULL, NULL} // Sentinel
+    {"print", prism_std_print, false},
+    {"render", prism_std_render, false},
+    {"input", prism_std_input, false},
+    {"type", prism_std_type, true},
+    {"string", prism_std_string, true},
+    {"int", prism_std_int, true},
+    {"float", prism_std_float, true},
+    {"bool", prism_std_bool, true},
+    {"done", prism_std_done, false},
+    {NULL, NULL, false} // Sentinel
 };
 
 void prism_std_init() {
@@ -48,27 +52,23 @@ PrismValue prism_std_print(PrismValue* args, int arg_count) {
     for (int i = 0; i < arg_count; i++) {
         prism_print_value(args[i]);
         if (i < arg_count - 1) {
-            printf(" ");
+            fputs(" ", prism_output());
         }
     }
     
-    PrismValue result;
-    result.type = TYPE_NONE;
-    return result;
+    return NONE_VAL;
 }
 
 PrismValue prism_std_render(PrismValue* args, int arg_count) {
     for (int i = 0; i < arg_count; i++) {
         prism_print_value(args[i]);
         if (i < arg_count - 1) {
-            printf(" ");
+            fputs(" ", prism_output());
         }
     }
-    printf("\n");
+    fputc('\n', prism_output());
     
-    PrismValue result;
-    result.type = TYPE_NONE;
-    return result;
+    return NONE_VAL;
 }
 
 PrismValue prism_std_input(PrismValue* args, int arg_count) {
@@ -85,40 +85,26 @@ PrismValue prism_std_input(PrismValue* args, int arg_count) {
             buffer[len-1] = '\0';
         }
         
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup(buffer);
-        return result;
+        return prism_string_value(buffer, strlen(buffer));
     }
     
-    PrismValue result;
-    result.type = TYPE_STRING;
-    result.value.s = strdup("");
-    return result;
+    return prism_string_value("", 0);
 }
 
 PrismValue prism_std_type(PrismValue* args, int arg_count) {
     if (arg_count < 1) {
         prism_error("Type function requires at least one argument");
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup("unknown");
-        return result;
+        return prism_string_value("unknown", 7);
     }
     
-    PrismValue result;
-    result.type = TYPE_STRING;
-    result.value.s = strdup(prism_type_to_string(args[0].type));
-    return result;
+    const char* name = prism_type_to_string(VALUE_TYPE(args[0]));
+    return prism_string_value(name, strlen(name));
 }
 
 PrismValue prism_std_string(PrismValue* args, int arg_count) {
     if (arg_count < 1) {
         prism_error("String conversion requires at least one argument");
-        PrismValue result;
-        result.type = TYPE_STRING;
-        result.value.s = strdup("");
-        return result;
+        return prism_string_value("", 0);
     }
     
     return prism_value_convert(args[0], TYPE_STRING);
@@ -127,10 +113,7 @@ PrismValue prism_std_string(PrismValue* args, int arg_count) {
 PrismValue prism_std_int(PrismValue* args, int arg_count) {
     if (arg_count < 1) {
         prism_error("Int conversion requires at least one argument");
-        PrismValue result;
-        result.type = TYPE_INT;
-        result.value.i = 0;
-        return result;
+        return INT_VAL(0);
     }
     
     return prism_value_convert(args[0], TYPE_INT);
@@ -139,10 +122,7 @@ PrismValue prism_std_int(PrismValue* args, int arg_count) {
 PrismValue prism_std_float(PrismValue* args, int arg_count) {
     if (arg_count < 1) {
         prism_error("Float conversion requires at least one argument");
-        PrismValue result;
-        result.type = TYPE_FLOAT;
-        result.value.f = 0.0;
-        return result;
+        return FLOAT_VAL(0.0);
     }
     
     return prism_value_convert(args[0], TYPE_FLOAT);
@@ -151,21 +131,33 @@ PrismValue prism_std_float(PrismValue* args, int arg_count) {
 PrismValue prism_std_bool(PrismValue* args, int arg_count) {
     if (arg_count < 1) {
         prism_error("Bool conversion requires at least one argument");
-        PrismValue result;
-        result.type = TYPE_BOOL;
-        result.value.b = false;
-        return result;
+        return BOOL_VAL(false);
     }
     
     return prism_value_convert(args[0], TYPE_BOOL);
 }
 
+// Whether a coroutine has returned, so resuming it again would fail
+PrismValue prism_std_done(PrismValue* args, int arg_count) {
+    if (arg_count < 1 || VALUE_TYPE(args[0]) != TYPE_COROUTINE) {
+        prism_error("done requires a coroutine argument");
+        return BOOL_VAL(false);
+    }
+    
+    Coroutine* coroutine = AS_PTR(args[0]);
+    return BOOL_VAL(coroutine->state == COROUTINE_DONE);
+}
+
 void prism_std_register_all(void* vm_ptr) {
     VM* vm = (VM*)vm_ptr;
     if (!vm || !vm->code_gen) return;
     
     // Register all standard library functions
     for (int i = 0; std_functions[i].name != NULL; i++) {
-        codegen_add_native_function(vm->code_gen, std_functions[i].name, std_functions[i].function);
+        if (std_functions[i].pure) {
+            codegen_add_pure_native_function(vm->code_gen, std_functions[i].name, std_functions[i].function);
+        } else {
+            codegen_add_native_function(vm->code_gen, std_functions[i].name, std_functions[i].function);
+        }
     }
 }
\ No newline at end of file
@@ -3,22 +3,38 @@
 #include "../include/core/ast.h"
 #include "../include/core/symtab.h"
 #include "../include/core/vm.h"
+#include "../include/core/aot.h"
+#include "../include/core/pool.h"
 #include "../include/common/error.h"
 #include "../include/common/memory.h"
 #include "../include/common/util.h"
+#include "../include/common/gc.h"
+#include "../include/common/arena.h"
 #include "../include/lib/std.h"
 #include "../include/lib/io.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef PRISM_PROFILE_PAIRS
+static void print_pair_profile(void) {
+    vm_print_pair_profile(stderr);
+}
+#endif
+
 static void print_usage(const char* program_name) {
     printf("Usage: %s [options] [script]\n", program_name);
     printf("Options:\n");
     printf("  -h, --help        Show this help message\n");
     printf("  -v, --version     Show version information\n");
     printf("  -i, --interactive Run in interactive mode\n");
-    printf("  -c, --compile     Compile script to bytecode\n");
+    printf("  -c, --compile     Compile script to a native executable with the C compiler\n");
+    printf("  -o, --output      Path of the compiled executable, or of the C source if it ends in .c\n");
+    printf("  -j, --jit         Compile hot functions to machine code\n");
+    printf("  -t, --trace       Compile traces through hot paths to machine code\n");
+    printf("  -p, --parallel N  Run every script given at once on N worker threads (0: one per core)\n");
+    printf("  -a, --auto-parallel Run prisms that share no state on other threads\n");
+    printf("  -g, --gc-stats    Print garbage collector statistics after the script runs\n");
 }
 
 static void print_version() {
@@ -50,7 +66,23 @@ static void repl() {
     vm_free(vm);
 }
 
-static void run_file(const char* path) {
+static void print_gc_stats(VM* vm) {
+    GcStats stats;
+    gc_get_stats(vm->heap, &stats);
+    uint64_t collections = stats.minor_collections + stats.major_collections;
+    
+    fprintf(stderr, "gc: %llu minor, %llu major collections\n",
+            (unsigned long long)stats.minor_collections, (unsigned long long)stats.major_collections);
+    fprintf(stderr, "gc: pauses %.3f ms total, %.3f ms max, %.3f ms mean\n",
+            stats.total_pause / 1e6, stats.max_pause / 1e6,
+            collections ? stats.total_pause / 1e6 / collections : 0.0);
+    fprintf(stderr, "gc: nursery %zu of %zu bytes, old generation %zu bytes in %zu objects\n",
+            stats.nursery_used, stats.nursery_size, stats.old_bytes, stats.old_objects);
+    fprintf(stderr, "gc: %zu bytes promoted, %zu bytes freed\n",
+            stats.promoted_bytes, stats.freed_bytes);
+}
+
+static void run_file(const char* path, bool use_jit, bool use_tracing, bool use_parallel, bool gc_stats) {
     char* source = prism_read_file(path);
     if (!source) {
         fprintf(stderr, "Could not read file '%s'\n", path);
@@ -58,7 +90,11 @@ static void run_file(const char* path) {
     }
     
     VM* vm = vm_create();
+    vm->use_jit = use_jit;
+    vm->use_tracing = use_tracing;
+    vm->use_parallel = use_parallel;
     InterpretResult result = vm_interpret(vm, source, path);
+    if (gc_stats) print_gc_stats(vm);
     vm_free(vm);
     prism_free(source);
     
@@ -66,11 +102,113 @@ static void run_file(const char* path) {
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+// Runs each script on its own VM in a worker pool, then prints their output
+// in the order given. Exits with the status of the most serious failure.
+static void run_parallel(const char** paths, int count, int workers, bool use_jit, bool use_tracing) {
+    PrismJob* jobs = prism_alloc(sizeof(PrismJob) * count);
+    char** sources = prism_alloc(sizeof(char*) * count);
+    
+    for (int i = 0; i < count; i++) {
+        sources[i] = prism_read_file(paths[i]);
+        if (!sources[i]) {
+            fprintf(stderr, "Could not read file '%s'\n", paths[i]);
+            exit(74);
+        }
+        jobs[i].source = sources[i];
+        jobs[i].filename = paths[i];
+        jobs[i].use_jit = use_jit;
+        jobs[i].use_tracing = use_tracing;
+    }
+    
+    WorkerPool* pool = pool_create(workers);
+    if (!pool) exit(1);
+    for (int i = 0; i < count; i++) {
+        pool_submit(pool, &jobs[i]);
+    }
+    pool_wait(pool);
+    pool_free(pool);
+    
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].output) fwrite(jobs[i].output, 1, jobs[i].output_size, stdout);
+        if (jobs[i].result == INTERPRET_COMPILE_ERROR) status = 65;
+        if (jobs[i].result == INTERPRET_RUNTIME_ERROR && status == 0) status = 70;
+        prism_free(jobs[i].output);
+        prism_free(jobs[i].error);
+        prism_free(sources[i]);
+    }
+    prism_free(sources);
+    prism_free(jobs);
+    
+    if (status != 0) exit(status);
+}
+
+// Builds the script ahead of time instead of running it
+static void compile_file(const char* path, const char* output_path) {
+    char* source = prism_read_file(path);
+    if (!source) {
+        fprintf(stderr, "Could not read file '%s'\n", path);
+        exit(74);
+    }
+    
+    Arena* arena = arena_create();
+    arena_set_current(arena);
+    Lexer* lexer = lexer_create(source, path);
+    lexer_scan_tokens(lexer);
+    Parser* parser = parser_create(lexer_get_tokens(lexer));
+    Program* program = NULL;
+    if (prism_get_last_error()->type == ERROR_NONE) {
+        program = parser_parse(parser);
+    }
+    arena_set_current(NULL);
+    
+    // Natives are registered first so calls to them bind like in vm_interpret
+    VM* vm = vm_create();
+    vm->code_gen = codegen_create();
+    prism_std_register_all(vm);
+    prism_io_register_all(vm);
+    if (prism_get_last_error()->type == ERROR_NONE) {
+        codegen_generate(vm->code_gen, program);
+    }
+    
+    parser_free(parser);
+    lexer_free(lexer);
+    arena_free(arena);
+    
+    bool compiled = prism_get_last_error()->type == ERROR_NONE;
+    bool built = compiled && aot_compile(vm->code_gen, output_path);
+    
+    vm_free(vm);
+    prism_free(source);
+    
+    if (!compiled) exit(65);
+    if (!built) exit(1);
+}
+
+// The script's path without its extension, or a.out if that would name
+// the script itself
+static char* default_output_path(const char* script_file) {
+    char* output = strdup(script_file);
+    char* dot = strrchr(output, '.');
+    char* slash = strrchr(output, '/');
+    if (dot && dot != output && (!slash || dot > slash + 1)) {
+        *dot = '\0';
+        return output;
+    }
+    prism_free(output);
+    return strdup("a.out");
+}
+
 int main(int argc, char* argv[]) {
     // Initialize standard library and IO
     prism_std_init();
     prism_io_init();
     
+#ifdef PRISM_PROFILE_PAIRS
+    // Also runs when a script exits early with an error status
+    atexit(print_pair_profile);
+#endif
+    
     if (argc == 1) {
         // No arguments, run REPL
         repl();
@@ -84,13 +222,21 @@ int main(int argc, char* argv[]) {
             repl();
         } else {
             // Assume it's a script file
-            run_file(argv[1]);
+            run_file(argv[1], false, false, false, false);
         }
     } else {
         // Multiple arguments, process them
         bool interactive = false;
         bool compile = false;
+        bool use_jit = false;
+        bool use_tracing = false;
+        bool use_parallel = false;
+        bool gc_stats = false;
         const char* script_file = NULL;
+        const char* output_path = NULL;
+        int workers = -1;
+        const char** scripts = prism_alloc(sizeof(char*) * argc);
+        int script_count = 0;
         
         for (int i = 1; i < argc; i++) {
             if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
@@ -103,16 +249,32 @@ int main(int argc, char* argv[]) {
                 interactive = true;
             } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--compile") == 0) {
                 compile = true;
+            } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jit") == 0) {
+                use_jit = true;
+            } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--trace") == 0) {
+                use_tracing = true;
+            } else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--auto-parallel") == 0) {
+                use_parallel = true;
+            } else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--gc-stats") == 0) {
+                gc_stats = true;
+            } else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i + 1 < argc) {
+                output_path = argv[++i];
+            } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--parallel") == 0) && i + 1 < argc) {
+                workers = atoi(argv[++i]);
             } else if (argv[i][0] != '-') {
                 script_file = argv[i];
+                scripts[script_count++] = argv[i];
             }
         }
         
-        if (compile && script_file) {
-            fprintf(stderr, "Compilation to bytecode not implemented yet\n");
-            return 1;
+        if (workers >= 0 && script_count > 0) {
+            run_parallel(scripts, script_count, workers, use_jit, use_tracing);
+        } else if (compile && script_file) {
+            char* default_path = output_path ? NULL : default_output_path(script_file);
+            compile_file(script_file, output_path ? output_path : default_path);
+            prism_free(default_path);
         } else if (script_file) {
-            run_file(script_file);
+            run_file(script_file, use_jit, use_tracing, use_parallel, gc_stats);
             if (interactive) {
                 repl();
             }
@@ -122,6 +284,7 @@ int main(int argc, char* argv[]) {
             print_usage(argv[0]);
             return 1;
         }
+        prism_free(scripts);
     }
     
     // Cleanup